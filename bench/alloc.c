@@ -0,0 +1,72 @@
+/**
+ * @file alloc.c HLS Performance client -- allocation counter
+ *
+ * Copyright (C) 2019 Creytiv.com
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <re.h>
+#include "bench.h"
+
+
+/*
+ * With glibc, the heap functions are replaced by wrappers that count
+ * the calls and forward to the glibc allocator. This also counts the
+ * allocations made inside libre. The benchmarks are single-threaded,
+ * so a plain counter is enough.
+ */
+
+
+#ifdef __GLIBC__
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void  __libc_free(void *ptr);
+
+static uint64_t n_alloc;
+
+
+void *malloc(size_t size)
+{
+	++n_alloc;
+	return __libc_malloc(size);
+}
+
+
+void *calloc(size_t nmemb, size_t size)
+{
+	++n_alloc;
+	return __libc_calloc(nmemb, size);
+}
+
+
+void *realloc(void *ptr, size_t size)
+{
+	++n_alloc;
+	return __libc_realloc(ptr, size);
+}
+
+
+void free(void *ptr)
+{
+	__libc_free(ptr);
+}
+
+#endif
+
+
+/* Get the number of heap allocations so far, ENOSYS if not counted */
+int bench_allocs(uint64_t *np)
+{
+	if (!np)
+		return EINVAL;
+
+#ifdef __GLIBC__
+	*np = n_alloc;
+	return 0;
+#else
+	return ENOSYS;
+#endif
+}
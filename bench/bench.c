@@ -0,0 +1,144 @@
+/**
+ * @file bench.c HLS Performance client -- microbenchmarks
+ *
+ * Copyright (C) 2019 Creytiv.com
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <re.h>
+#include "../src/hlsperf.h"
+#include "bench.h"
+
+
+/*
+ * Microbenchmarks of the per request code, on synthetic media
+ * playlists of 10, 1000 and 50000 lines. Each measurement reports
+ * the time and the number of heap allocations per operation.
+ */
+
+
+enum {
+	MIN_USEC = 200000  /* minimum run time per measurement */
+};
+
+
+/*
+ * Run `oph` for at least MIN_USEC. Returns the time per operation [ns]
+ * and the heap allocations per operation in *allocs, or -1 if they
+ * cannot be counted.
+ */
+double bench_measure(bench_op_h *oph, void *arg, double *allocs)
+{
+	uint64_t t0, t, a0 = 0, a1 = 0;
+	size_t n = 0;
+	bool counted;
+
+	counted = 0 == bench_allocs(&a0);
+
+	t0 = time_usec();
+
+	do {
+		n += oph(arg);
+		t = time_usec() - t0;
+	} while (t < MIN_USEC || !n);
+
+	counted = counted && 0 == bench_allocs(&a1);
+
+	if (allocs)
+		*allocs = counted ? (double)(a1 - a0) / n : -1;
+
+	return t * 1000.0 / n;
+}
+
+
+/* Run `oph` for at least MIN_USEC and print the cost per operation */
+double bench_run(const char *name, bench_op_h *oph, void *arg)
+{
+	double ns, allocs;
+
+	ns = bench_measure(oph, arg, &allocs);
+
+	if (allocs >= 0)
+		re_printf("  %-20s %12.1f ns/op %10.2f allocs/op\n",
+			  name, ns, allocs);
+	else
+		re_printf("  %-20s %12.1f ns/op %10s allocs/op\n",
+			  name, ns, "-");
+
+	return ns;
+}
+
+
+/* A live media playlist of `n_lines` lines, at least 6 */
+int bench_playlist(struct mbuf *mb, size_t n_lines)
+{
+	const size_t n_seg = (n_lines - 4) / 2;
+	size_t i;
+	int err;
+
+	err = mbuf_printf(mb,
+			  "#EXTM3U\n"
+			  "#EXT-X-VERSION:7\n"
+			  "#EXT-X-TARGETDURATION:4\n"
+			  "#EXT-X-MEDIA-SEQUENCE:%zu\n", 1000 + n_seg);
+
+	for (i=0; i<n_seg && !err; i++) {
+
+		err = mbuf_printf(mb,
+				  "#EXTINF:3.840000,\n"
+				  "media_0_%zu.m4s?slid=1234567\n",
+				  1000 + n_seg + i);
+	}
+
+	return err;
+}
+
+
+static int bench(size_t n_lines)
+{
+	struct mbuf *mb;
+	struct pl pl;
+	int err;
+
+	mb = mbuf_alloc(32 * n_lines + 128);
+	if (!mb)
+		return ENOMEM;
+
+	err = bench_playlist(mb, n_lines);
+	if (err)
+		goto out;
+
+	pl.p = (const char *)mb->buf;
+	pl.l = mb->end;
+
+	re_printf("%zu lines (%zu bytes):\n", n_lines, pl.l);
+
+	err = bench_parser(&pl, n_lines);
+	if (err)
+		goto out;
+
+	err = bench_hotpath(&pl);
+
+ out:
+	mem_deref(mb);
+
+	return err;
+}
+
+
+int main(void)
+{
+	static const size_t linev[] = {10, 1000, 50000};
+	size_t i;
+	int err;
+
+	re_printf("per request:\n");
+
+	err = bench_request();
+
+	for (i=0; i<ARRAY_SIZE(linev) && !err; i++)
+		err = bench(linev[i]);
+
+	return err ? 1 : 0;
+}
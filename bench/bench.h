@@ -0,0 +1,33 @@
+/**
+ * @file bench.h HLS Performance client -- microbenchmark interface
+ *
+ * Copyright (C) 2019 Creytiv.com
+ */
+
+
+/*
+ * Harness -- the handler does one or more operations per call and
+ * returns how many
+ */
+
+typedef size_t (bench_op_h)(void *arg);
+
+double bench_measure(bench_op_h *oph, void *arg, double *allocs);
+double bench_run(const char *name, bench_op_h *oph, void *arg);
+int    bench_playlist(struct mbuf *mb, size_t n_lines);
+
+
+/*
+ * Allocation counter
+ */
+
+int bench_allocs(uint64_t *np);
+
+
+/*
+ * Benchmarks
+ */
+
+int bench_parser(const struct pl *m3u8, size_t n_lines);
+int bench_hotpath(const struct pl *m3u8);
+int bench_request(void);
@@ -0,0 +1,252 @@
+/**
+ * @file hotpath.c HLS Performance client -- per request code
+ *
+ * Copyright (C) 2019 Creytiv.com
+ */
+
+#include <string.h>
+#include <re.h>
+#include "../src/hlsperf.h"
+#include "bench.h"
+
+
+/*
+ * The code that runs for every playlist reload and every request:
+ *
+ *   playlist_parse      the first load, every segment is new
+ *   playlist_reload     a reload where every segment is known
+ *   mediafile           segment added, taken with mediafile_next()
+ *                       and released, per segment
+ *   mediafile_heap      the same, without the object pool
+ *   mediafile_duration  the buffered duration of all listed segments
+ *   segment_uri         the request URI of each segment, as built for
+ *                       every segment request
+ *   hist_record         one latency sample
+ *
+ * The media playlist is not connected to a client, so nothing is
+ * requested; the playlist must not use LL-HLS parts. The names are
+ * shared through a string pool and the segments come from an object
+ * pool, as in a worker.
+ */
+
+
+enum {
+	N_SAMPLES    = 4096,
+	STRPOOL_SIZE = 1024,
+	MF_POOL_SIZE = 8192,
+};
+
+struct hotpath {
+	struct media_playlist mpl;
+	struct pools heap;        /* names shared, segments from the heap */
+	const struct pl *m3u8;
+	struct pl base;           /* URI of the media playlist */
+	struct le *le;            /* next segment name, segment_uri */
+};
+
+struct histbench {
+	struct hist h;
+	uint64_t samplev[N_SAMPLES];
+};
+
+
+static void mpl_reset(struct media_playlist *mpl)
+{
+	list_flush(&mpl->playlist);
+
+	mpl->seq      = 0;
+	mpl->next_msn = 0;
+	mpl->end_msn  = 0;
+	mpl->ts_avail = 0;
+}
+
+
+static size_t parse_op(void *arg)
+{
+	struct hotpath *hp = arg;
+
+	mpl_reset(&hp->mpl);
+	(void)playlist_parse(&hp->mpl, hp->m3u8);
+
+	return 1;
+}
+
+
+static size_t reload_op(void *arg)
+{
+	struct hotpath *hp = arg;
+
+	(void)playlist_parse(&hp->mpl, hp->m3u8);
+
+	return 1;
+}
+
+
+/* the names of the parsed playlist are added again, then played */
+static size_t mediafile_run(struct hotpath *hp, const struct pools *pools)
+{
+	struct list lst = LIST_INIT;
+	struct mediafile *mf;
+	struct pl name;
+	struct le *le;
+	size_t n = 0;
+
+	for (le = hp->mpl.playlist.head; le; le = le->next) {
+
+		mf = le->data;
+
+		pl_set_str(&name, mf->filename);
+		(void)mediafile_new(&lst, pools, &name, mf->msn,
+				    mf->duration);
+	}
+
+	while ((mf = mediafile_next(&lst))) {
+		mem_deref(mf);
+		++n;
+	}
+
+	return n;
+}
+
+
+static size_t mediafile_op(void *arg)
+{
+	struct hotpath *hp = arg;
+
+	return mediafile_run(hp, &hp->mpl.pools);
+}
+
+
+static size_t mediafile_heap_op(void *arg)
+{
+	struct hotpath *hp = arg;
+
+	return mediafile_run(hp, &hp->heap);
+}
+
+
+static size_t duration_op(void *arg)
+{
+	struct hotpath *hp = arg;
+	volatile double dur;
+
+	dur = mediafile_duration(&hp->mpl.playlist);
+	(void)dur;
+
+	return 1;
+}
+
+
+static size_t uri_op(void *arg)
+{
+	struct hotpath *hp = arg;
+	const struct mediafile *mf;
+	struct pl name;
+	char uri[512];
+
+	if (!hp->le)
+		hp->le = hp->mpl.playlist.head;
+
+	mf = hp->le->data;
+	hp->le = hp->le->next;
+
+	pl_set_str(&name, mf->filename);
+	(void)m3u8_uri_resolve(uri, sizeof(uri), &hp->base, &name);
+
+	return 1;
+}
+
+
+static size_t hist_op(void *arg)
+{
+	struct histbench *hb = arg;
+	size_t i;
+
+	for (i=0; i<N_SAMPLES; i++)
+		hist_record(&hb->h, hb->samplev[i]);
+
+	return N_SAMPLES;
+}
+
+
+int bench_hotpath(const struct pl *m3u8)
+{
+	struct hotpath hp;
+	int err;
+
+	if (!m3u8)
+		return EINVAL;
+
+	memset(&hp, 0, sizeof(hp));
+
+	err = strpool_alloc(&hp.mpl.pools.sp, STRPOOL_SIZE);
+	if (err)
+		return err;
+
+	err = mediafile_pool_alloc(&hp.mpl.pools.mf, MF_POOL_SIZE);
+	if (err)
+		goto out;
+
+	hp.heap.sp = hp.mpl.pools.sp;
+
+	list_init(&hp.mpl.playlist);
+	list_init(&hp.mpl.parts);
+	hp.mpl.last_dur = 10.0;
+	hp.mpl.rend     = TRACE_NO_REND;
+
+	hp.m3u8 = m3u8;
+	pl_set_str(&hp.base,
+		   "http://origin.example.com/live/event/index.m3u8");
+
+	bench_run("playlist_parse", parse_op, &hp);
+	bench_run("playlist_reload", reload_op, &hp);
+
+	if (!list_head(&hp.mpl.playlist)) {
+		re_fprintf(stderr, "no segments in the playlist\n");
+		err = EPROTO;
+		goto out;
+	}
+
+	bench_run("mediafile", mediafile_op, &hp);
+	bench_run("mediafile_heap", mediafile_heap_op, &hp);
+	bench_run("mediafile_duration", duration_op, &hp);
+	bench_run("segment_uri", uri_op, &hp);
+
+ out:
+	list_flush(&hp.mpl.playlist);
+	mem_deref(hp.mpl.pools.mf);
+	mem_deref(hp.mpl.pools.sp);
+
+	return err;
+}
+
+
+/* does not depend on the playlist size */
+int bench_request(void)
+{
+	struct histbench *hb;
+	uint64_t x = 88172645463325252ULL;
+	size_t i;
+
+	hb = mem_zalloc(sizeof(*hb), NULL);
+	if (!hb)
+		return ENOMEM;
+
+	hist_init(&hb->h);
+
+	/* request times of 100 us to ~3 s, log-uniform (xorshift64) */
+	for (i=0; i<N_SAMPLES; i++) {
+
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+
+		hb->samplev[i] = (100ULL << (x % 16)) + (x >> 48) % 100;
+	}
+
+	bench_run("hist_record", hist_op, hb);
+
+	mem_deref(hb);
+
+	return 0;
+}
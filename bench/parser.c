@@ -0,0 +1,180 @@
+/**
+ * @file parser.c HLS Performance client -- parser microbenchmark
+ *
+ * Copyright (C) 2019 Creytiv.com
+ */
+
+#include <string.h>
+#include <re.h>
+#include "../src/hlsperf.h"
+#include "bench.h"
+
+
+/*
+ * Compares the M3U8 tokenizer with the previous re_regex based line
+ * handler. Both do the same work per line: EXTINF duration, media
+ * sequence number and the extension of every segment URI.
+ */
+
+
+struct result {
+	double dur;
+	uint64_t seq;
+	size_t n_uri;
+};
+
+struct parser {
+	void (*parse)(struct result *, const struct pl *);
+	const struct pl *m3u8;
+	struct result res;
+};
+
+
+/* the parser as it was before the tokenizer, without allocations */
+static void regex_line(struct result *res, const struct pl *line)
+{
+	struct pl file, ext;
+
+	if (line->p[0] == '#') {
+
+		struct pl pl_dur, pl_seq;
+
+		if (0 == re_regex(line->p, line->l,
+				  "EXTINF:[0-9.]+", &pl_dur)) {
+
+			res->dur += pl_float(&pl_dur);
+		}
+		else if (0 == re_regex(line->p, line->l,
+				       "EXT-X-MEDIA-SEQUENCE:[0-9]+",
+				       &pl_seq)) {
+
+			res->seq = pl_u64(&pl_seq);
+		}
+
+		return;
+	}
+
+	if (re_regex(line->p, line->l, "[^.]+.[a-z0-9]+", &file, &ext))
+		return;
+
+	if (0 == pl_strcasecmp(&ext, "m4s"))
+		++res->n_uri;
+}
+
+
+static void regex_parse(struct result *res, const struct pl *playlist)
+{
+	struct pl pl = *playlist;
+
+	while (pl.l > 1) {
+
+		const char *end;
+		struct pl line;
+
+		end = pl_strchr(&pl, '\n');
+		if (!end)
+			break;
+
+		line.p = pl.p;
+		line.l = end - pl.p;
+
+		regex_line(res, &line);
+
+		pl_advance(&pl, line.l + 1);
+	}
+}
+
+
+static bool m3u8_line(const struct m3u8_line *ml, void *arg)
+{
+	struct result *res = arg;
+	struct pl ext;
+
+	switch (ml->tag) {
+
+	case M3U8_EXTINF:
+		res->dur += m3u8_decimal(&ml->val);
+		break;
+
+	case M3U8_MEDIA_SEQUENCE:
+		res->seq = pl_u64(&ml->val);
+		break;
+
+	case M3U8_URI:
+		if (0 == m3u8_uri_ext(&ml->val, &ext) &&
+		    0 == pl_strcasecmp(&ext, "m4s"))
+			++res->n_uri;
+		break;
+
+	default:
+		break;
+	}
+
+	return false;
+}
+
+
+static void tokenizer_parse(struct result *res, const struct pl *playlist)
+{
+	m3u8_parse(playlist, m3u8_line, res);
+}
+
+
+/* one playlist per operation */
+static size_t parser_op(void *arg)
+{
+	struct parser *p = arg;
+
+	memset(&p->res, 0, sizeof(p->res));
+	p->parse(&p->res, p->m3u8);
+
+	return 1;
+}
+
+
+/* one playlist per operation, with the line rate of the parser */
+static double parser_run(const char *name, struct parser *p,
+			 size_t n_lines)
+{
+	double ns, allocs;
+
+	ns = bench_measure(parser_op, p, &allocs);
+
+	if (allocs >= 0)
+		re_printf("  %-20s %12.1f ns/playlist %12.0f lines/s"
+			  " %10.2f allocs/op\n",
+			  name, ns, n_lines * 1e9 / ns, allocs);
+	else
+		re_printf("  %-20s %12.1f ns/playlist %12.0f lines/s"
+			  " %10s allocs/op\n",
+			  name, ns, n_lines * 1e9 / ns, "-");
+
+	return ns;
+}
+
+
+int bench_parser(const struct pl *m3u8, size_t n_lines)
+{
+	struct parser rx, tok;
+	double ns_rx, ns_tok;
+
+	if (!m3u8 || !n_lines)
+		return EINVAL;
+
+	rx.parse   = regex_parse;
+	rx.m3u8    = m3u8;
+	tok.parse  = tokenizer_parse;
+	tok.m3u8   = m3u8;
+
+	ns_rx  = parser_run("re_regex", &rx, n_lines);
+	ns_tok = parser_run("m3u8_parse", &tok, n_lines);
+
+	re_printf("  %-20s %12.1fx\n", "speedup", ns_rx / ns_tok);
+
+	if (rx.res.seq != tok.res.seq || rx.res.n_uri != tok.res.n_uri) {
+		re_fprintf(stderr, "parser results differ\n");
+		return EPROTO;
+	}
+
+	return 0;
+}
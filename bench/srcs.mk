@@ -0,0 +1,10 @@
+#
+# srcs.mk All benchmark source files.
+#
+# Copyright (C) 2019 Creytiv.com
+#
+
+BENCH_SRCS	+= alloc.c
+BENCH_SRCS	+= bench.c
+BENCH_SRCS	+= hotpath.c
+BENCH_SRCS	+= parser.c
@@ -0,0 +1,304 @@
+/**
+ * @file abr.c HLS Performance client -- adaptive bitrate controller
+ *
+ * Copyright (C) 2019 Creytiv.com
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <re.h>
+#include "hlsperf.h"
+
+
+/*
+ * One controller per session selects the variant stream for the next
+ * segment. Its inputs are the segment download throughput and the
+ * player buffer level. Variants are ordered by bandwidth, index 0 is
+ * the lowest.
+ */
+
+
+enum {
+	HYBRID_LEVEL = 10,  /* [s] below this the hybrid uses throughput */
+};
+
+#define SAFETY     0.9   /* fraction of the estimate that may be used */
+#define HL_FAST    3.0   /* EWMA half-life [s of media] */
+#define HL_SLOW    8.0
+#define BOLA_GAMMA 5.0   /* BOLA gamma*p, preference for rebuffer safety */
+
+
+struct abr {
+	const struct abr_algo *algo;
+	const struct rendition **varv;  /* variants by bandwidth */
+	uint64_t *timev;                /* time spent per variant [us] */
+	uint32_t varc;
+	uint32_t cur;
+	double tput_fast;               /* [kbit/s] */
+	double tput_slow;
+	double weight;                  /* media duration sampled [s] */
+	uint64_t ts;                    /* [us] */
+	uint32_t n_switch;
+};
+
+
+static void destructor(void *data)
+{
+	struct abr *abr = data;
+
+	mem_deref(abr->varv);
+	mem_deref(abr->timev);
+}
+
+
+/* bias corrected minimum of the fast and slow estimate [kbit/s] */
+static double tput_estimate(const struct abr *abr)
+{
+	double fast, slow;
+
+	if (abr->weight <= 0.0)
+		return 0.0;
+
+	fast = abr->tput_fast / (1 - pow(0.5, abr->weight / HL_FAST));
+	slow = abr->tput_slow / (1 - pow(0.5, abr->weight / HL_SLOW));
+
+	return min(fast, slow);
+}
+
+
+/* highest variant that fits into the throughput estimate */
+static uint32_t select_throughput(const struct abr *abr, double level,
+				  double seg_dur, double buf_max)
+{
+	const double kbps = tput_estimate(abr) * SAFETY;
+	uint32_t i, sel = 0;
+	(void)level;
+	(void)seg_dur;
+	(void)buf_max;
+
+	if (kbps <= 0.0)
+		return abr->cur;
+
+	for (i=0; i<abr->varc; i++) {
+
+		if (abr->varv[i]->bandwidth <= kbps * 1000)
+			sel = i;
+	}
+
+	return sel;
+}
+
+
+/*
+ * BOLA-BASIC (Spiteri et al.): maximize (V*(v_m + gp) - Q) / S_m
+ * with utility v_m = ln(S_m/S_0), Q the buffer level in segments and
+ * V chosen so that the top variant is used when the buffer is full.
+ */
+static uint32_t select_bola(const struct abr *abr, double level,
+			    double seg_dur, double buf_max)
+{
+	const double s0 = max(abr->varv[0]->bandwidth, 1);
+	double v_max, V, q, q_max, best = -1e300;
+	uint32_t i, sel = 0;
+
+	if (seg_dur <= 0.0)
+		return abr->cur;
+
+	q     = level / seg_dur;
+	q_max = max(buf_max / seg_dur, 2.0);
+	v_max = log(max(abr->varv[abr->varc-1]->bandwidth, 1) / s0);
+	V     = (q_max - 1) / (v_max + BOLA_GAMMA);
+
+	for (i=0; i<abr->varc; i++) {
+
+		const double s = max(abr->varv[i]->bandwidth, 1);
+		const double score = (V * (log(s / s0) + BOLA_GAMMA) - q) / s;
+
+		if (score >= best) {
+			best = score;
+			sel  = i;
+		}
+	}
+
+	return sel;
+}
+
+
+/* throughput while the buffer is low, BOLA once it has built up */
+static uint32_t select_hybrid(const struct abr *abr, double level,
+			      double seg_dur, double buf_max)
+{
+	if (level < HYBRID_LEVEL)
+		return select_throughput(abr, level, seg_dur, buf_max);
+
+	return select_bola(abr, level, seg_dur, buf_max);
+}
+
+
+static const struct abr_algo algov[] = {
+	{"throughput", select_throughput},
+	{"buffer",     select_bola},
+	{"hybrid",     select_hybrid},
+};
+
+
+const struct abr_algo *abr_algo_find(const char *name)
+{
+	size_t i;
+
+	for (i=0; i<ARRAY_SIZE(algov); i++) {
+
+		if (0 == str_casecmp(algov[i].name, name))
+			return &algov[i];
+	}
+
+	return NULL;
+}
+
+
+static int rend_cmp(const void *a, const void *b)
+{
+	const struct rendition * const *ra = a;
+	const struct rendition * const *rb = b;
+
+	if ((*ra)->bandwidth != (*rb)->bandwidth)
+		return (*ra)->bandwidth < (*rb)->bandwidth ? -1 : 1;
+
+	/* stable for equal bandwidth */
+	return *ra < *rb ? -1 : (*ra > *rb);
+}
+
+
+/*
+ * Allocate a controller for the variants of `rt`, starting with
+ * variant `start`
+ */
+int abr_alloc(struct abr **abrp, const struct abr_algo *algo,
+	      const struct rendtab *rt, const struct rendition *start)
+{
+	struct abr *abr;
+	uint32_t i;
+	int err = 0;
+
+	if (!abrp || !algo || !rt || !start)
+		return EINVAL;
+
+	abr = mem_zalloc(sizeof(*abr), destructor);
+	if (!abr)
+		return ENOMEM;
+
+	abr->algo = algo;
+
+	abr->varv  = mem_zalloc(rt->rendc * sizeof(*abr->varv), NULL);
+	abr->timev = mem_zalloc(rt->rendc * sizeof(*abr->timev), NULL);
+	if (!abr->varv || !abr->timev) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	for (i=0; i<rt->rendc; i++) {
+
+		if (rt->rendv[i].type == RENDITION_VARIANT)
+			abr->varv[abr->varc++] = &rt->rendv[i];
+	}
+
+	qsort(abr->varv, abr->varc, sizeof(*abr->varv), rend_cmp);
+
+	for (i=0; i<abr->varc; i++) {
+
+		if (abr->varv[i] == start)
+			abr->cur = i;
+	}
+
+	abr->ts = time_usec();
+
+ out:
+	if (err)
+		mem_deref(abr);
+	else
+		*abrp = abr;
+
+	return err;
+}
+
+
+/* a segment of `duration` [s] was received at `kbps` */
+void abr_sample(struct abr *abr, double kbps, double duration)
+{
+	double a;
+
+	if (!abr || duration <= 0.0)
+		return;
+
+	a = pow(0.5, duration / HL_FAST);
+	abr->tput_fast = a * abr->tput_fast + (1 - a) * kbps;
+
+	a = pow(0.5, duration / HL_SLOW);
+	abr->tput_slow = a * abr->tput_slow + (1 - a) * kbps;
+
+	abr->weight += duration;
+}
+
+
+/*
+ * Select the variant for the next segment. Returns the new variant,
+ * or NULL if the current one should be kept.
+ */
+const struct rendition *abr_select(struct abr *abr, double level,
+				   double seg_dur, double buf_max)
+{
+	uint64_t now;
+	uint32_t sel;
+
+	if (!abr || !abr->varc || !abr->ts)
+		return NULL;
+
+	sel = abr->algo->selecth(abr, level, seg_dur, buf_max);
+	if (sel >= abr->varc || sel == abr->cur)
+		return NULL;
+
+	now = time_usec();
+
+	abr->timev[abr->cur] += now - abr->ts;
+	abr->ts  = now;
+	abr->cur = sel;
+	++abr->n_switch;
+
+	return abr->varv[sel];
+}
+
+
+/* end of the session, account the time in the current variant */
+void abr_close(struct abr *abr)
+{
+	uint64_t now;
+
+	if (!abr || !abr->ts)
+		return;
+
+	now = time_usec();
+
+	abr->timev[abr->cur] += now - abr->ts;
+	abr->ts = 0;
+}
+
+
+uint32_t abr_switches(const struct abr *abr)
+{
+	return abr ? abr->n_switch : 0;
+}
+
+
+/* variant `ix` (by bandwidth) and the time spent in it [us] */
+const struct rendition *abr_variant(const struct abr *abr, uint32_t ix,
+				    uint64_t *time)
+{
+	if (!abr || ix >= abr->varc)
+		return NULL;
+
+	if (time)
+		*time = abr->timev[ix];
+
+	return abr->varv[ix];
+}
@@ -0,0 +1,582 @@
+/**
+ * @file agent.c HLS Performance client -- load agent
+ *
+ * Copyright (C) 2019 Creytiv.com
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <re.h>
+#include "hlsperf.h"
+
+
+#define DEBUG_MODULE "hlsperf"
+#define DEBUG_LEVEL 6
+#include <re_dbg.h>
+
+
+/*
+ * An agent runs the sessions of one controller. It is configured by
+ * the controller, starts its workers at the start time given by the
+ * controller, sends a snapshot of its metrics every second and its
+ * final metrics and summary when told to stop.
+ *
+ * An agent serves one run. It exits when the controller closes the
+ * link, or when the link is lost.
+ */
+
+
+enum {
+	STATS_INTERVAL = 1000,    /* [ms] */
+};
+
+struct agent {
+	struct config cfg;
+	struct link *lk;
+	int lfd;                  /* listening socket, -1 if none */
+	char *uri;
+	uint32_t num_sess;
+	uint32_t num_workers;
+	unsigned agents;          /* share of the profile, 1/agents */
+	struct worker **wv;
+	struct tmr tmr_start;
+	struct tmr tmr_stats;
+	struct metrics m;         /* sent with STATS and DONE */
+	struct metrics snap;
+	struct memusage mu;
+	bool configured;
+	bool done;
+};
+
+
+static void destructor(void *data)
+{
+	struct agent *ag = data;
+	uint32_t i;
+
+	tmr_cancel(&ag->tmr_start);
+	tmr_cancel(&ag->tmr_stats);
+
+	if (ag->wv) {
+		for (i=0; i<ag->num_workers; i++) {
+			worker_stop(ag->wv[i]);
+			mem_deref(ag->wv[i]);
+		}
+	}
+
+	if (ag->lfd >= 0) {
+		fd_close(ag->lfd);
+		(void)close(ag->lfd);
+	}
+
+	mem_deref(ag->wv);
+	mem_deref(ag->lk);
+	mem_deref(ag->uri);
+	mem_deref(ag->cfg.profile);
+}
+
+
+static void send_error(struct agent *ag, int err, const char *what)
+{
+	char buf[256];
+	int n;
+
+	n = re_snprintf(buf, sizeof(buf), "%s: %m", what, err);
+	if (n < 0)
+		return;
+
+	(void)link_send(ag->lk, MSG_ERROR, (uint8_t *)buf, n);
+}
+
+
+static int config_set(struct agent *ag, const struct pl *key,
+		      const struct pl *val)
+{
+	char *str;
+	int err;
+
+	err = pl_strdup(&str, val);
+	if (err)
+		return err;
+
+	if (0 == pl_strcmp(key, "uri")) {
+		mem_deref(ag->uri);
+		ag->uri = mem_ref(str);
+	}
+	else if (0 == pl_strcmp(key, "sessions")) {
+		ag->num_sess = pl_u32(val);
+	}
+	else if (0 == pl_strcmp(key, "workers")) {
+		ag->num_workers = pl_u32(val);
+	}
+	else if (0 == pl_strcmp(key, "agents")) {
+		ag->agents = pl_u32(val);
+	}
+	else if (0 == pl_strcmp(key, "llhls")) {
+		ag->cfg.llhls = pl_u32(val) != 0;
+	}
+	else if (0 == pl_strcmp(key, "validate")) {
+		ag->cfg.validate = pl_u32(val) != 0;
+	}
+	else if (0 == pl_strcmp(key, "abr")) {
+		ag->cfg.abr = abr_algo_find(str);
+		if (!ag->cfg.abr)
+			err = ENOENT;
+	}
+	else if (0 == pl_strcmp(key, "pool")) {
+		err = httpc_conf_decode(&ag->cfg.http, str);
+	}
+	else if (0 == pl_strcmp(key, "links")) {
+		err = linkmix_decode(&ag->cfg.links, str);
+	}
+	else if (0 == pl_strcmp(key, "lifetime")) {
+		err = dist_decode(&ag->cfg.lifetime, str);
+	}
+	else if (0 == pl_strcmp(key, "profile")) {
+		ag->cfg.profile = mem_deref(ag->cfg.profile);
+		err = profile_decode(&ag->cfg.profile, str);
+	}
+
+	/* unknown keys are ignored */
+
+	mem_deref(str);
+
+	return err;
+}
+
+
+/* key=value lines, see MSG_CONFIG */
+static int config_decode(struct agent *ag, const struct mbuf *mb)
+{
+	struct pl text;
+	int err;
+
+	pl_set_mbuf(&text, mb);
+
+	while (text.l) {
+
+		struct pl line, key, val;
+		const char *nl, *eq;
+
+		nl = pl_strchr(&text, '\n');
+
+		line.p = text.p;
+		line.l = nl ? (size_t)(nl - text.p) : text.l;
+
+		pl_advance(&text, nl ? line.l + 1 : line.l);
+
+		eq = pl_strchr(&line, '=');
+		if (!eq)
+			continue;
+
+		key.p = line.p;
+		key.l = eq - line.p;
+		val.p = eq + 1;
+		val.l = line.l - key.l - 1;
+
+		err = config_set(ag, &key, &val);
+		if (err) {
+			re_fprintf(stderr, "agent: invalid config %r=%r\n",
+				   &key, &val);
+			return err;
+		}
+	}
+
+	if (!ag->uri || !ag->agents)
+		return EINVAL;
+
+	if (ag->cfg.profile)
+		profile_scale(ag->cfg.profile, 1.0 / ag->agents);
+
+	if (ag->num_workers == 0) {
+		long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		ag->num_workers = ncpu > 0 ? (uint32_t)ncpu : 1;
+	}
+	if (!ag->cfg.profile)
+		ag->num_workers = min(ag->num_workers, max(ag->num_sess, 1));
+
+	ag->cfg.workers = ag->num_workers;
+
+	return 0;
+}
+
+
+/* sum of the worker metrics, while they are running */
+static void metrics_collect(struct agent *ag)
+{
+	uint32_t i;
+
+	metrics_init(&ag->m);
+
+	for (i=0; i<ag->num_workers; i++) {
+
+		const struct metrics *wm = worker_metrics(ag->wv[i]);
+
+		if (!wm)
+			continue;
+
+		metrics_load(&ag->snap, wm);
+		metrics_merge(&ag->m, &ag->snap);
+	}
+}
+
+
+static void tmr_stats_handler(void *arg)
+{
+	struct agent *ag = arg;
+
+	tmr_start(&ag->tmr_stats, STATS_INTERVAL, tmr_stats_handler, ag);
+
+	metrics_collect(ag);
+	memusage_sample(&ag->mu, ag->m.n_active);
+
+	(void)link_send(ag->lk, MSG_STATS, (uint8_t *)&ag->m, sizeof(ag->m));
+}
+
+
+static void tmr_start_handler(void *arg)
+{
+	struct agent *ag = arg;
+	uint32_t i;
+	int err;
+
+	ag->wv = mem_zalloc(ag->num_workers * sizeof(*ag->wv), NULL);
+	if (!ag->wv) {
+		send_error(ag, ENOMEM, "start");
+		return;
+	}
+
+	memusage_init(&ag->mu);
+
+	/* spread the sessions evenly over the workers */
+	for (i=0; i<ag->num_workers; i++) {
+
+		uint32_t n = ag->num_sess / ag->num_workers;
+
+		if (i < ag->num_sess % ag->num_workers)
+			++n;
+
+		err = worker_alloc(&ag->wv[i], i, &ag->cfg, ag->uri, n);
+		if (err) {
+			send_error(ag, err, "worker");
+			return;
+		}
+	}
+
+	tmr_start(&ag->tmr_stats, STATS_INTERVAL, tmr_stats_handler, ag);
+}
+
+
+/* stop the workers and send the final metrics and summary */
+static void agent_done(struct agent *ag)
+{
+	struct summary sum;
+	struct mbuf *mb;
+	uint32_t i;
+	int err;
+
+	if (ag->done)
+		return;
+
+	ag->done = true;
+
+	tmr_cancel(&ag->tmr_start);
+	tmr_cancel(&ag->tmr_stats);
+
+	if (ag->wv) {
+		metrics_collect(ag);
+		memusage_sample(&ag->mu, ag->m.n_active);
+	}
+
+	summary_init(&sum);
+	metrics_init(&ag->m);
+
+	for (i=0; ag->wv && i<ag->num_workers; i++) {
+
+		const struct metrics *wm;
+
+		worker_stop(ag->wv[i]);
+		worker_summary(ag->wv[i], &sum);
+
+		wm = worker_metrics(ag->wv[i]);
+		if (wm)
+			metrics_merge(&ag->m, wm);
+	}
+
+	sum.mem_bytes = ag->mu.bytes;
+	sum.mem_sess  = ag->mu.n_sess;
+
+	mb = mbuf_alloc(sizeof(ag->m) + 1024);
+	if (!mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err  = mbuf_write_mem(mb, (uint8_t *)&ag->m, sizeof(ag->m));
+	err |= summary_encode(mb, &sum);
+	if (err)
+		goto out;
+
+	err = link_send(ag->lk, MSG_DONE, mb->buf, mb->end);
+
+ out:
+	if (err)
+		DEBUG_WARNING("agent: could not send summary (%m)\n", err);
+
+	mem_deref(mb);
+	summary_reset(&sum);
+}
+
+
+static void msg_handler(uint32_t type, struct mbuf *mb, void *arg)
+{
+	struct agent *ag = arg;
+	uint32_t workers;
+	uint64_t start, now;
+	int err;
+
+	switch (type) {
+
+	case MSG_CONFIG:
+		if (ag->configured) {
+			send_error(ag, EALREADY, "config");
+			break;
+		}
+
+		err = config_decode(ag, mb);
+		if (err) {
+			send_error(ag, err, "config");
+			break;
+		}
+
+		ag->configured = true;
+
+		workers = ag->num_workers;
+		(void)link_send(ag->lk, MSG_READY,
+				(uint8_t *)&workers, sizeof(workers));
+		break;
+
+	case MSG_START:
+		if (!ag->configured || ag->wv ||
+		    mbuf_get_left(mb) < sizeof(start)) {
+			send_error(ag, EPROTO, "start");
+			break;
+		}
+
+		start = mbuf_read_u64(mb);
+		now   = time_wall();
+		start = start > now ? (start - now) / 1000 : 0;
+
+		tmr_start(&ag->tmr_start, start, tmr_start_handler, ag);
+		break;
+
+	case MSG_STOP:
+		agent_done(ag);
+		break;
+
+	default:
+		break;
+	}
+}
+
+
+static void close_handler(int err, void *arg)
+{
+	struct agent *ag = arg;
+
+	if (!ag->done)
+		re_fprintf(stderr, "agent: controller lost (%m)\n", err);
+
+	re_cancel();
+}
+
+
+static int agent_attach(struct agent *ag, int fd)
+{
+	uint32_t hello[3];
+	int err;
+
+	err = link_alloc(&ag->lk, fd, msg_handler, close_handler, ag);
+	if (err)
+		return err;
+
+	hello[0] = AGENT_MAGIC;
+	hello[1] = AGENT_VERSION;
+	hello[2] = sizeof(struct metrics);
+
+	return link_send(ag->lk, MSG_HELLO, (uint8_t *)hello, sizeof(hello));
+}
+
+
+/* the first controller is served, the socket is closed */
+static void accept_handler(int flags, void *arg)
+{
+	struct agent *ag = arg;
+	struct sa peer;
+	int fd, err;
+
+	peer.len = sizeof(peer.u);
+
+	fd = accept(ag->lfd, &peer.u.sa, &peer.len);
+	if (fd < 0)
+		return;
+
+	(void)fcntl(fd, F_SETFL, O_NONBLOCK);
+
+	fd_close(ag->lfd);
+	(void)close(ag->lfd);
+	ag->lfd = -1;
+
+	re_printf("agent: controller %J\n", &peer);
+
+	err = agent_attach(ag, fd);
+	if (err) {
+		re_fprintf(stderr, "agent: %m\n", err);
+		re_cancel();
+	}
+}
+
+
+static void signal_handler(int signum)
+{
+	re_fprintf(stderr, "agent: terminated on signal %d\n", signum);
+
+	re_cancel();
+}
+
+
+/* serve one controller, on the listening socket `lfd` or link `fd` */
+static int agent_main(int lfd, int fd)
+{
+	struct agent *ag;
+	int err;
+
+	err = fd_setsize(2048);
+	if (!err)
+		err = libre_init();
+	if (err) {
+		if (lfd >= 0)
+			(void)close(lfd);
+		if (fd >= 0)
+			(void)close(fd);
+		return err;
+	}
+
+	ag = mem_zalloc(sizeof(*ag), destructor);
+	if (!ag) {
+		if (lfd >= 0)
+			(void)close(lfd);
+		if (fd >= 0)
+			(void)close(fd);
+		err = ENOMEM;
+		goto out;
+	}
+
+	ag->lfd = lfd;
+
+	tmr_init(&ag->tmr_start);
+	tmr_init(&ag->tmr_stats);
+
+	if (fd >= 0)
+		err = agent_attach(ag, fd);
+	else
+		err = fd_listen(ag->lfd, FD_READ, accept_handler, ag);
+	if (err)
+		goto out;
+
+	(void)re_main(signal_handler);
+
+ out:
+	mem_deref(ag);
+	libre_close();
+
+	return err;
+}
+
+
+/* Run as an agent, listening for a controller on `addr` (ip:port) */
+int agent_run(const char *addr)
+{
+	struct sa laddr;
+	int fd, one = 1;
+	int err;
+
+	if (!addr)
+		return EINVAL;
+
+	err = sa_decode(&laddr, addr, strlen(addr));
+	if (err)
+		return err;
+
+	fd = socket(sa_af(&laddr), SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (fd < 0)
+		return errno;
+
+	(void)setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	if (bind(fd, &laddr.u.sa, laddr.len) || listen(fd, 4)) {
+		err = errno;
+		(void)close(fd);
+		return err;
+	}
+
+	re_printf("agent: listening on %J\n", &laddr);
+
+	return agent_main(fd, -1);
+}
+
+
+/*
+ * Start a local agent, a child process connected over a socket pair.
+ * The child closes the descriptors in `closev`, the links of the
+ * agents started before it.
+ */
+int agent_spawn(int *fdp, pid_t *pidp, const int *closev, size_t closec)
+{
+	int sv[2];
+	pid_t pid;
+	size_t i;
+	int err;
+
+	if (!fdp || !pidp)
+		return EINVAL;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv))
+		return errno;
+
+	/* nothing buffered may be written twice */
+	(void)fflush(NULL);
+
+	pid = fork();
+	if (pid < 0) {
+		err = errno;
+		(void)close(sv[0]);
+		(void)close(sv[1]);
+		return err;
+	}
+
+	if (pid == 0) {
+		(void)close(sv[0]);
+
+		for (i=0; i<closec; i++)
+			(void)close(closev[i]);
+
+		/* keep terminal signals with the controller */
+		(void)setpgid(0, 0);
+
+		exit(agent_main(-1, sv[1]) ? 1 : 0);
+	}
+
+	(void)close(sv[1]);
+
+	*fdp  = sv[0];
+	*pidp = pid;
+
+	return 0;
+}
@@ -15,16 +15,18 @@
 
 
 struct client {
-	struct http_cli *cli;
-	struct dnsc *dnsc;
-	struct mqueue *mqueue;
-	char *uri;
-	struct pl path;
-	struct media_playlist *mplv[MAX_PLAYLISTS];
+	struct httpc *cli;
+	struct metrics *metrics;
+	struct pools pools;
+	const struct config *cfg;
+	const char *uri;    /* not copied, it outlives the sessions */
+	struct rendtab *rt;
+	struct abr *abr;
+	struct media_playlist *mplv[MEDIA_TYPES];
 	uint32_t slid;
 	struct tmr tmr_load;
-	uint64_t ts_start;
-	uint64_t ts_conn;
+	uint64_t ts_start;  /* [us] */
+	uint64_t ts_conn;   /* [us] */
 	bool connected;
 	bool terminated;
 	int saved_err;
@@ -35,7 +37,8 @@ struct client {
 
 
 static int load_playlist(struct client *cli);
-static void http_resp_handler(int err, const struct http_msg *msg, void *arg);
+static void http_resp_handler(int err, const struct http_msg *msg,
+			      const struct httpc_timing *t, void *arg);
 
 
 static void destructor(void *data)
@@ -52,161 +55,118 @@ static void destructor(void *data)
 	}
 
 	mem_deref(cli->cli);
-	mem_deref(cli->dnsc);
-	mem_deref(cli->uri);
-	mem_deref(cli->mqueue);
+	mem_deref(cli->abr);
+	mem_deref(cli->rt);
 }
 
 
-static int add_playlist(struct client *cli, const char *filename)
+static int add_playlist(struct client *cli, enum media_type type,
+			const struct rendition *r)
 {
-	struct pl media_ix;
-	int err = 0;
-
-	if (0 == re_regex(filename, str_len(filename),
-			  "media_[0-9]+", &media_ix)) {
-
-		unsigned ix = pl_u32(&media_ix);
+	int err;
 
-		if (ix >= ARRAY_SIZE(cli->mplv))
-			return 0;
+	if (!r || cli->mplv[type])
+		return 0;
 
-		err = playlist_new(&cli->mplv[ix], cli, filename);
-		if (err)
-			goto out;
+	err = playlist_new(&cli->mplv[type], cli, r->uri);
+	if (err)
+		return err;
 
-		err = playlist_start(cli->mplv[ix]);
-		if (err)
-			goto out;
-	}
-	else {
-		DEBUG_WARNING("m3u8 file not handled (%s)\n", filename);
-	}
+	cli->mplv[type]->rend = (uint16_t)(r - cli->rt->rendv);
 
- out:
-	return err;
+	return playlist_start(cli->mplv[type]);
 }
 
 
-static void handle_line(struct client *cli, const struct pl *line)
+/*
+ * Decode the rendition table and start like a player does:
+ * the first variant stream plus the matching audio rendition
+ */
+static int handle_hls_playlist(struct client *cli, const struct http_msg *msg)
 {
-	struct pl file, ext, val;
-	char *uri = NULL;
-	int err = 0;
-
-	/* ignore comment */
-	if (line->p[0] == '#') {
-
-		if (0 == re_regex(line->p, line->l,
-				  "#EXT-X-MEDIA:[^]+", &val)) {
-
-			struct pl muri;
-
-			if (0 == re_regex(val.p, val.l,
-					  "URI=\"[^\"]+\"", &muri)) {
-
-				char buf[256];
-
-				pl_strcpy(&muri, buf, sizeof(buf));
-
-				err = add_playlist(cli, buf);
-				if (err)
-					goto out;
-			}
-		}
-
-		return;
-	}
+	const struct rendition *variant;
+	struct pl pl, uri, val;
+	int err;
 
-	if (re_regex(line->p, line->l, "[^.]+.[a-z0-9]+", &file, &ext)) {
-		DEBUG_NOTICE("could not parse line (%r)\n", line);
-		return;
-	}
+	/* decoded once, the ABR controller refers to the table */
+	if (cli->rt)
+		return 0;
 
-	if (0 == pl_strcasecmp(&ext, "m3u8")) {
+	pl_set_mbuf(&pl, msg->mb);
 
-		char buf[256];
+	err = rendtab_decode(&cli->rt, &pl);
+	if (err)
+		return err;
 
-		re_snprintf(buf, sizeof(buf), "%r", line);
+	variant = rendtab_variant(cli->rt);
+	if (!variant)
+		return ENOENT;
 
-		err = add_playlist(cli, buf);
+	if (cli->cfg->abr && !cli->abr) {
+		err = abr_alloc(&cli->abr, cli->cfg->abr, cli->rt, variant);
 		if (err)
-			goto out;
-
-		if (cli->slid == 0) {
-
-			struct pl slid;
-
-			if (0 == re_regex(line->p, line->l,
-					  "?slid=[0-9]+", &slid)) {
-
-				cli->slid = pl_u32(&slid);
-			}
-		}
-	}
-	else {
-		DEBUG_NOTICE("hls: unknown extension: %r\n", &ext);
+			return err;
 	}
 
- out:
+	pl_set_str(&uri, variant->uri);
+	if (cli->slid == 0 && 0 == m3u8_uri_param(&uri, "slid", &val))
+		cli->slid = pl_u32(&val);
+
+	err = add_playlist(cli, MEDIA_VIDEO, variant);
 	if (err)
-		re_printf("WARNING: parse error\n");
+		return err;
 
-	mem_deref(uri);
+	return add_playlist(cli, MEDIA_AUDIO,
+			    rendtab_group(cli->rt, RENDITION_AUDIO,
+					  variant->group));
 }
 
 
-static int handle_hls_playlist(struct client *cli, const struct http_msg *msg)
+/* stop the session, but keep the HTTP client (may be in its callback) */
+static void session_stop(struct client *cli, int err)
 {
-	struct pl pl;
+	size_t i;
 
-	pl_set_mbuf(&pl, msg->mb);
+	if (!cli->terminated && cli->connected)
+		STAT_ADD(cli->metrics->n_active, -1);
 
-	while (pl.l > 1) {
+	cli->terminated = true;
 
-		const char *end;
-		struct pl line;
+	tmr_cancel(&cli->tmr_load);
 
-		end = pl_strchr(&pl, '\n');
-		if (!end)
-			break;
+	for (i=0; i<ARRAY_SIZE(cli->mplv); i++) {
 
-		line.p = pl.p;
-		line.l = end - pl.p;
+		playlist_close(cli->mplv[i], 0);
+	}
 
-		if (line.l > 0)
-			handle_line(cli, &line);
+	abr_close(cli->abr);
 
-		pl_advance(&pl, line.l + 1);
-	}
+	if (cli->errorh)
+		cli->errorh(cli, err, cli->arg);
 
-	return 0;
+	cli->errorh = NULL;
 }
 
 
 /*
- * NOTE: may be called from any thread
+ * NOTE: must be called from the thread running the session
  */
 void client_close(struct client *cli, int err)
 {
 	if (!cli)
 		return;
 
-	mqueue_push(cli->mqueue, 0, NULL);
-
-	cli->terminated = true;
-	cli->dnsc = mem_deref(cli->dnsc);
+	session_stop(cli, err);
 
-	if (cli->errorh)
-		cli->errorh(cli, err, cli->arg);
-
-	cli->errorh = NULL;
+	cli->cli = mem_deref(cli->cli);
 }
 
 
-static void http_resp_handler(int err, const struct http_msg *msg, void *arg)
+static void http_resp_handler(int err, const struct http_msg *msg,
+			      const struct httpc_timing *t, void *arg)
 {
 	struct client *cli = arg;
+	(void)t;
 
 	if (cli->terminated)
 		return;
@@ -214,7 +174,7 @@ static void http_resp_handler(int err, const struct http_msg *msg, void *arg)
 	if (err) {
 		re_printf("http error: %m\n", err);
 		cli->saved_err = err;
-		client_close(cli, err);
+		session_stop(cli, err);
 		return;
 	}
 
@@ -224,7 +184,7 @@ static void http_resp_handler(int err, const struct http_msg *msg, void *arg)
 		re_printf("request failed (%u %r)\n",
 			  msg->scode, &msg->reason);
 		cli->saved_scode = msg->scode;
-		client_close(cli, EPROTO);
+		session_stop(cli, EPROTO);
 		return;
 	}
 
@@ -234,12 +194,24 @@ static void http_resp_handler(int err, const struct http_msg *msg, void *arg)
 
 	if (msg_ctype_cmp(&msg->ctyp, "application", "vnd.apple.mpegurl")) {
 
-		if (!cli->ts_conn)
-			cli->ts_conn = tmr_jiffies();
+		if (!cli->ts_conn) {
+			cli->ts_conn = time_usec();
+
+			hist_record(&cli->metrics->conn,
+				    cli->ts_conn - cli->ts_start);
+		}
+
+		if (!cli->connected)
+			STAT_ADD(cli->metrics->n_active, 1);
 
 		cli->connected = true;
 
-		handle_hls_playlist(cli, msg);
+		err = handle_hls_playlist(cli, msg);
+		if (err) {
+			re_printf("master playlist: no playable"
+				  " rendition (%m)\n", err);
+			session_stop(cli, err);
+		}
 	}
 	else {
 		DEBUG_NOTICE("unknown content-type: %r/%r\n",
@@ -248,37 +220,19 @@ static void http_resp_handler(int err, const struct http_msg *msg, void *arg)
 }
 
 
-static void mqueue_handler(int id, void *data, void *arg)
-{
-	struct client *cli = arg;
-	size_t i;
-
-	/* note: timer must be closed from thread context */
-	tmr_cancel(&cli->tmr_load);
-
-	for (i=0; i<ARRAY_SIZE(cli->mplv); i++) {
-
-		playlist_close(cli->mplv[i], 0);
-	}
-
-	cli->cli = mem_deref(cli->cli);
-
-	re_cancel();
-}
-
-
-int client_alloc(struct client **clip, const char *uri,
+int client_alloc(struct client **clip, const struct config *cfg,
+		 const char *uri, struct dnscache *dc,
+		 const struct pools *pools,
+		 struct metrics *metrics, const struct reqlog *log,
 		 client_error_h *errorh, void *arg)
 {
 	struct client *cli;
-	const char *rslash;
 	int err;
 
-	if (!clip || !uri)
+	if (!clip || !cfg || !uri || !metrics)
 		return EINVAL;
 
-	rslash = strrchr(uri, '/');
-	if (!rslash) {
+	if (!strstr(uri, "://")) {
 		re_printf("invalid uri '%s'\n", uri);
 		return EINVAL;
 	}
@@ -287,25 +241,20 @@ int client_alloc(struct client **clip, const char *uri,
 	if (!cli)
 		return ENOMEM;
 
-	err = mqueue_alloc(&cli->mqueue, mqueue_handler, cli);
-	if (err)
-		goto out;
+	if (pools)
+		cli->pools = *pools;
 
-	err = dns_init(&cli->dnsc);
+	err = httpc_alloc(&cli->cli, dc, cli->pools.req, metrics, &cfg->http);
 	if (err)
 		goto out;
 
-	err = http_client_alloc(&cli->cli, cli->dnsc);
-	if (err)
-		goto out;
-
-	err = str_dup(&cli->uri, uri);
-	if (err)
-		goto out;
+	if (log)
+		httpc_set_log(cli->cli, log);
 
-	cli->path.p = uri;
-	cli->path.l = rslash + 1 - uri;
+	cli->uri = uri;
 
+	cli->metrics = metrics;
+	cli->cfg = cfg;
 	cli->errorh = errorh;
 	cli->arg = arg;
 
@@ -322,13 +271,14 @@ int client_alloc(struct client **clip, const char *uri,
 /* Load master playlist */
 static int load_playlist(struct client *cli)
 {
+	const struct httpc_opt opt = {REQ_MASTER, TRACE_NO_REND, 0, 0, 0};
 	int err;
 
 	if (!cli->ts_start)
-		cli->ts_start = tmr_jiffies();
+		cli->ts_start = time_usec();
 
-	err = http_request(NULL, cli->cli, "GET", cli->uri,
-			   http_resp_handler, NULL, cli, NULL);
+	err = httpc_request(NULL, cli->cli, "GET", cli->uri, &opt,
+			    http_resp_handler, NULL, cli);
 	if (err) {
 		re_printf("http request failed (%m)\n", err);
 		return err;
@@ -346,10 +296,9 @@ static void tmr_load_handler(void *data)
 }
 
 
-int client_start(struct client *cli)
+/* start the session after `delay` [ms] */
+int client_start(struct client *cli, uint32_t delay)
 {
-	uint32_t delay = rand_u32() % 10000;
-
 	if (!cli)
 		return EINVAL;
 
@@ -365,12 +314,13 @@ bool client_connected(const struct client *cli)
 }
 
 
+/* connect time in [ms] */
 int64_t client_conn_time(const struct client *cli)
 {
 	if (!cli)
 		return 0;
 
-	return cli->ts_conn - cli->ts_start;
+	return (cli->ts_conn - cli->ts_start) / 1000;
 }
 
 
@@ -380,13 +330,44 @@ struct media_playlist * const *client_playlists(const struct client *cli)
 }
 
 
-struct http_cli *client_http_cli(const struct client *cli)
+struct httpc *client_httpc(const struct client *cli)
 {
 	return cli ? cli->cli : NULL;
 }
 
 
-const struct pl *client_path(const struct client *cli)
+const struct rendtab *client_renditions(const struct client *cli)
+{
+	return cli ? cli->rt : NULL;
+}
+
+
+struct abr *client_abr(const struct client *cli)
+{
+	return cli ? cli->abr : NULL;
+}
+
+
+/* URI of the master playlist, the renditions are relative to it */
+const char *client_uri(const struct client *cli)
+{
+	return cli ? cli->uri : NULL;
+}
+
+
+const struct pools *client_pools(const struct client *cli)
+{
+	return cli ? &cli->pools : NULL;
+}
+
+
+struct metrics *client_metrics(const struct client *cli)
+{
+	return cli ? cli->metrics : NULL;
+}
+
+
+const struct config *client_config(const struct client *cli)
 {
-	return cli ? &cli->path : NULL;
+	return cli ? cli->cfg : NULL;
 }
@@ -0,0 +1,483 @@
+/**
+ * @file controller.c HLS Performance client -- controller of agents
+ *
+ * Copyright (C) 2019 Creytiv.com
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <re.h>
+#include "hlsperf.h"
+
+
+#define DEBUG_MODULE "hlsperf"
+#define DEBUG_LEVEL 6
+#include <re_dbg.h>
+
+
+/*
+ * The controller runs one test over several agent processes, local
+ * or remote. Each agent gets the configuration with its share of the
+ * sessions, or of the arrival rate. When all agents are ready, they
+ * are told to start at the same wall clock time, START_DELAY from now.
+ *
+ * The latest metrics of each agent are kept, so that they can be
+ * merged into one report at any time. When stopped, the agents send
+ * their final metrics and summaries, and the run is done when every
+ * agent has sent them or has been lost.
+ */
+
+
+enum {
+	START_DELAY = 1000,       /* [ms] */
+};
+
+struct peer {
+	struct le le;
+	struct controller *ctrl;
+	struct link *lk;
+	struct metrics m;         /* latest snapshot, or the final metrics */
+	struct summary sum;
+	char name[64];
+	pid_t pid;                /* local agent, 0 if remote */
+	unsigned ix;
+	bool ready;
+	bool done;
+};
+
+struct controller {
+	struct list peerl;
+	const struct config *cfg;
+	const char *uri;
+	uint32_t num_sess;
+	uint32_t workers;         /* per agent, 0 for one per core */
+	unsigned n_ready;
+	unsigned n_done;
+	controller_start_h *starth;
+	controller_done_h *doneh;
+	void *arg;
+	bool started;
+	bool stopping;
+	int err;
+};
+
+
+static void peer_destructor(void *data)
+{
+	struct peer *peer = data;
+
+	list_unlink(&peer->le);
+
+	/* the agent exits when the link is closed */
+	mem_deref(peer->lk);
+	summary_reset(&peer->sum);
+
+	if (peer->pid > 0)
+		(void)waitpid(peer->pid, NULL, 0);
+}
+
+
+static void destructor(void *data)
+{
+	struct controller *ctrl = data;
+
+	list_flush(&ctrl->peerl);
+}
+
+
+static void peer_done(struct peer *peer)
+{
+	struct controller *ctrl = peer->ctrl;
+
+	if (peer->done)
+		return;
+
+	peer->done = true;
+
+	if (++ctrl->n_done == list_count(&ctrl->peerl) && ctrl->doneh)
+		ctrl->doneh(ctrl->err, ctrl->arg);
+}
+
+
+/* abort the run, before or after the start */
+static void controller_fail(struct controller *ctrl, int err)
+{
+	if (!ctrl->err)
+		ctrl->err = err;
+
+	controller_stop(ctrl);
+}
+
+
+/* key=value lines, see MSG_CONFIG */
+static int config_encode(struct mbuf *mb, const struct controller *ctrl,
+			 unsigned ix)
+{
+	const struct config *cfg = ctrl->cfg;
+	const unsigned n = list_count(&ctrl->peerl);
+	uint32_t num_sess;
+	int err;
+
+	/* spread the sessions evenly over the agents */
+	num_sess = ctrl->num_sess / n;
+	if (ix < ctrl->num_sess % n)
+		++num_sess;
+
+	err  = mbuf_printf(mb, "uri=%s\n", ctrl->uri);
+	err |= mbuf_printf(mb, "sessions=%u\n", num_sess);
+	err |= mbuf_printf(mb, "workers=%u\n", ctrl->workers);
+	err |= mbuf_printf(mb, "agents=%u\n", n);
+	err |= mbuf_printf(mb, "llhls=%d\n", cfg->llhls);
+	err |= mbuf_printf(mb, "validate=%d\n", cfg->validate);
+	err |= mbuf_printf(mb, "pool=%H\n", httpc_conf_print, &cfg->http);
+
+	if (cfg->abr)
+		err |= mbuf_printf(mb, "abr=%s\n", cfg->abr->name);
+	if (cfg->links.n)
+		err |= mbuf_printf(mb, "links=%H\n",
+				   linkmix_print, &cfg->links);
+	if (cfg->lifetime.type != DIST_NONE)
+		err |= mbuf_printf(mb, "lifetime=%H\n",
+				   dist_print, &cfg->lifetime);
+	if (cfg->profile)
+		err |= mbuf_printf(mb, "profile=%H\n",
+				   profile_print, cfg->profile);
+
+	return err;
+}
+
+
+static void send_config(struct peer *peer)
+{
+	struct mbuf *mb;
+	int err;
+
+	mb = mbuf_alloc(1024);
+	if (!mb) {
+		controller_fail(peer->ctrl, ENOMEM);
+		return;
+	}
+
+	err = config_encode(mb, peer->ctrl, peer->ix);
+	if (!err)
+		err = link_send(peer->lk, MSG_CONFIG, mb->buf, mb->end);
+	if (err)
+		controller_fail(peer->ctrl, err);
+
+	mem_deref(mb);
+}
+
+
+/* all agents start at the same time */
+static void start_all(struct controller *ctrl)
+{
+	const uint64_t start = time_wall() + START_DELAY * 1000;
+	struct le *le;
+
+	ctrl->started = true;
+
+	for (le = ctrl->peerl.head; le; le = le->next) {
+
+		struct peer *peer = le->data;
+
+		(void)link_send(peer->lk, MSG_START,
+				(uint8_t *)&start, sizeof(start));
+	}
+
+	if (ctrl->starth)
+		ctrl->starth(START_DELAY, ctrl->arg);
+}
+
+
+static void handle_hello(struct peer *peer, struct mbuf *mb)
+{
+	uint32_t hello[3];
+
+	if (mbuf_get_left(mb) < sizeof(hello)) {
+		controller_fail(peer->ctrl, EPROTO);
+		return;
+	}
+
+	(void)mbuf_read_mem(mb, (uint8_t *)hello, sizeof(hello));
+
+	if (hello[0] != AGENT_MAGIC || hello[1] != AGENT_VERSION ||
+	    hello[2] != sizeof(struct metrics)) {
+		re_fprintf(stderr, "agent %s: incompatible version\n",
+			   peer->name);
+		controller_fail(peer->ctrl, EPROTO);
+		return;
+	}
+
+	send_config(peer);
+}
+
+
+static void handle_ready(struct peer *peer, struct mbuf *mb)
+{
+	struct controller *ctrl = peer->ctrl;
+	uint32_t workers = 0;
+
+	if (peer->ready)
+		return;
+
+	if (mbuf_get_left(mb) >= sizeof(workers))
+		(void)mbuf_read_mem(mb, (uint8_t *)&workers, sizeof(workers));
+
+	re_printf("agent %s: ready, %u workers\n", peer->name, workers);
+
+	peer->ready = true;
+
+	if (++ctrl->n_ready == list_count(&ctrl->peerl) && !ctrl->stopping)
+		start_all(ctrl);
+}
+
+
+static void handle_done(struct peer *peer, struct mbuf *mb)
+{
+	int err;
+
+	if (mbuf_get_left(mb) < sizeof(peer->m)) {
+		re_fprintf(stderr, "agent %s: short summary\n", peer->name);
+		peer_done(peer);
+		return;
+	}
+
+	(void)mbuf_read_mem(mb, (uint8_t *)&peer->m, sizeof(peer->m));
+
+	err = summary_decode(&peer->sum, mb);
+	if (err)
+		re_fprintf(stderr, "agent %s: summary: %m\n", peer->name, err);
+
+	peer_done(peer);
+}
+
+
+static void peer_msg_handler(uint32_t type, struct mbuf *mb, void *arg)
+{
+	struct peer *peer = arg;
+
+	switch (type) {
+
+	case MSG_HELLO:
+		handle_hello(peer, mb);
+		break;
+
+	case MSG_READY:
+		handle_ready(peer, mb);
+		break;
+
+	case MSG_ERROR:
+		re_fprintf(stderr, "agent %s: %b\n", peer->name,
+			   mbuf_buf(mb), mbuf_get_left(mb));
+		controller_fail(peer->ctrl, EPROTO);
+		break;
+
+	case MSG_STATS:
+		if (mbuf_get_left(mb) >= sizeof(peer->m) && !peer->done)
+			(void)mbuf_read_mem(mb, (uint8_t *)&peer->m,
+					    sizeof(peer->m));
+		break;
+
+	case MSG_DONE:
+		handle_done(peer, mb);
+		break;
+
+	default:
+		break;
+	}
+}
+
+
+static void peer_close_handler(int err, void *arg)
+{
+	struct peer *peer = arg;
+
+	if (peer->done)
+		return;
+
+	re_fprintf(stderr, "agent %s: link lost (%m)\n", peer->name,
+		   err ? err : ECONNRESET);
+
+	/* the last snapshot is kept, the summary is lost */
+	if (!peer->ctrl->started)
+		controller_fail(peer->ctrl, err ? err : ECONNRESET);
+
+	peer_done(peer);
+}
+
+
+static int peer_alloc(struct peer **peerp, struct controller *ctrl)
+{
+	struct peer *peer;
+
+	peer = mem_zalloc(sizeof(*peer), peer_destructor);
+	if (!peer)
+		return ENOMEM;
+
+	peer->ctrl = ctrl;
+	peer->ix   = list_count(&ctrl->peerl);
+
+	metrics_init(&peer->m);
+	summary_init(&peer->sum);
+
+	list_append(&ctrl->peerl, &peer->le, peer);
+
+	*peerp = peer;
+
+	return 0;
+}
+
+
+/*
+ * Create a controller for the run of `uri`. Agents are added with
+ * controller_connect() and controller_attach(), before the main loop
+ * runs. `starth` is called when the start time has been sent, `doneh`
+ * when all agents are done.
+ */
+int controller_alloc(struct controller **ctrlp, const struct config *cfg,
+		     const char *uri, uint32_t num_sess, uint32_t workers,
+		     controller_start_h *starth, controller_done_h *doneh,
+		     void *arg)
+{
+	struct controller *ctrl;
+
+	if (!ctrlp || !cfg || !uri)
+		return EINVAL;
+
+	ctrl = mem_zalloc(sizeof(*ctrl), destructor);
+	if (!ctrl)
+		return ENOMEM;
+
+	ctrl->cfg      = cfg;
+	ctrl->uri      = uri;
+	ctrl->num_sess = num_sess;
+	ctrl->workers  = workers;
+	ctrl->starth   = starth;
+	ctrl->doneh    = doneh;
+	ctrl->arg      = arg;
+
+	*ctrlp = ctrl;
+
+	return 0;
+}
+
+
+/* Add a remote agent, listening on `addr` */
+int controller_connect(struct controller *ctrl, const struct sa *addr)
+{
+	struct peer *peer;
+	int err;
+
+	if (!ctrl || !addr)
+		return EINVAL;
+
+	err = peer_alloc(&peer, ctrl);
+	if (err)
+		return err;
+
+	(void)re_snprintf(peer->name, sizeof(peer->name), "%J", addr);
+
+	err = link_connect(&peer->lk, addr, peer_msg_handler,
+			   peer_close_handler, peer);
+	if (err)
+		mem_deref(peer);
+
+	return err;
+}
+
+
+/* Add a local agent started with agent_spawn() */
+int controller_attach(struct controller *ctrl, int fd, pid_t pid)
+{
+	struct peer *peer;
+	int err;
+
+	if (!ctrl || fd < 0)
+		return EINVAL;
+
+	err = peer_alloc(&peer, ctrl);
+	if (err) {
+		(void)close(fd);
+		return err;
+	}
+
+	(void)re_snprintf(peer->name, sizeof(peer->name), "local/%u",
+			  peer->ix);
+
+	peer->pid = pid;
+
+	err = link_alloc(&peer->lk, fd, peer_msg_handler,
+			 peer_close_handler, peer);
+	if (err)
+		mem_deref(peer);
+
+	return err;
+}
+
+
+/* Tell all agents to stop and to send their summaries */
+void controller_stop(struct controller *ctrl)
+{
+	struct le *le;
+
+	if (!ctrl || ctrl->stopping)
+		return;
+
+	ctrl->stopping = true;
+
+	le = ctrl->peerl.head;
+	while (le) {
+		struct peer *peer = le->data;
+
+		le = le->next;
+
+		if (peer->done)
+			continue;
+
+		if (link_send(peer->lk, MSG_STOP, NULL, 0))
+			peer_done(peer);
+	}
+}
+
+
+/* Merge the latest metrics of all agents into `m` */
+void controller_metrics(const struct controller *ctrl, struct metrics *m)
+{
+	struct le *le;
+
+	if (!ctrl || !m)
+		return;
+
+	for (le = ctrl->peerl.head; le; le = le->next) {
+
+		const struct peer *peer = le->data;
+
+		metrics_merge(m, &peer->m);
+	}
+}
+
+
+/* Merge the final summaries of all agents into `sum` */
+void controller_summary(const struct controller *ctrl, struct summary *sum)
+{
+	struct le *le;
+
+	if (!ctrl || !sum)
+		return;
+
+	for (le = ctrl->peerl.head; le; le = le->next) {
+
+		const struct peer *peer = le->data;
+
+		summary_merge(sum, &peer->sum);
+	}
+}
+
+
+unsigned controller_agents(const struct controller *ctrl)
+{
+	return ctrl ? list_count(&ctrl->peerl) : 0;
+}
@@ -0,0 +1,272 @@
+/**
+ * @file dnscache.c HLS Performance client -- shared DNS cache
+ *
+ * Copyright (C) 2019 Creytiv.com
+ */
+
+#include <string.h>
+#include <re.h>
+#include "hlsperf.h"
+
+
+#define DEBUG_MODULE "hlsperf"
+#define DEBUG_LEVEL 6
+#include <re_dbg.h>
+
+
+enum {
+	TTL_MIN = 1,     /* seconds */
+	TTL_MAX = 3600,  /* seconds */
+};
+
+
+/*
+ * One resolver and one cache per worker, shared by all its sessions.
+ * Lookups for a name that is already being resolved are queued on
+ * the pending query instead of sending another one.
+ */
+struct dnscache {
+	struct dnsc *dnsc;
+	struct list entryl;
+	struct metrics *metrics;
+};
+
+struct dns_entry {
+	struct le le;
+	struct dnscache *dc;
+	char *host;
+	struct sa addr;
+	uint64_t expires;         /* jiffies */
+	uint64_t ts_query;        /* [us] */
+	struct dns_query *q;
+	struct list waitl;
+	bool pending;
+};
+
+struct dnscache_q {
+	struct le le;
+	dnscache_h *h;
+	void *arg;
+};
+
+
+static void cache_destructor(void *data)
+{
+	struct dnscache *dc = data;
+
+	list_flush(&dc->entryl);
+	mem_deref(dc->dnsc);
+}
+
+
+static void entry_destructor(void *data)
+{
+	struct dns_entry *ent = data;
+
+	list_unlink(&ent->le);
+	mem_deref(ent->q);
+	mem_deref(ent->host);
+
+	/* waiters are owned by their callers */
+	list_clear(&ent->waitl);
+}
+
+
+static void q_destructor(void *data)
+{
+	struct dnscache_q *q = data;
+
+	list_unlink(&q->le);
+}
+
+
+static struct dns_entry *entry_find(const struct dnscache *dc,
+				    const char *host)
+{
+	struct le *le;
+
+	for (le = list_head(&dc->entryl); le; le = le->next) {
+
+		struct dns_entry *ent = le->data;
+
+		if (0 == str_casecmp(ent->host, host))
+			return ent;
+	}
+
+	return NULL;
+}
+
+
+static void query_handler(int err, const struct dnshdr *hdr,
+			  struct list *ansl, struct list *authl,
+			  struct list *addl, void *arg)
+{
+	struct dns_entry *ent = arg;
+	struct dnscache *dc = ent->dc;
+	int64_t ttl = TTL_MAX;
+	bool found = false;
+	struct le *le;
+	(void)authl;
+	(void)addl;
+
+	ent->pending = false;
+
+	hist_record(&dc->metrics->dns, time_usec() - ent->ts_query);
+
+	if (!err && hdr->rcode != 0)
+		err = ENOENT;
+
+	for (le = list_head(ansl); le && !err; le = le->next) {
+
+		const struct dnsrr *rr = le->data;
+
+		if (rr->type != DNS_TYPE_A)
+			continue;
+
+		/* the entry lives as long as the shortest TTL */
+		if (!found)
+			sa_set_in(&ent->addr, rr->rdata.a.addr, 0);
+
+		ttl = min(ttl, rr->ttl);
+		found = true;
+	}
+
+	if (!err && !found)
+		err = EDESTADDRREQ;
+
+	if (err) {
+		DEBUG_WARNING("dns: could not resolve %s (%m)\n",
+			      ent->host, err);
+		ent->expires = 0;
+	}
+	else {
+		ttl = max(ttl, TTL_MIN);
+		ent->expires = tmr_jiffies() + ttl * 1000;
+	}
+
+	while (ent->waitl.head) {
+
+		struct dnscache_q *q = ent->waitl.head->data;
+
+		list_unlink(&q->le);
+
+		q->h(err, err ? NULL : &ent->addr, q->arg);
+	}
+}
+
+
+int dnscache_alloc(struct dnscache **dcp, struct metrics *metrics)
+{
+	struct dnscache *dc;
+	int err;
+
+	if (!dcp || !metrics)
+		return EINVAL;
+
+	dc = mem_zalloc(sizeof(*dc), cache_destructor);
+	if (!dc)
+		return ENOMEM;
+
+	dc->metrics = metrics;
+
+	err = dns_init(&dc->dnsc);
+
+	if (err)
+		mem_deref(dc);
+	else
+		*dcp = dc;
+
+	return err;
+}
+
+
+/*
+ * Get a cached address for `host`. An IP address is returned as-is.
+ *
+ * Returns ENOENT if the host is not cached or the entry has expired.
+ */
+int dnscache_get(struct dnscache *dc, const char *host, struct sa *addr)
+{
+	struct dns_entry *ent;
+
+	if (!dc || !host || !addr)
+		return EINVAL;
+
+	if (0 == sa_set_str(addr, host, 0))
+		return 0;
+
+	STAT_ADD(dc->metrics->dns_lookup, 1);
+
+	ent = entry_find(dc, host);
+	if (!ent || !ent->expires || tmr_jiffies() >= ent->expires)
+		return ENOENT;
+
+	STAT_ADD(dc->metrics->dns_hit, 1);
+	*addr = ent->addr;
+
+	return 0;
+}
+
+
+/*
+ * Resolve `host` and call `h` with the result. If a query for the same
+ * host is outstanding, the lookup waits for that one.
+ */
+int dnscache_query(struct dnscache_q **qp, struct dnscache *dc,
+		   const char *host, dnscache_h *h, void *arg)
+{
+	struct dns_entry *ent;
+	struct dnscache_q *q;
+	int err;
+
+	if (!qp || !dc || !host || !h)
+		return EINVAL;
+
+	ent = entry_find(dc, host);
+	if (!ent) {
+
+		ent = mem_zalloc(sizeof(*ent), entry_destructor);
+		if (!ent)
+			return ENOMEM;
+
+		ent->dc = dc;
+
+		err = str_dup(&ent->host, host);
+		if (err) {
+			mem_deref(ent);
+			return err;
+		}
+
+		list_append(&dc->entryl, &ent->le, ent);
+	}
+
+	if (!ent->pending) {
+
+		ent->ts_query = time_usec();
+		ent->q = mem_deref(ent->q);
+
+		err = dnsc_query(&ent->q, dc->dnsc, host, DNS_TYPE_A,
+				 DNS_CLASS_IN, true, query_handler, ent);
+		if (err) {
+			DEBUG_WARNING("dns: query %s failed (%m)\n",
+				      host, err);
+			return err;
+		}
+
+		ent->pending = true;
+	}
+
+	q = mem_zalloc(sizeof(*q), q_destructor);
+	if (!q)
+		return ENOMEM;
+
+	q->h   = h;
+	q->arg = arg;
+
+	list_append(&ent->waitl, &q->le, q);
+
+	*qp = q;
+
+	return 0;
+}
+
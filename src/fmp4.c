@@ -0,0 +1,573 @@
+/**
+ * @file fmp4.c HLS Performance client -- fragmented MP4 validation
+ *
+ * Copyright (C) 2019 Creytiv.com
+ */
+
+#include <string.h>
+#include <re.h>
+#include "hlsperf.h"
+
+
+/*
+ * Incremental ISO-BMFF box walker (ISO/IEC 14496-12), fed with the
+ * body of a segment as it arrives. Nothing is buffered beyond one box
+ * header or one table entry, so the state is constant per request.
+ *
+ * It checks that:
+ *
+ *   - every box fits in its parent, and the body ends after a box
+ *   - every moof has an mfhd and is followed by an mdat
+ *   - the mfhd sequence numbers increase, also between segments
+ *   - a trun fits in its box, and the samples of a moof fit in
+ *     the following mdat, if their sizes are known
+ *
+ * A segment with only a moov (an initialization segment) is valid.
+ */
+
+
+#define FOURCC(a, b, c, d) \
+	((uint32_t)(a) << 24 | (uint32_t)(b) << 16 | (c) << 8 | (d))
+
+enum {
+	BOX_MOOF = FOURCC('m','o','o','f'),
+	BOX_MFHD = FOURCC('m','f','h','d'),
+	BOX_TRAF = FOURCC('t','r','a','f'),
+	BOX_TFHD = FOURCC('t','f','h','d'),
+	BOX_TRUN = FOURCC('t','r','u','n'),
+	BOX_MDAT = FOURCC('m','d','a','t'),
+	BOX_MOOV = FOURCC('m','o','o','v'),
+	BOX_TRAK = FOURCC('t','r','a','k'),
+	BOX_MDIA = FOURCC('m','d','i','a'),
+	BOX_MINF = FOURCC('m','i','n','f'),
+	BOX_STBL = FOURCC('s','t','b','l'),
+	BOX_MVEX = FOURCC('m','v','e','x'),
+	BOX_EDTS = FOURCC('e','d','t','s'),
+	BOX_DINF = FOURCC('d','i','n','f'),
+};
+
+enum {
+	HDR_SIZE  = 8,
+	HDR_LARGE = 16,
+};
+
+enum state {
+	ST_HDR = 0,       /* box header */
+	ST_FIELD,         /* fields of a box that is parsed */
+	ST_SKIP,          /* rest of the box */
+};
+
+enum field {
+	F_MFHD = 0,
+	F_TFHD,
+	F_TRUN,
+	F_TRUN_OPT,       /* data offset and first sample flags */
+	F_TRUN_ENTRY,
+};
+
+/* tfhd and trun flags */
+enum {
+	TFHD_BASE_OFFSET  = 0x000001,
+	TFHD_DESC_INDEX   = 0x000002,
+	TFHD_DEF_DURATION = 0x000008,
+	TFHD_DEF_SIZE     = 0x000010,
+	TRUN_DATA_OFFSET  = 0x000001,
+	TRUN_FIRST_FLAGS  = 0x000004,
+	TRUN_DURATION     = 0x000100,
+	TRUN_SIZE         = 0x000200,
+	TRUN_FLAGS        = 0x000400,
+	TRUN_CTO          = 0x000800,
+};
+
+
+static uint32_t be32(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | p[2] << 8 | p[3];
+}
+
+
+static uint64_t be64(const uint8_t *p)
+{
+	return (uint64_t)be32(p) << 32 | be32(p + 4);
+}
+
+
+static void fail(struct fmp4 *f, const char *what)
+{
+	if (f->err)
+		return;
+
+	f->err  = EBADMSG;
+	f->what = what;
+}
+
+
+static bool is_container(uint32_t type)
+{
+	switch (type) {
+
+	case BOX_MOOF:
+	case BOX_TRAF:
+	case BOX_MOOV:
+	case BOX_TRAK:
+	case BOX_MDIA:
+	case BOX_MINF:
+	case BOX_STBL:
+	case BOX_MVEX:
+	case BOX_EDTS:
+	case BOX_DINF:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+
+static uint32_t parent_type(const struct fmp4 *f)
+{
+	return f->depth ? f->typev[f->depth - 1] : 0;
+}
+
+
+static void want_header(struct fmp4 *f)
+{
+	f->state = ST_HDR;
+	f->need  = HDR_SIZE;
+	f->len   = 0;
+}
+
+
+/* the current box has been walked, close the containers ending here */
+static void box_end(struct fmp4 *f)
+{
+	while (f->depth && f->endv[f->depth - 1] == f->off) {
+
+		--f->depth;
+
+		if (f->typev[f->depth] == BOX_MOOF && !f->mfhd)
+			fail(f, "moof without mfhd");
+	}
+
+	want_header(f);
+}
+
+
+static void skip_box(struct fmp4 *f)
+{
+	if (f->left)
+		f->state = ST_SKIP;
+	else
+		box_end(f);
+}
+
+
+/* read `need` bytes of fields, or skip the rest of the box */
+static void want_field(struct fmp4 *f, enum field field, uint64_t need)
+{
+	if (need > f->left) {
+		fail(f, "box too short for its fields");
+		return;
+	}
+
+	if (!need) {
+		skip_box(f);
+		return;
+	}
+
+	f->state = ST_FIELD;
+	f->field = field;
+	f->need  = (uint8_t)need;
+	f->len   = 0;
+}
+
+
+static void handle_mfhd(struct fmp4 *f)
+{
+	const uint32_t seq = be32(f->buf + 4);
+
+	if (f->seq_set && seq <= f->seq)
+		fail(f, "mfhd sequence number not increasing");
+
+	f->seq     = seq;
+	f->seq_set = true;
+	f->mfhd    = true;
+
+	skip_box(f);
+}
+
+
+static void handle_tfhd(struct fmp4 *f)
+{
+	const uint32_t flags = be32(f->buf) & 0xffffff;
+	size_t pos = 8;
+
+	if (flags & TFHD_BASE_OFFSET)
+		pos += 8;
+	if (flags & TFHD_DESC_INDEX)
+		pos += 4;
+	if (flags & TFHD_DEF_DURATION)
+		pos += 4;
+
+	if (flags & TFHD_DEF_SIZE) {
+
+		if (pos + 4 > f->need) {
+			fail(f, "tfhd too short");
+			return;
+		}
+
+		f->def_size = be32(f->buf + pos);
+	}
+
+	skip_box(f);
+}
+
+
+static void handle_trun(struct fmp4 *f)
+{
+	const uint32_t flags = be32(f->buf) & 0xffffff;
+	const uint32_t count = be32(f->buf + 4);
+	size_t opt = 0, entry;
+
+	if (flags & TRUN_DATA_OFFSET)
+		opt += 4;
+	if (flags & TRUN_FIRST_FLAGS)
+		opt += 4;
+
+	entry = 4 * (!!(flags & TRUN_DURATION) + !!(flags & TRUN_SIZE) +
+		     !!(flags & TRUN_FLAGS) + !!(flags & TRUN_CTO));
+
+	if (opt + (uint64_t)count * entry > f->left) {
+		fail(f, "trun larger than its box");
+		return;
+	}
+
+	f->trun_flags = flags;
+	f->trun_left  = count;
+	f->trun_entry = (uint8_t)entry;
+
+	if (!(flags & TRUN_SIZE)) {
+
+		/* all samples have the default size, if there is one */
+		if (f->def_size)
+			f->frag_bytes += (uint64_t)count * f->def_size;
+		else
+			f->frag_sizes = false;
+
+		skip_box(f);
+		return;
+	}
+
+	if (opt)
+		want_field(f, F_TRUN_OPT, opt);
+	else
+		want_field(f, F_TRUN_ENTRY, count ? entry : 0);
+}
+
+
+static void handle_trun_entry(struct fmp4 *f)
+{
+	const size_t pos = f->trun_flags & TRUN_DURATION ? 4 : 0;
+
+	if (f->field == F_TRUN_ENTRY) {
+		f->frag_bytes += be32(f->buf + pos);
+		--f->trun_left;
+	}
+
+	want_field(f, F_TRUN_ENTRY, f->trun_left ? f->trun_entry : 0);
+}
+
+
+static void field_handler(struct fmp4 *f)
+{
+	switch (f->field) {
+
+	case F_MFHD:
+		handle_mfhd(f);
+		break;
+
+	case F_TFHD:
+		handle_tfhd(f);
+		break;
+
+	case F_TRUN:
+		handle_trun(f);
+		break;
+
+	case F_TRUN_OPT:
+	case F_TRUN_ENTRY:
+		handle_trun_entry(f);
+		break;
+	}
+}
+
+
+static void box_begin(struct fmp4 *f, uint64_t size, uint32_t type)
+{
+	const uint64_t start = f->off - f->len;
+	const uint32_t parent = parent_type(f);
+	uint64_t end;
+
+	if (size == 0) {
+
+		/* extends to the end of the body, top level only */
+		if (f->depth) {
+			fail(f, "box without size in a container");
+			return;
+		}
+
+		f->open_end = true;
+		end = UINT64_MAX;
+	}
+	else {
+		if (size < f->len) {
+			fail(f, "box smaller than its header");
+			return;
+		}
+
+		end = start + size;
+
+		if (f->depth && end > f->endv[f->depth - 1]) {
+			fail(f, "box larger than its parent");
+			return;
+		}
+	}
+
+	f->left = end - f->off;
+
+	switch (type) {
+
+	case BOX_MOOF:
+		if (f->depth) {
+			fail(f, "moof in a container");
+			return;
+		}
+		if (f->moof) {
+			fail(f, "moof without mdat");
+			return;
+		}
+
+		f->moof       = true;
+		f->mfhd       = false;
+		f->media      = true;
+		f->frag_bytes = 0;
+		f->frag_sizes = true;
+		break;
+
+	case BOX_MFHD:
+		if (parent != BOX_MOOF) {
+			fail(f, "mfhd outside of moof");
+			return;
+		}
+
+		want_field(f, F_MFHD, 8);
+		return;
+
+	case BOX_TRAF:
+		if (parent != BOX_MOOF) {
+			fail(f, "traf outside of moof");
+			return;
+		}
+
+		f->def_size = 0;
+		break;
+
+	case BOX_TFHD:
+		if (parent != BOX_TRAF) {
+			fail(f, "tfhd outside of traf");
+			return;
+		}
+
+		if (f->left < 8) {
+			fail(f, "tfhd too short");
+			return;
+		}
+
+		want_field(f, F_TFHD, min(f->left, sizeof(f->buf)));
+		return;
+
+	case BOX_TRUN:
+		if (parent != BOX_TRAF) {
+			fail(f, "trun outside of traf");
+			return;
+		}
+
+		want_field(f, F_TRUN, 8);
+		return;
+
+	case BOX_MDAT:
+		if (f->depth || !f->moof) {
+			fail(f, "mdat without moof");
+			return;
+		}
+
+		if (f->frag_sizes && !f->open_end &&
+		    f->frag_bytes > f->left) {
+			fail(f, "samples larger than mdat");
+			return;
+		}
+
+		f->moof = false;
+		break;
+
+	case BOX_MOOV:
+		f->media = true;
+		break;
+
+	default:
+		break;
+	}
+
+	if (!is_container(type) || f->open_end ||
+	    f->depth == ARRAY_SIZE(f->endv)) {
+		skip_box(f);
+		return;
+	}
+
+	f->endv[f->depth]  = end;
+	f->typev[f->depth] = type;
+	++f->depth;
+
+	if (f->left)
+		want_header(f);
+	else
+		box_end(f);
+}
+
+
+static void handle_header(struct fmp4 *f)
+{
+	const uint32_t size = be32(f->buf);
+	const uint32_t type = be32(f->buf + 4);
+
+	/* 64-bit size follows the type */
+	if (size == 1 && f->need == HDR_SIZE) {
+		f->need = HDR_LARGE;
+		return;
+	}
+
+	box_begin(f, size == 1 ? be64(f->buf + 8) : size, type);
+}
+
+
+/* Reset the state of `f`, the sequence numbers start over */
+void fmp4_init(struct fmp4 *f)
+{
+	if (!f)
+		return;
+
+	memset(f, 0, sizeof(*f));
+	want_header(f);
+}
+
+
+/* Start a new body, keeping the last sequence number */
+void fmp4_begin(struct fmp4 *f)
+{
+	uint32_t seq;
+	bool seq_set;
+
+	if (!f)
+		return;
+
+	seq     = f->seq;
+	seq_set = f->seq_set;
+
+	fmp4_init(f);
+
+	f->seq     = seq;
+	f->seq_set = seq_set;
+}
+
+
+/*
+ * Forget the last sequence number, when the stream restarts or another
+ * rendition follows. The body being walked is not affected.
+ */
+void fmp4_restart(struct fmp4 *f)
+{
+	if (!f)
+		return;
+
+	f->seq     = 0;
+	f->seq_set = false;
+}
+
+
+/* Walk the next `n` bytes of the body, returns the first error */
+int fmp4_walk(struct fmp4 *f, const uint8_t *p, size_t n)
+{
+	size_t k;
+
+	if (!f || (n && !p))
+		return EINVAL;
+
+	while (n && !f->err) {
+
+		switch (f->state) {
+
+		case ST_HDR:
+		case ST_FIELD:
+			k = min(n, (size_t)(f->need - f->len));
+
+			memcpy(f->buf + f->len, p, k);
+			f->len += (uint8_t)k;
+			f->off += k;
+
+			if (f->state == ST_FIELD)
+				f->left -= k;
+
+			if (f->len < f->need)
+				break;
+
+			if (f->state == ST_HDR)
+				handle_header(f);
+			else
+				field_handler(f);
+			break;
+
+		case ST_SKIP:
+			k = n;
+			if (!f->open_end && f->left < k)
+				k = (size_t)f->left;
+
+			f->off += k;
+
+			if (!f->open_end) {
+				f->left -= k;
+				if (!f->left)
+					box_end(f);
+			}
+			break;
+
+		default:
+			k = n;
+			break;
+		}
+
+		p += k;
+		n -= k;
+	}
+
+	return f->err;
+}
+
+
+/* The body is complete, check that nothing is missing */
+int fmp4_end(struct fmp4 *f)
+{
+	if (!f)
+		return EINVAL;
+
+	if (f->err)
+		return f->err;
+
+	if (!f->open_end && (f->state != ST_HDR || f->len || f->depth))
+		fail(f, "truncated box");
+	else if (f->moof)
+		fail(f, "moof without mdat");
+	else if (!f->media)
+		fail(f, "no moof or moov");
+
+	return f->err;
+}
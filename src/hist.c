@@ -0,0 +1,164 @@
+/**
+ * @file hist.c HLS Performance client -- latency histogram
+ *
+ * Copyright (C) 2019 Creytiv.com
+ */
+
+#include <string.h>
+#include <re.h>
+#include "hlsperf.h"
+
+
+/*
+ * Log-linear buckets, similar to HdrHistogram: values below
+ * 2*HIST_SUB are exact, above that every power of two is split
+ * into HIST_SUB buckets, which gives a relative error of 1/HIST_SUB.
+ */
+
+
+static unsigned msb64(uint64_t v)
+{
+	return 63 - __builtin_clzll(v);
+}
+
+
+static unsigned bucket_index(uint64_t v)
+{
+	unsigned e;
+
+	if (v < 2*HIST_SUB)
+		return (unsigned)v;
+
+	if (v > HIST_MAX)
+		v = HIST_MAX;
+
+	e = msb64(v) - HIST_SUB_BITS;
+
+	return e*HIST_SUB + (unsigned)(v >> e);
+}
+
+
+/* highest value that falls into bucket `ix` */
+static uint64_t bucket_value(unsigned ix)
+{
+	unsigned e;
+
+	if (ix < 2*HIST_SUB)
+		return ix;
+
+	e = ix/HIST_SUB - 1;
+
+	return (((uint64_t)(ix - e*HIST_SUB) + 1) << e) - 1;
+}
+
+
+void hist_init(struct hist *h)
+{
+	memset(h, 0, sizeof(*h));
+}
+
+
+void hist_record(struct hist *h, uint64_t v)
+{
+	const unsigned ix = bucket_index(v);
+
+	STAT_ADD(h->bucketv[ix], 1);
+	STAT_ADD(h->count, 1);
+
+	if (v > h->max)
+		__atomic_store_n(&h->max, v, __ATOMIC_RELAXED);
+}
+
+
+void hist_merge(struct hist *dst, const struct hist *src)
+{
+	size_t i;
+
+	if (!src->count)
+		return;
+
+	for (i=0; i<HIST_BUCKETS; i++)
+		dst->bucketv[i] += src->bucketv[i];
+
+	dst->count += src->count;
+	dst->max = max(dst->max, src->max);
+}
+
+
+/* copy a histogram that is being written by another thread */
+void hist_load(struct hist *dst, const struct hist *src)
+{
+	size_t i;
+
+	for (i=0; i<HIST_BUCKETS; i++)
+		dst->bucketv[i] = STAT_GET(src->bucketv[i]);
+
+	dst->count = STAT_GET(src->count);
+	dst->max   = STAT_GET(src->max);
+}
+
+
+/* values recorded between two snapshots of the same histogram */
+void hist_delta(struct hist *dst, const struct hist *cur,
+		const struct hist *prev)
+{
+	size_t i;
+
+	dst->count = 0;
+	dst->max   = 0;
+
+	for (i=0; i<HIST_BUCKETS; i++) {
+
+		dst->bucketv[i] = cur->bucketv[i] - prev->bucketv[i];
+
+		if (dst->bucketv[i]) {
+			dst->count += dst->bucketv[i];
+			dst->max = min(bucket_value((unsigned)i), cur->max);
+		}
+	}
+}
+
+
+/* value at percentile `p` (0-100) */
+uint64_t hist_percentile(const struct hist *h, double p)
+{
+	uint64_t rank, acc = 0;
+	size_t i;
+
+	if (!h->count)
+		return 0;
+
+	rank = (uint64_t)(p / 100.0 * (double)h->count + 0.5);
+	rank = max(rank, 1);
+
+	for (i=0; i<HIST_BUCKETS; i++) {
+
+		acc += h->bucketv[i];
+
+		if (acc >= rank)
+			return min(bucket_value((unsigned)i), h->max);
+	}
+
+	return h->max;
+}
+
+
+/*
+ * Print p50/p90/p99/p99.9/max, scaled by 1/1000
+ * (i.e. [us] are printed as [ms], [kbit/s] as [Mbit/s])
+ */
+int hist_print(struct re_printf *pf, const struct hist *h)
+{
+	if (!h)
+		return 0;
+
+	if (!h->count)
+		return re_hprintf(pf, "(not set)");
+
+	return re_hprintf(pf, "%.1f/%.1f/%.1f/%.1f/%.1f (n=%llu)",
+			  hist_percentile(h, 50.0)  * .001,
+			  hist_percentile(h, 90.0)  * .001,
+			  hist_percentile(h, 99.0)  * .001,
+			  hist_percentile(h, 99.9)  * .001,
+			  h->max * .001, h->count);
+}
@@ -5,7 +5,183 @@
  */
 
 
-#define MAX_PLAYLISTS 2
+/*
+ * Counters written by one thread and sampled by another. The writer
+ * is the only one modifying the value, so no locked instructions are
+ * needed; the relaxed atomics only keep the accesses tear-free.
+ */
+#define STAT_ADD(var, n) \
+	__atomic_store_n(&(var), (var) + (n), __ATOMIC_RELAXED)
+#define STAT_GET(var) \
+	__atomic_load_n(&(var), __ATOMIC_RELAXED)
+
+
+/*
+ * Histogram
+ */
+
+enum {
+	HIST_SUB_BITS = 5,
+	HIST_SUB      = 1 << HIST_SUB_BITS,
+	HIST_BUCKETS  = 1024,
+};
+
+#define HIST_MAX ((1ULL << 36) - 1)  /* largest value, ~19 hours in [us] */
+
+struct hist {
+	uint64_t count;
+	uint64_t max;
+	uint64_t bucketv[HIST_BUCKETS];
+};
+
+void     hist_init(struct hist *h);
+void     hist_record(struct hist *h, uint64_t v);
+void     hist_merge(struct hist *dst, const struct hist *src);
+void     hist_load(struct hist *dst, const struct hist *src);
+void     hist_delta(struct hist *dst, const struct hist *cur,
+		    const struct hist *prev);
+uint64_t hist_percentile(const struct hist *h, double p);
+int      hist_print(struct re_printf *pf, const struct hist *h);
+
+
+/*
+ * Metrics -- written by one worker thread only, may be sampled
+ * from other threads with metrics_load()
+ */
+
+struct metrics {
+	struct hist dns;       /* DNS resolution time [us] */
+	struct hist tcp;       /* TCP connect time, new connections [us] */
+	struct hist conn;      /* session start to master playlist [us] */
+	struct hist playlist_ttfb;  /* media playlist first byte [us] */
+	struct hist playlist;  /* media playlist fetch time [us] */
+	struct hist segment_ttfb;   /* segment first byte [us] */
+	struct hist segment;   /* segment fetch time [us] */
+	struct hist segment_co;     /* segment, from intended send time [us] */
+	struct hist throughput;     /* segment body throughput [kbit/s] */
+	struct hist part;      /* LL-HLS part fetch time [us] */
+	struct hist part_hint; /* LL-HLS preload hint fetch time [us] */
+	struct hist hold_back; /* LL-HLS distance to the live edge [us] */
+	struct hist startup;   /* playout startup delay [us] */
+	struct hist stall;     /* playout stall duration [us] */
+	uint64_t dns_lookup;
+	uint64_t dns_hit;
+	uint64_t n_req;        /* completed HTTP requests */
+	uint64_t n_bytes;      /* received bytes */
+	uint64_t n_err;        /* failed HTTP requests */
+	uint64_t n_stall;      /* playout stalls */
+	uint64_t n_switch;     /* ABR variant switches */
+	uint64_t n_arrival;    /* sessions started */
+	uint64_t n_depart;     /* sessions ended by their lifetime */
+	uint64_t n_conn_new;   /* requests sent on a new connection */
+	uint64_t n_conn_reuse; /* requests sent on a kept-alive connection */
+	uint64_t n_conn_wait;  /* requests queued for a free connection */
+	uint64_t conn_time;    /* time spent in TCP handshakes [us] */
+	uint64_t n_invalid;    /* media failing fMP4 validation */
+	uint64_t check_bytes;  /* bytes walked by the fMP4 validation */
+	uint64_t check_time;   /* time spent in the fMP4 validation [ns] */
+	int64_t  n_active;     /* connected sessions */
+};
+
+void metrics_init(struct metrics *m);
+void metrics_merge(struct metrics *dst, const struct metrics *src);
+void metrics_load(struct metrics *dst, const struct metrics *src);
+void metrics_delta(struct metrics *dst, const struct metrics *cur,
+		   const struct metrics *prev);
+
+
+/*
+ * DNS cache
+ */
+
+struct dnscache;
+struct dnscache_q;
+
+typedef void (dnscache_h)(int err, const struct sa *addr, void *arg);
+
+int  dnscache_alloc(struct dnscache **dcp, struct metrics *metrics);
+int  dnscache_get(struct dnscache *dc, const char *host, struct sa *addr);
+int  dnscache_query(struct dnscache_q **qp, struct dnscache *dc,
+		    const char *host, dnscache_h *h, void *arg);
+
+
+/*
+ * HTTP client
+ */
+
+struct httpc;
+struct httpc_req;
+
+/* phase timing of one request, all values in [us] */
+struct httpc_timing {
+	uint64_t ts_start;   /* request issued */
+	uint64_t dns;        /* DNS resolution, 0 if cached */
+	uint64_t connect;    /* TCP connect, 0 if connection reused */
+	uint64_t ttfb;       /* request sent to first response byte */
+	uint64_t download;   /* first to last response byte */
+	uint64_t total;      /* request issued to last response byte */
+	uint64_t bytes;      /* body bytes received */
+	bool reused;         /* sent on a keep-alive connection */
+};
+
+typedef void (httpc_resp_h)(int err, const struct http_msg *msg,
+			    const struct httpc_timing *t, void *arg);
+
+/* connection pooling */
+enum httpc_pool {
+	HTTPC_POOL_KEEPALIVE = 0,  /* persistent, new connection if busy */
+	HTTPC_POOL_CLOSE,          /* one connection per request */
+	HTTPC_POOL_HOST,           /* persistent, capped per server */
+};
+
+struct httpc_conf {
+	enum httpc_pool pool;
+	unsigned max_host;   /* connections per server, HTTPC_POOL_HOST */
+};
+
+/* what a request is for, in the request logs */
+enum req_kind {
+	REQ_OTHER = 0,
+	REQ_MASTER,
+	REQ_PLAYLIST,
+	REQ_SEGMENT,
+	REQ_PART,
+	REQ_HINT,
+	REQ_INIT,
+};
+
+struct recwriter;
+struct shaper;
+struct trace;
+
+/* attributes of one request */
+struct httpc_opt {
+	enum req_kind kind;      /* in the request logs */
+	uint16_t rend;           /* rendition index, TRACE_NO_REND if none */
+	uint64_t range_off;      /* byte range, both 0 for all of it */
+	uint64_t range_len;      /* 0 for the rest of the resource */	uint32_t timeout;        /* [ms] without progress, 0 for the default */
+};
+
+/* where the requests of a session are logged, all optional */
+struct reqlog {
+	struct recwriter *rw;    /* CSV records */
+	struct trace *tr;        /* binary trace */
+	uint32_t sess;           /* session number within the worker */
+};
+
+int httpc_conf_decode(struct httpc_conf *conf, const char *str);
+int httpc_conf_print(struct re_printf *pf, const struct httpc_conf *conf);
+const char *httpc_pool_name(enum httpc_pool pool);
+struct objpool;
+
+int httpc_alloc(struct httpc **hcp, struct dnscache *dc, struct objpool *reqp,
+		struct metrics *metrics, const struct httpc_conf *conf);
+int httpc_reqpool_alloc(struct objpool **opp, uint32_t max);
+void httpc_set_log(struct httpc *hc, const struct reqlog *log);
+void httpc_set_rate(struct httpc *hc, struct shaper *sh, uint32_t kbps);
+int httpc_request(struct httpc_req **reqp, struct httpc *hc, const char *met,
+		  const char *uri, const struct httpc_opt *opt,
+		  httpc_resp_h *resph, http_data_h *datah, void *arg);
 
 
 /*
@@ -13,35 +189,263 @@
  */
 
 struct client;
+struct config;
+struct strpool;
+
+/* allocation pools of a worker, shared by its sessions */
+struct pools {
+	struct strpool *sp;      /* names */
+	struct objpool *mf;      /* segments and parts */
+	struct objpool *req;     /* HTTP requests */
+};
 
 typedef void (client_error_h)(struct client *cli, int err, void *arg);
 
-int  client_alloc(struct client **clip, const char *uri,
+int  client_alloc(struct client **clip, const struct config *cfg,
+		  const char *uri, struct dnscache *dc,
+		  const struct pools *pools,
+		  struct metrics *metrics, const struct reqlog *log,
 		  client_error_h *errorh, void *arg);
-int  client_start(struct client *cli);
+int  client_start(struct client *cli, uint32_t delay);
 void client_close(struct client *cli, int err);
 bool client_connected(const struct client *cli);
 int64_t client_conn_time(const struct client *cli);
 struct media_playlist * const *client_playlists(const struct client *cli);
-struct http_cli *client_http_cli(const struct client *cli);
-const struct pl *client_path(const struct client *cli);
+const struct rendtab *client_renditions(const struct client *cli);
+struct abr *client_abr(const struct client *cli);
+struct httpc *client_httpc(const struct client *cli);
+const struct pools *client_pools(const struct client *cli);
+struct metrics *client_metrics(const struct client *cli);
+const struct config *client_config(const struct client *cli);
+const char *client_uri(const struct client *cli);
+
+
+/*
+ * Shared strings, per worker
+ */
+
+struct strpool;
+
+int strpool_alloc(struct strpool **spp, uint32_t bsize);
+int strpool_get(struct strpool *sp, char **strp, const struct pl *pl);
+
+
+/*
+ * Object pools, per worker
+ */
+
+int   objpool_alloc(struct objpool **opp, size_t size, uint32_t max);
+void *objpool_get(struct objpool *op, size_t size, mem_destroy_h *dh);
+void  objpool_put(struct objpool *op, void *obj);
 
 
 /*
  * Mediafile
  */
 
+/* sub-range of a resource (EXT-X-BYTERANGE) */
+struct byterange {
+	uint64_t off;
+	uint64_t len;     /* 0 for the whole resource */
+};
+
+/* initialization segment (EXT-X-MAP), shared by its segments */
+struct mediamap {
+	char *uri;        /* shared, read-only */
+	struct byterange range;
+};
+
 struct mediafile {
 	struct le le;
-	char *filename;
+	char *filename;   /* shared, read-only */
+	uint64_t msn;     /* media sequence number */
+	uint32_t part;    /* part index within the segment (LL-HLS) */
 	double duration;  /* seconds */
-	bool played;
+	uint64_t ts_avail;  /* when it was due to be published [us] */
+	struct byterange range;
+	struct mediamap *map;  /* NULL if none */
+	struct objpool *pool;  /* released into, NULL if none */
 };
 
 
-int mediafile_new(struct list *lst, const char *filename, double duration);
-struct mediafile *mediafile_find(const struct list *lst, const char *filename);
+int mediafile_new(struct list *lst, const struct pools *pools,
+		  const struct pl *filename, uint64_t msn, double duration);
+int mediafile_part_new(struct list *lst, const struct pools *pools,
+		       const struct pl *filename, uint64_t msn, uint32_t part,
+		       double duration);
+int mediafile_pool_alloc(struct objpool **opp, uint32_t max);
+double mediafile_duration(const struct list *lst);
 struct mediafile *mediafile_next(const struct list *lst);
+unsigned mediafile_evict(struct list *lst, uint64_t msn);
+int  mediamap_alloc(struct mediamap **mapp, struct strpool *sp,
+		    const struct pl *uri, const struct byterange *range);
+bool mediamap_equal(const struct mediamap *a, const struct mediamap *b);
+
+
+/*
+ * M3U8 tokenizer
+ */
+
+enum m3u8_tag {
+	M3U8_URI = 0,
+	M3U8_COMMENT,
+	M3U8_UNKNOWN,
+	M3U8_EXTINF,
+	M3U8_MEDIA_SEQUENCE,
+	M3U8_TARGETDURATION,
+	M3U8_ENDLIST,
+	M3U8_MEDIA,
+	M3U8_STREAM_INF,
+	M3U8_PART,
+	M3U8_PART_INF,
+	M3U8_PRELOAD_HINT,
+	M3U8_SERVER_CONTROL,
+	M3U8_MAP,
+	M3U8_BYTERANGE,
+};
+
+struct m3u8_line {
+	enum m3u8_tag tag;
+	struct pl line;   /* the whole line, without line ending */
+	struct pl val;    /* text after "#EXT...:", or the URI */
+};
+
+typedef bool (m3u8_line_h)(const struct m3u8_line *ml, void *arg);
+
+void   m3u8_parse(const struct pl *pl, m3u8_line_h *lineh, void *arg);
+int    m3u8_attr(const struct pl *val, const char *name, struct pl *attr);
+int    m3u8_uri_ext(const struct pl *uri, struct pl *ext);
+int    m3u8_uri_param(const struct pl *uri, const char *name, struct pl *val);
+int    m3u8_uri_resolve(char *buf, size_t size, const struct pl *base,
+			const struct pl *ref);
+double m3u8_decimal(const struct pl *val);
+int    m3u8_byterange(const struct pl *val, uint64_t next,
+		      struct byterange *br);
+
+
+/*
+ * Renditions of the master playlist
+ */
+
+enum rendition_type {
+	RENDITION_VARIANT = 0,   /* EXT-X-STREAM-INF */
+	RENDITION_AUDIO,         /* EXT-X-MEDIA */
+	RENDITION_VIDEO,
+	RENDITION_SUBTITLES,
+};
+
+struct rendition {
+	const char *uri;
+	const char *codecs;
+	const char *group;       /* GROUP-ID, or AUDIO group of a variant */
+	uint32_t bandwidth;      /* [bit/s] */
+	uint16_t width;
+	uint16_t height;
+	uint8_t type;            /* enum rendition_type */
+	bool dflt;               /* DEFAULT=YES */
+};
+
+/* one allocation: the table followed by its strings */
+struct rendtab {
+	struct rendition *rendv;
+	uint32_t rendc;
+};
+
+int rendtab_decode(struct rendtab **rtp, const struct pl *m3u8);
+const struct rendition *rendtab_group(const struct rendtab *rt,
+				      enum rendition_type type,
+				      const char *group);
+const struct rendition *rendtab_variant(const struct rendtab *rt);
+
+
+/*
+ * Adaptive bitrate controller
+ */
+
+struct abr;
+
+/* returns the variant index, ordered by bandwidth */
+typedef uint32_t (abr_select_h)(const struct abr *abr, double level,
+				double seg_dur, double buf_max);
+
+struct abr_algo {
+	const char *name;
+	abr_select_h *selecth;
+};
+
+const struct abr_algo *abr_algo_find(const char *name);
+int  abr_alloc(struct abr **abrp, const struct abr_algo *algo,
+	       const struct rendtab *rt, const struct rendition *start);
+void abr_sample(struct abr *abr, double kbps, double duration);
+const struct rendition *abr_select(struct abr *abr, double level,
+				   double seg_dur, double buf_max);
+void abr_close(struct abr *abr);
+uint32_t abr_switches(const struct abr *abr);
+const struct rendition *abr_variant(const struct abr *abr, uint32_t ix,
+				    uint64_t *time);
+
+
+/*
+ * Playout buffer model
+ */
+
+struct playout {
+	double level;          /* buffered media [s] at ts */
+	uint64_t ts;           /* last update [us] */
+	uint64_t ts_start;     /* first request [us] */
+	uint64_t ts_stall;     /* buffer ran dry, 0 if not stalled [us] */
+	uint64_t startup;      /* startup delay, 0 if not started [us] */
+	uint64_t play_time;    /* time spent playing [us] */
+	uint64_t stall_time;   /* time spent stalled [us] */
+	uint32_t n_stall;
+	bool playing;
+	bool ended;            /* end of the content has been added */
+};
+
+void     playout_init(struct playout *po, uint64_t now);
+void     playout_update(struct playout *po, uint64_t now);
+void     playout_add(struct playout *po, double duration, uint64_t now);
+void     playout_end(struct playout *po, uint64_t now);
+void     playout_close(struct playout *po, uint64_t now);
+double   playout_rebuffer_ratio(const struct playout *po);
+
+
+/*
+ * Fragmented MP4 validation -- the state of one body being walked
+ */
+
+struct fmp4 {
+	uint64_t off;             /* bytes walked */
+	uint64_t left;            /* bytes left of the current box */
+	uint64_t endv[8];         /* end of the open containers */
+	uint64_t frag_bytes;      /* sample bytes declared by the moof */
+	uint32_t typev[8];
+	uint32_t seq;             /* last mfhd sequence number */
+	uint32_t def_size;        /* tfhd default sample size, 0 if none */
+	uint32_t trun_flags;
+	uint32_t trun_left;       /* trun entries left */
+	uint8_t buf[32];          /* box header or fields */
+	uint8_t need;             /* bytes wanted in buf */
+	uint8_t len;              /* bytes in buf */
+	uint8_t depth;
+	uint8_t state;
+	uint8_t field;
+	uint8_t trun_entry;       /* size of a trun entry */
+	bool seq_set;
+	bool open_end;            /* box extends to the end of the body */
+	bool frag_sizes;          /* all sample sizes of the moof are known */
+	bool moof;                /* a moof is waiting for its mdat */
+	bool mfhd;
+	bool media;               /* moof or moov seen */
+	const char *what;         /* what failed */
+	int err;
+};
+
+void fmp4_init(struct fmp4 *f);
+void fmp4_begin(struct fmp4 *f);
+void fmp4_restart(struct fmp4 *f);
+int  fmp4_walk(struct fmp4 *f, const uint8_t *p, size_t n);
+int  fmp4_end(struct fmp4 *f);
 
 
 /*
@@ -49,37 +453,400 @@ struct mediafile *mediafile_next(const struct list *lst);
  */
 
 
+enum media_type {
+	MEDIA_VIDEO = 0,
+	MEDIA_AUDIO,
+
+	MEDIA_TYPES
+};
+
 /*
- * represent media_0.m3u8
+ * represent one media playlist, e.g. media_0.m3u8
  */
 struct media_playlist {
 	const struct client *cli;
-	char *filename;
+	struct pools pools;      /* of the worker, NULL for the heap */
+	char *uri;               /* absolute URI, shared, read-only */
 	struct list playlist;
-	struct http_req *req;
-	struct http_req *req_media;
+	struct httpc_req *req;
+	struct httpc_req *req_media;
 	struct tmr tmr_reload;
 	struct tmr tmr_play;
-	double last_dur;
+	double last_dur;         /* EXTINF of the next segment [s] */
+	uint32_t target_dur;     /* EXT-X-TARGETDURATION [s] */
+	bool endlist;            /* EXT-X-ENDLIST seen, no more reloads */
 	bool terminated;
 
-	size_t bytes;
-	uint64_t ts_media_req;
-	uint64_t ts_media_resp;
-	uint64_t media_time_acc;
-	unsigned media_count;
-	uint64_t bitrate_acc;
+	uint64_t seq;            /* EXT-X-MEDIA-SEQUENCE of last reload */
+	uint64_t parse_msn;      /* sequence number of next parsed segment */
+	uint64_t next_msn;       /* first sequence number not yet known */
+	uint64_t end_msn;        /* parse_msn at the end of last reload */
+	uint64_t n_skipped;      /* segments that left the window unplayed */
+
+	/* Low-Latency HLS */
+	bool ll;                 /* playlist has parts and LL mode is on */
+	bool can_block;          /* CAN-BLOCK-RELOAD=YES */
+	bool part_started;       /* initial hold-back has been applied */
+	double part_target;      /* EXT-X-PART-INF PART-TARGET [s] */
+	double part_hold_back;   /* EXT-X-SERVER-CONTROL PART-HOLD-BACK [s] */
+	struct list parts;       /* parts not fetched yet, ordered */
+	struct httpc_req *req_part;
+	struct httpc_req *req_hint;
+	char *hint_uri;          /* last requested EXT-X-PRELOAD-HINT */
+	struct byterange hint_range;  /* of hint_uri, len 0 for the rest */
+	struct pl parse_hint;    /* preload hint of the playlist being parsed */
+	struct byterange parse_hint_range;
+	uint32_t parse_part;     /* index of next parsed part in parse_msn */
+	uint32_t end_part;       /* parse_part at the end of last reload */
+	uint64_t next_part;      /* first part position not yet known */
+
+	/* EXT-X-MAP and EXT-X-BYTERANGE */
+	struct mediamap *map;       /* initialization segment loaded */
+	struct mediamap *parse_map; /* map of the segments being parsed */
+	struct byterange parse_range;  /* of the next parsed segment */
+	uint64_t parse_range_end;   /* end of the last segment range */
+	uint64_t parse_part_end;    /* end of the last part range */
+
+	uint64_t bytes;          /* body bytes of all segments */
+	uint64_t seg_bytes;      /* body bytes of the current segment */
+	struct fmp4 *fmp4;       /* segment validation, NULL if off */
+	struct fmp4 *fmp4_part;  /* part validation, NULL if off */
+	bool check;              /* the segment body is validated */
+	bool check_part;         /* the part body is validated */
+
+	struct playout po;       /* player buffer */
+	double req_dur;          /* media duration being downloaded [s] */
+	uint16_t rend;           /* rendition index, for the request logs */
+	uint64_t ts_avail;       /* due time of the next new segment [us] */
+	uint64_t ts_room;        /* buffer has room for the next one [us] */
+	uint64_t ts_intended;    /* intended send time of current one [us] */
 };
 
 
 int playlist_new(struct media_playlist **plp, const struct client *cli,
 		 const char *filename);
 int playlist_start(struct media_playlist *pl);
+int playlist_switch(struct media_playlist *mpl, const char *filename);
+bool playlist_parse(struct media_playlist *mpl, const struct pl *m3u8);
 void playlist_close(struct media_playlist *mpl, int err);
 
 
+/*
+ * Summary of ended sessions
+ */
+
+/* time spent in one variant, over all sessions */
+struct vtime {
+	uint32_t bandwidth;       /* [bit/s] */
+	uint16_t width;
+	uint16_t height;
+	uint64_t time;            /* [us] */
+};
+
+struct summary {
+	struct vtime *vtv;        /* ordered by bandwidth */
+	size_t vtc;
+	struct hist rebuffer;     /* per session rebuffer ratio [0.001 %] */
+	size_t n_sess;
+	size_t n_connected;
+	size_t n_stalled;         /* sessions with at least one stall */
+	uint64_t n_skipped;
+	uint64_t play_time;       /* [us] */
+	uint64_t stall_time;      /* [us] */
+	uint64_t mem_bytes;       /* resident memory of the sessions */
+	uint64_t mem_sess;        /* ... and their number, see memusage */
+};
+
+void summary_init(struct summary *sum);
+void summary_reset(struct summary *sum);
+void summary_add_client(struct summary *sum, const struct client *cli);
+void summary_merge(struct summary *dst, const struct summary *src);
+int  summary_encode(struct mbuf *mb, const struct summary *sum);
+int  summary_decode(struct summary *sum, struct mbuf *mb);
+
+
+/*
+ * Load profile
+ */
+
+struct phase {
+	double rate0;             /* new sessions per second at the start */
+	double rate1;             /* ... and at the end */
+	double dur;               /* [s] */
+};
+
+struct profile {
+	struct phase *phasev;
+	size_t phasec;
+	double dur;               /* total [s] */
+};
+
+enum dist_type {
+	DIST_NONE = 0,
+	DIST_FIXED,
+	DIST_UNIFORM,
+	DIST_EXP,
+	DIST_LOGNORMAL,
+};
+
+struct dist {
+	enum dist_type type;
+	double a;
+	double b;
+};
+
+int    profile_decode(struct profile **profp, const char *str);
+int    profile_print(struct re_printf *pf, const struct profile *prof);
+void   profile_scale(struct profile *prof, double factor);
+const struct phase *profile_phase(const struct profile *prof, double t,
+				  double *t0);
+double phase_rate(const struct phase *ph, double t);
+int    dist_decode(struct dist *d, const char *str);
+int    dist_print(struct re_printf *pf, const struct dist *d);
+const char *dist_name(enum dist_type type);
+double dist_sample(const struct dist *d);
+double rand_uniform(void);
+
+
+/*
+ * Link speed shaping
+ */
+
+enum {
+	LINKMIX_MAX = 8
+};
+
+/* link speeds of the sessions, drawn per session */
+struct linkmix {
+	double sharev[LINKMIX_MAX];   /* relative share of the sessions */
+	uint32_t kbpsv[LINKMIX_MAX];  /* [kbit/s], 0 for unlimited */
+	unsigned n;                   /* 0 if not shaped */
+};
+
+/* receive token bucket of one session */
+struct bucket {
+	double tokens;            /* [bytes] */
+	double rate;              /* [bytes/s], 0 for unlimited */
+	double burst;             /* [bytes] */
+	uint64_t ts;              /* last refill [us] */
+};
+
+struct shaper;
+
+typedef void (shaper_wake_h)(void *arg);
+
+struct shaper_wait {
+	struct le le;
+	struct shaper *sh;
+	uint64_t ts_wake;         /* [us] */
+	shaper_wake_h *wakeh;
+	void *arg;
+};
+
+int      linkmix_decode(struct linkmix *lm, const char *str);
+int      linkmix_print(struct re_printf *pf, const struct linkmix *lm);
+uint32_t linkmix_sample(const struct linkmix *lm);
+void     bucket_init(struct bucket *b, uint32_t kbps, uint64_t now);
+size_t   bucket_avail(struct bucket *b, uint64_t now);
+void     bucket_take(struct bucket *b, size_t n);
+uint64_t bucket_delay(const struct bucket *b, size_t n);
+int      shaper_alloc(struct shaper **shp);
+void     shaper_wait(struct shaper *sh, struct shaper_wait *sw,
+		     uint64_t ts_wake, shaper_wake_h *wakeh, void *arg);
+void     shaper_cancel(struct shaper_wait *sw);
+
+
+/*
+ * Per-request records
+ */
+
+struct recorder;
+
+struct reqrec {
+	uint64_t ts;         /* request issued [us] */
+	uint64_t dns;        /* [us] */
+	uint64_t connect;    /* [us] */
+	uint64_t ttfb;       /* [us] */
+	uint64_t total;      /* [us] */
+	uint64_t bytes;      /* body bytes */
+	uint32_t sess;       /* session number within the worker */
+	unsigned worker;
+	int err;
+	uint16_t scode;
+	uint16_t rend;       /* rendition index, TRACE_NO_REND if none */
+	uint8_t kind;        /* enum req_kind */
+	bool reused;
+	char name[32];       /* last path segment, truncated */
+};
+
+int      recorder_alloc(struct recorder **recp, const char *path);
+uint64_t recorder_dropped(struct recorder *rec);
+int      recwriter_alloc(struct recwriter **rwp, struct recorder *rec,
+			 unsigned ix);
+void     recwriter_add(struct recwriter *rw, const struct reqrec *r);
+void     recwriter_flush(struct recwriter *rw);
+
+
+/*
+ * Binary request trace -- the file format is a header followed by a
+ * ring of records, in host byte order
+ */
+
+#define TRACE_MAGIC   "HLSTRACE"
+#define TRACE_VERSION 1
+#define TRACE_NO_REND 0xffff
+
+enum {
+	TRACE_REUSED = 1 << 0,   /* sent on a kept-alive connection */
+};
+
+struct trace_hdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t recsize;
+	uint64_t capacity;       /* records in the ring, a power of two */
+	uint64_t head;           /* records written, the ring has the last */
+	uint64_t ts_start;       /* monotonic [us] */
+	uint64_t wall_start;     /* wall clock at ts_start [us] */
+	uint32_t worker;
+	uint32_t reserved[3];
+};
+
+struct trace_rec {
+	uint64_t ts;             /* request issued, since ts_start [us] */
+	uint64_t bytes;          /* body bytes */
+	uint32_t dns;            /* [us] */
+	uint32_t connect;        /* [us] */
+	uint32_t ttfb;           /* [us] */
+	uint32_t total;          /* [us] */
+	uint32_t sess;
+	uint32_t uri_hash;       /* of the request path */
+	int32_t  err;
+	uint16_t scode;
+	uint16_t rend;           /* rendition index, or TRACE_NO_REND */
+	uint8_t  kind;           /* enum req_kind */
+	uint8_t  flags;          /* TRACE_REUSED */
+	uint8_t  reserved[14];
+};
+
+int      trace_alloc(struct trace **trp, const char *prefix, unsigned ix,
+		     uint64_t capacity);
+void     trace_add(struct trace *tr, const struct trace_rec *r);
+uint64_t trace_start(const struct trace *tr);
+const char *req_kind_name(enum req_kind kind);
+
+
+/*
+ * Machine-readable summary
+ */
+
+int output_summary(const char *path, const struct config *cfg,
+		   const char *uri, const struct metrics *m,
+		   const struct summary *sum);
+
+
+/*
+ * Configuration -- set up by main, read-only for the workers
+ */
+
+struct config {
+	bool llhls;        /* Low-Latency HLS: parts, hints, blocking reload */
+	bool validate;     /* walk the fMP4 boxes of segments and parts */
+	const struct abr_algo *abr;  /* ABR algorithm, NULL for fixed variant */
+	struct profile *profile;     /* arrival rate, NULL for a fixed count */
+	struct dist lifetime;        /* session lifetime [s], none if unset */
+	struct linkmix links;        /* link speeds, none if unset */
+	unsigned workers;            /* number of worker threads */
+	struct httpc_conf http;      /* connection pooling */
+	struct recorder *rec;        /* per-request records, NULL if off */
+	const char *trace;           /* binary trace file prefix, or NULL */
+};
+
+
+/*
+ * Worker
+ */
+
+struct worker;
+
+int  worker_alloc(struct worker **wp, unsigned ix, const struct config *cfg,
+		  const char *uri, uint32_t num_sess);
+void worker_stop(struct worker *w);
+void worker_summary(const struct worker *w, struct summary *sum);
+const struct metrics *worker_metrics(const struct worker *w);
+
+
+/*
+ * Message link between the controller and its agents
+ */
+
+struct link;
+
+typedef void (link_msg_h)(uint32_t type, struct mbuf *mb, void *arg);
+typedef void (link_close_h)(int err, void *arg);
+
+int link_alloc(struct link **lkp, int fd, link_msg_h *msgh,
+	       link_close_h *closeh, void *arg);
+int link_connect(struct link **lkp, const struct sa *peer, link_msg_h *msgh,
+		 link_close_h *closeh, void *arg);
+int link_send(struct link *lk, uint32_t type, const uint8_t *p, size_t n);
+
+
+/*
+ * Controller and agents -- one run spread over several processes.
+ * Payloads are in host byte order and the metrics are sent as they
+ * are, so all processes must run the same build, which HELLO checks.
+ */
+
+#define AGENT_MAGIC   0x484c5341  /* "HLSA" */
+#define AGENT_VERSION 2
+
+enum agent_msg {
+	MSG_HELLO = 1,   /* agent: magic, version, size of the metrics */
+	MSG_CONFIG,      /* controller: "key=value" lines */
+	MSG_READY,       /* agent: configured, number of workers */
+	MSG_ERROR,       /* agent: error text */
+	MSG_START,       /* controller: start time, wall clock [us] */
+	MSG_STATS,       /* agent: metrics, every second */
+	MSG_STOP,        /* controller: stop the sessions */
+	MSG_DONE,        /* agent: final metrics and summary */
+};
+
+struct controller;
+
+/* the agents start in `delay` [ms] */
+typedef void (controller_start_h)(uint32_t delay, void *arg);
+typedef void (controller_done_h)(int err, void *arg);
+
+int  agent_run(const char *addr);
+int  agent_spawn(int *fdp, pid_t *pidp, const int *closev, size_t closec);
+int  controller_alloc(struct controller **ctrlp, const struct config *cfg,
+		      const char *uri, uint32_t num_sess, uint32_t workers,
+		      controller_start_h *starth, controller_done_h *doneh,
+		      void *arg);
+int  controller_connect(struct controller *ctrl, const struct sa *addr);
+int  controller_attach(struct controller *ctrl, int fd, pid_t pid);
+void controller_stop(struct controller *ctrl);
+void controller_metrics(const struct controller *ctrl, struct metrics *m);
+void controller_summary(const struct controller *ctrl,
+			struct summary *sum);
+unsigned controller_agents(const struct controller *ctrl);
+
+
 /*
  * Utils
  */
 
+/* growth of the resident memory, at the peak of active sessions */
+struct memusage {
+	uint64_t base;            /* before the sessions [bytes] */
+	uint64_t bytes;           /* growth from base at the peak */
+	uint64_t n_sess;          /* active sessions at the peak */
+};
+
 int dns_init(struct dnsc **dnsc);
+uint64_t time_usec(void);
+uint64_t time_nsec(void);
+uint64_t time_wall(void);
+void memusage_init(struct memusage *mu);
+void memusage_sample(struct memusage *mu, int64_t n_active);
@@ -0,0 +1,1301 @@
+/**
+ * @file httpc.c HLS Performance client -- HTTP/1.1 client
+ *
+ * Copyright (C) 2019 Creytiv.com
+ */
+
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <re.h>
+#include "hlsperf.h"
+
+
+#define DEBUG_MODULE "hlsperf"
+#define DEBUG_LEVEL 6
+#include <re_dbg.h>
+
+
+/*
+ * A minimal HTTP/1.1 client with keep-alive connections.
+ *
+ * Host names are resolved through the worker's DNS cache, which is
+ * why sessions do not use the libre HTTP client (it runs a DNS query
+ * for every request).
+ *
+ * Connections are pooled per client (session), see enum httpc_pool.
+ * With a per-server cap, requests wait in a queue until a connection
+ * to their server becomes idle or is closed, like in a browser.
+ */
+
+
+enum {
+	RECV_SIZE       = 16384,
+	RECV_MIN        = 4096,   /* tokens needed to resume reading */
+	PROGRESS_TMR    = 10000,  /* ms without progress before timeout */
+	HOST_SIZE       = 256,
+	MAX_HOST        = 6,      /* default per-server connection cap */
+};
+
+enum body_mode {
+	BODY_NONE = 0,
+	BODY_CLEN,
+	BODY_CHUNKED,
+	BODY_CLOSE,
+};
+
+enum chunk_state {
+	CHUNK_SIZE = 0,
+	CHUNK_EXT,
+	CHUNK_SIZE_LF,
+	CHUNK_DATA,
+	CHUNK_DATA_CR,
+	CHUNK_DATA_LF,
+	CHUNK_TRAILER,
+	CHUNK_TRAILER_LINE,
+	CHUNK_TRAILER_LF,
+};
+
+struct httpc {
+	struct dnscache *dc;
+	struct objpool *reqp;     /* requests, NULL for the heap */
+	struct metrics *metrics;
+	struct httpc_conf conf;
+	struct list connl;
+	struct list reql;
+	struct list waitl;        /* requests waiting for a connection */
+	struct tmr tmr_wait;
+	struct reqlog log;        /* request logs, all optional */
+	struct shaper *sh;        /* link speed shaping, NULL if off */
+	struct bucket bucket;     /* receive rate of the session */
+};
+
+struct conn {
+	struct le le;
+	struct httpc *hc;
+	struct httpc_req *req;    /* active request, NULL if idle */
+	struct mbuf *mb;          /* response header */
+	struct sa peer;
+	uint64_t ts_conn;         /* connect started [us] */
+	struct shaper_wait sw;    /* reading paused, out of tokens */
+	int fd;
+	bool estab;
+	unsigned nreq;            /* requests sent on connection */
+};
+
+struct httpc_req {
+	struct le le;
+	struct le le_wait;
+	struct httpc *hc;
+	struct httpc_req **reqp;
+	struct conn *conn;
+	struct dnscache_q *dq;
+	struct mbuf *mbreq;
+	struct mbuf *hdr;
+	struct mbuf *body;
+	struct http_msg *msg;
+	struct tmr tmr;
+	char host[HOST_SIZE];
+	char name[32];            /* for the request record */
+	uint32_t uri_hash;        /* for the trace */
+	enum req_kind kind;
+	uint16_t rend;
+	uint16_t port;
+	struct sa addr;
+	httpc_resp_h *resph;
+	http_data_h *datah;
+	void *arg;
+	struct objpool *pool;     /* released into, NULL if none */
+
+	struct httpc_timing t;
+	uint64_t ts_sent;         /* [us] */
+	uint64_t ts_first;        /* [us] */
+
+	enum body_mode mode;
+	enum chunk_state cstate;
+	uint64_t body_left;       /* Content-Length or chunk bytes left */
+	uint64_t rx;              /* total bytes received */
+	uint64_t rx_tmr;          /* bytes received at last timer tick */
+	uint32_t timeout;         /* [ms] without progress */
+	bool head;
+	bool keepalive;
+	bool retried;
+};
+
+
+static const struct pl pl_slash = PL("/");
+
+
+static void conn_close(struct conn *conn);
+static int  req_connect(struct httpc_req *req);
+static void conn_fd_handler(int flags, void *arg);
+static void wait_schedule(struct httpc *hc);
+
+
+static void httpc_destructor(void *data)
+{
+	struct httpc *hc = data;
+
+	/* cancel outstanding requests without calling their handlers */
+	while (hc->reql.head) {
+
+		struct httpc_req *req = hc->reql.head->data;
+
+		list_unlink(&req->le);
+
+		if (req->reqp) {
+			*req->reqp = NULL;
+			req->reqp = NULL;
+		}
+
+		mem_deref(req);
+	}
+
+	while (hc->connl.head)
+		conn_close(hc->connl.head->data);
+
+	tmr_cancel(&hc->tmr_wait);
+	mem_deref(hc->dc);
+	mem_deref(hc->reqp);
+	mem_deref(hc->sh);
+}
+
+
+static void conn_destructor(void *data)
+{
+	struct conn *conn = data;
+
+	list_unlink(&conn->le);
+	shaper_cancel(&conn->sw);
+
+	if (conn->fd >= 0) {
+		fd_close(conn->fd);
+		(void)close(conn->fd);
+	}
+
+	mem_deref(conn->mb);
+}
+
+
+static void req_destructor(void *data)
+{
+	struct httpc_req *req = data;
+
+	list_unlink(&req->le);
+	list_unlink(&req->le_wait);
+	tmr_cancel(&req->tmr);
+
+	/* a cancelled request leaves the connection in an unknown state */
+	if (req->conn)
+		conn_close(req->conn);
+
+	mem_deref(req->dq);
+	mem_deref(req->mbreq);
+	mem_deref(req->msg);
+	mem_deref(req->hdr);
+	mem_deref(req->body);
+
+	objpool_put(req->pool, req);
+}
+
+
+/*
+ * Close the socket and release the connection. The memory stays valid
+ * while the fd handler holds a reference (fd == -1 marks it closed).
+ */
+static void conn_close(struct conn *conn)
+{
+	if (conn->req) {
+		conn->req->conn = NULL;
+		conn->req = NULL;
+	}
+
+	list_unlink(&conn->le);
+	shaper_cancel(&conn->sw);
+	wait_schedule(conn->hc);
+
+	if (conn->fd >= 0) {
+		fd_close(conn->fd);
+		(void)close(conn->fd);
+		conn->fd = -1;
+	}
+
+	mem_deref(conn);
+}
+
+
+static void req_record(const struct httpc_req *req, int err)
+{
+	struct reqrec r;
+
+	memset(&r, 0, sizeof(r));
+
+	r.ts      = req->t.ts_start;
+	r.dns     = req->t.dns;
+	r.connect = req->t.connect;
+	r.ttfb    = req->t.ttfb;
+	r.total   = req->t.total;
+	r.bytes   = req->t.bytes;
+	r.sess    = req->hc->log.sess;
+	r.err     = err;
+	r.scode   = req->msg ? req->msg->scode : 0;
+	r.rend    = req->rend;
+	r.kind    = req->kind;
+	r.reused  = req->t.reused;
+	memcpy(r.name, req->name, sizeof(r.name));
+
+	recwriter_add(req->hc->log.rw, &r);
+}
+
+
+static uint32_t clamp32(uint64_t v)
+{
+	return (uint32_t)min(v, (uint64_t)UINT32_MAX);
+}
+
+
+static void req_trace(const struct httpc_req *req, int err)
+{
+	struct trace *tr = req->hc->log.tr;
+	struct trace_rec r;
+
+	memset(&r, 0, sizeof(r));
+
+	r.ts       = req->t.ts_start - trace_start(tr);
+	r.bytes    = req->t.bytes;
+	r.dns      = clamp32(req->t.dns);
+	r.connect  = clamp32(req->t.connect);
+	r.ttfb     = clamp32(req->t.ttfb);
+	r.total    = clamp32(req->t.total);
+	r.sess     = req->hc->log.sess;
+	r.uri_hash = req->uri_hash;
+	r.err      = err;
+	r.scode    = req->msg ? req->msg->scode : 0;
+	r.rend     = req->rend;
+	r.kind     = req->kind;
+	r.flags    = req->t.reused ? TRACE_REUSED : 0;
+
+	trace_add(tr, &r);
+}
+
+
+/* hand the response to the caller and release the request */
+static void req_complete(struct httpc_req *req, int err)
+{
+	struct conn *conn = req->conn;
+	const uint64_t now = time_usec();
+
+	tmr_cancel(&req->tmr);
+	list_unlink(&req->le);
+	list_unlink(&req->le_wait);
+
+	if (req->ts_first) {
+		req->t.ttfb     = req->ts_first - req->ts_sent;
+		req->t.download = now - req->ts_first;
+	}
+	req->t.total = now - req->t.ts_start;
+
+	STAT_ADD(req->hc->metrics->n_req, 1);
+	if (err || (req->msg && req->msg->scode >= 400))
+		STAT_ADD(req->hc->metrics->n_err, 1);
+
+	if (req->hc->log.rw)
+		req_record(req, err);
+	if (req->hc->log.tr)
+		req_trace(req, err);
+
+	if (conn) {
+		conn->req = NULL;
+		req->conn = NULL;
+
+		if (err || !req->keepalive ||
+		    req->hc->conf.pool == HTTPC_POOL_CLOSE) {
+			conn_close(conn);
+		}
+		else {
+			fd_listen(conn->fd, FD_READ, conn_fd_handler, conn);
+			wait_schedule(req->hc);
+		}
+	}
+
+	if (req->reqp) {
+		*req->reqp = NULL;
+		req->reqp = NULL;
+	}
+
+	if (req->resph) {
+
+		if (err) {
+			req->resph(err, NULL, &req->t, req->arg);
+		}
+		else {
+			struct http_msg *msg = req->msg;
+
+			if (!req->datah) {
+				mem_deref(msg->mb);
+				msg->mb = mem_ref(req->body);
+			}
+
+			req->resph(0, msg, &req->t, req->arg);
+		}
+	}
+
+	mem_deref(req);
+}
+
+
+static void tmr_handler(void *arg)
+{
+	struct httpc_req *req = arg;
+
+	if (req->rx == req->rx_tmr) {
+		req_complete(req, ETIMEDOUT);
+		return;
+	}
+
+	req->rx_tmr = req->rx;
+	tmr_start(&req->tmr, req->timeout, tmr_handler, req);
+}
+
+
+/*
+ * Deliver body bytes to the data handler, or buffer them.
+ * Returns ECANCELED if the handler cancelled the request.
+ */
+static int body_recv(struct httpc_req *req, const uint8_t *p, size_t n)
+{
+	bool cancelled;
+	int err;
+
+	if (!n)
+		return 0;
+
+	if (!req->datah)
+		return mbuf_write_mem(req->body, p, n);
+
+	mem_ref(req);
+	err = req->datah(p, n, req->msg, req->arg);
+	cancelled = mem_nrefs(req) == 1;
+	mem_deref(req);
+
+	return cancelled ? ECANCELED : err;
+}
+
+
+static int hexval(uint8_t c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+
+	return -1;
+}
+
+
+/*
+ * Decode chunked transfer encoding.
+ * Returns the number of bytes consumed, or a negative error code.
+ */
+static ssize_t chunked_recv(struct httpc_req *req, const uint8_t *p,
+			    size_t n, bool *done)
+{
+	size_t i = 0;
+	int err;
+
+	while (i < n && !*done) {
+
+		const uint8_t c = p[i];
+		size_t len;
+
+		switch (req->cstate) {
+
+		case CHUNK_SIZE:
+			if (hexval(c) >= 0) {
+				/* a chunk size beyond 64 bits */
+				if (req->body_left > (UINT64_MAX >> 4))
+					return -EBADMSG;
+
+				req->body_left = req->body_left*16 + hexval(c);
+			}
+			else if (c == '\r')
+				req->cstate = CHUNK_SIZE_LF;
+			else if (c == ';' || c == ' ' || c == '\t')
+				req->cstate = CHUNK_EXT;
+			else
+				return -EBADMSG;
+			++i;
+			break;
+
+		case CHUNK_EXT:
+			if (c == '\r')
+				req->cstate = CHUNK_SIZE_LF;
+			++i;
+			break;
+
+		case CHUNK_SIZE_LF:
+			if (c != '\n')
+				return -EBADMSG;
+			req->cstate = req->body_left ? CHUNK_DATA
+				: CHUNK_TRAILER;
+			++i;
+			break;
+
+		case CHUNK_DATA:
+			len = (size_t)min((uint64_t)(n - i), req->body_left);
+
+			err = body_recv(req, p + i, len);
+			if (err)
+				return -err;
+
+			req->t.bytes += len;
+			req->body_left -= len;
+			if (!req->body_left)
+				req->cstate = CHUNK_DATA_CR;
+			i += len;
+			break;
+
+		case CHUNK_DATA_CR:
+			if (c != '\r')
+				return -EBADMSG;
+			req->cstate = CHUNK_DATA_LF;
+			++i;
+			break;
+
+		case CHUNK_DATA_LF:
+			if (c != '\n')
+				return -EBADMSG;
+			req->cstate = CHUNK_SIZE;
+			++i;
+			break;
+
+		case CHUNK_TRAILER:
+			/* an empty line terminates the trailer */
+			req->cstate = (c == '\r') ? CHUNK_TRAILER_LF
+				: CHUNK_TRAILER_LINE;
+			++i;
+			break;
+
+		case CHUNK_TRAILER_LINE:
+			if (c == '\n')
+				req->cstate = CHUNK_TRAILER;
+			++i;
+			break;
+
+		case CHUNK_TRAILER_LF:
+			if (c != '\n')
+				return -EBADMSG;
+			*done = true;
+			++i;
+			break;
+		}
+	}
+
+	return i;
+}
+
+
+/*
+ * Feed received body bytes to the active request.
+ * Returns the number of bytes consumed, or a negative error code.
+ */
+static ssize_t req_recv(struct httpc_req *req, const uint8_t *p, size_t n,
+			bool *done)
+{
+	size_t len;
+	int err;
+
+	switch (req->mode) {
+
+	case BODY_CLEN:
+		len = (size_t)min((uint64_t)n, req->body_left);
+
+		err = body_recv(req, p, len);
+		if (err)
+			return -err;
+
+		req->t.bytes += len;
+		req->body_left -= len;
+		*done = req->body_left == 0;
+		return len;
+
+	case BODY_CHUNKED:
+		return chunked_recv(req, p, n, done);
+
+	case BODY_CLOSE:
+		err = body_recv(req, p, n);
+		if (err)
+			return -err;
+
+		req->t.bytes += n;
+		return n;
+
+	default:
+		*done = true;
+		return 0;
+	}
+}
+
+
+/* decide how the body of the response is delimited */
+static void req_set_mode(struct httpc_req *req, const struct http_msg *msg)
+{
+	const struct http_hdr *hdr;
+
+	req->keepalive = 0 == pl_strcmp(&msg->ver, "1.1") &&
+		!http_msg_hdr_has_value(msg, HTTP_HDR_CONNECTION, "close");
+
+	if (req->head || msg->scode == 204 || msg->scode == 304) {
+		req->mode = BODY_NONE;
+		return;
+	}
+
+	if (http_msg_hdr_has_value(msg, HTTP_HDR_TRANSFER_ENCODING,
+				   "chunked")) {
+		req->mode   = BODY_CHUNKED;
+		req->cstate = CHUNK_SIZE;
+		req->body_left = 0;
+		return;
+	}
+
+	hdr = http_msg_hdr(msg, HTTP_HDR_CONTENT_LENGTH);
+	if (hdr) {
+		req->mode = BODY_CLEN;
+		req->body_left = pl_u64(&hdr->val);
+		return;
+	}
+
+	req->mode = BODY_CLOSE;
+	req->keepalive = false;
+}
+
+
+/*
+ * Handle received bytes on a connection with an active request.
+ * Returns true if the request was completed or cancelled.
+ */
+static bool conn_recv(struct conn *conn, const uint8_t *p, size_t n)
+{
+	struct httpc_req *req = conn->req;
+	bool done = false;
+	ssize_t len;
+	int err;
+
+	if (!req->ts_first)
+		req->ts_first = time_usec();
+
+	req->rx += n;
+	STAT_ADD(conn->hc->metrics->n_bytes, n);
+
+	while (!req->msg) {
+
+		conn->mb->pos = conn->mb->end;
+
+		if (n) {
+			err = mbuf_write_mem(conn->mb, p, n);
+			if (err)
+				goto error;
+		}
+
+		conn->mb->pos = 0;
+		p = NULL;
+		n = 0;
+
+		err = http_msg_decode(&req->msg, conn->mb, false);
+		if (err == ENODATA)
+			return false;
+		else if (err)
+			goto error;
+
+		/* 1xx: skip the interim response */
+		if (req->msg->scode < 200) {
+			size_t left = mbuf_get_left(conn->mb);
+
+			req->msg = mem_deref(req->msg);
+			memmove(conn->mb->buf, mbuf_buf(conn->mb), left);
+			conn->mb->pos = 0;
+			conn->mb->end = left;
+			continue;
+		}
+
+		/* keep the header, it is referenced by the message */
+		req->hdr = conn->mb;
+		conn->mb = mbuf_alloc(1024);
+		if (!conn->mb) {
+			err = ENOMEM;
+			goto error;
+		}
+
+		req_set_mode(req, req->msg);
+
+		p = mbuf_buf(req->hdr);
+		n = mbuf_get_left(req->hdr);
+	}
+
+	len = req_recv(req, p, n, &done);
+	if (len == -ECANCELED)
+		return true;
+	else if (len < 0) {
+		err = (int)-len;
+		goto error;
+	}
+
+	if (done) {
+		if ((size_t)len < n)
+			req->keepalive = false;  /* unexpected trailing data */
+
+		req_complete(req, 0);
+		return true;
+	}
+
+	return false;
+
+ error:
+	req_complete(req, err);
+	return true;
+}
+
+
+static void conn_error(struct conn *conn, int err)
+{
+	struct httpc_req *req = conn->req;
+
+	if (req) {
+		/* the server closed an idle keep-alive connection */
+		if (conn->nreq > 1 && !req->msg && !req->retried) {
+
+			req->retried = true;
+			req->conn = NULL;
+			conn->req = NULL;
+			conn_close(conn);
+
+			err = req_connect(req);
+			if (err)
+				req_complete(req, err);
+			return;
+		}
+
+		/* the body is delimited by the end of the connection */
+		if (!err && req->mode == BODY_CLOSE && req->msg) {
+			req_complete(req, 0);
+			return;
+		}
+
+		req_complete(req, err ? err : ECONNRESET);
+		return;
+	}
+
+	conn_close(conn);
+}
+
+
+static int conn_send(struct conn *conn)
+{
+	struct mbuf *mb = conn->req->mbreq;
+	ssize_t n;
+
+	while (mbuf_get_left(mb)) {
+
+		n = send(conn->fd, mbuf_buf(mb), mbuf_get_left(mb),
+			 MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return fd_listen(conn->fd, FD_READ | FD_WRITE,
+						 conn_fd_handler, conn);
+			return errno;
+		}
+
+		mbuf_advance(mb, n);
+	}
+
+	conn->req->ts_sent = time_usec();
+
+	return fd_listen(conn->fd, FD_READ, conn_fd_handler, conn);
+}
+
+
+static void conn_resume(void *arg)
+{
+	struct conn *conn = arg;
+	int flags = FD_READ;
+	int err;
+
+	/* a request may have been sent on it in the meantime */
+	if (conn->req && mbuf_get_left(conn->req->mbreq))
+		flags |= FD_WRITE;
+
+	err = fd_listen(conn->fd, flags, conn_fd_handler, conn);
+	if (err)
+		conn_error(conn, err);
+}
+
+
+static void conn_fd_handler(int flags, void *arg)
+{
+	struct conn *conn = arg;
+	struct bucket *b = &conn->hc->bucket;
+	uint8_t buf[RECV_SIZE];
+	size_t lim = sizeof(buf);
+	ssize_t n;
+	int err;
+
+	if (!conn->estab) {
+		socklen_t len = sizeof(err);
+
+		if (getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &err, &len))
+			err = errno;
+		if (err) {
+			conn_error(conn, err);
+			return;
+		}
+
+		conn->estab = true;
+
+		if (conn->req) {
+			uint64_t t = time_usec() - conn->ts_conn;
+
+			conn->req->t.connect = t;
+			hist_record(&conn->hc->metrics->tcp, t);
+			STAT_ADD(conn->hc->metrics->conn_time, t);
+
+			err = conn_send(conn);
+			if (err)
+				conn_error(conn, err);
+		}
+		return;
+	}
+
+	if ((flags & FD_WRITE) && conn->req) {
+		err = conn_send(conn);
+		if (err) {
+			conn_error(conn, err);
+			return;
+		}
+	}
+
+	if (!(flags & FD_READ))
+		return;
+
+	/* out of tokens: stop reading until the bucket has refilled */
+	if (conn->hc->sh) {
+
+		const uint64_t now = time_usec();
+
+		lim = min(bucket_avail(b, now), lim);
+		if (lim < RECV_MIN) {
+			fd_close(conn->fd);
+			shaper_wait(conn->hc->sh, &conn->sw,
+				    now + bucket_delay(b, RECV_MIN),
+				    conn_resume, conn);
+			return;
+		}
+	}
+
+	n = recv(conn->fd, buf, lim, 0);
+	if (n < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+			return;
+		conn_error(conn, errno);
+		return;
+	}
+	else if (n == 0) {
+		conn_error(conn, 0);
+		return;
+	}
+
+	bucket_take(b, n);
+
+	if (!conn->req) {
+		/* unexpected data on an idle connection */
+		conn_close(conn);
+		return;
+	}
+
+	mem_ref(conn);
+	(void)conn_recv(conn, buf, n);
+	mem_deref(conn);
+}
+
+
+static struct conn *conn_idle(const struct httpc *hc, const struct sa *peer)
+{
+	struct le *le;
+
+	for (le = list_head(&hc->connl); le; le = le->next) {
+
+		struct conn *conn = le->data;
+
+		if (!conn->req && conn->estab &&
+		    sa_cmp(&conn->peer, peer, SA_ALL))
+			return conn;
+	}
+
+	return NULL;
+}
+
+
+/* number of connections to `peer`, idle or busy */
+static unsigned conn_count(const struct httpc *hc, const struct sa *peer)
+{
+	struct le *le;
+	unsigned n = 0;
+
+	for (le = list_head(&hc->connl); le; le = le->next) {
+
+		const struct conn *conn = le->data;
+
+		if (sa_cmp(&conn->peer, peer, SA_ALL))
+			++n;
+	}
+
+	return n;
+}
+
+
+/* a request to `peer` can be sent now */
+static bool conn_available(const struct httpc *hc, const struct sa *peer)
+{
+	if (hc->conf.pool != HTTPC_POOL_HOST)
+		return true;
+
+	return conn_idle(hc, peer) || conn_count(hc, peer) < hc->conf.max_host;
+}
+
+
+static int conn_alloc(struct conn **connp, struct httpc *hc,
+		      const struct sa *peer)
+{
+	struct conn *conn;
+	int one = 1;
+	int err = 0;
+
+	conn = mem_zalloc(sizeof(*conn), conn_destructor);
+	if (!conn)
+		return ENOMEM;
+
+	conn->hc   = hc;
+	conn->peer = *peer;
+
+	conn->fd = socket(sa_af(peer), SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (conn->fd < 0) {
+		err = errno;
+		goto out;
+	}
+
+	(void)setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY,
+			 &one, sizeof(one));
+
+	/* a shaped session advertises a window of about one burst */
+	if (hc->sh) {
+		int rcvbuf = (int)hc->bucket.burst;
+
+		(void)setsockopt(conn->fd, SOL_SOCKET, SO_RCVBUF,
+				 &rcvbuf, sizeof(rcvbuf));
+	}
+
+	conn->mb = mbuf_alloc(1024);
+	if (!conn->mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	conn->ts_conn = time_usec();
+
+	if (0 != connect(conn->fd, &peer->u.sa, peer->len) &&
+	    errno != EINPROGRESS) {
+		err = errno;
+		goto out;
+	}
+
+	err = fd_listen(conn->fd, FD_WRITE | FD_EXCEPT,
+			conn_fd_handler, conn);
+	if (err)
+		goto out;
+
+	list_append(&hc->connl, &conn->le, conn);
+
+ out:
+	if (err)
+		mem_deref(conn);
+	else
+		*connp = conn;
+
+	return err;
+}
+
+
+static int req_connect(struct httpc_req *req)
+{
+	struct metrics *m = req->hc->metrics;
+	struct conn *conn;
+	int err;
+
+	/* all connections to the server are busy, wait for one */
+	if (!conn_available(req->hc, &req->addr)) {
+
+		if (!req->le_wait.list) {
+			list_append(&req->hc->waitl, &req->le_wait, req);
+			STAT_ADD(m->n_conn_wait, 1);
+		}
+		return 0;
+	}
+
+	conn = conn_idle(req->hc, &req->addr);
+	if (!conn) {
+		err = conn_alloc(&conn, req->hc, &req->addr);
+		if (err)
+			return err;
+	}
+
+	conn->req = req;
+	req->conn = conn;
+	req->t.reused = conn->nreq > 0;
+	++conn->nreq;
+
+	if (req->t.reused)
+		STAT_ADD(m->n_conn_reuse, 1);
+	else
+		STAT_ADD(m->n_conn_new, 1);
+
+	mbuf_rewind(conn->mb);
+	req->mbreq->pos = 0;
+
+	if (!conn->estab)
+		return 0;
+
+	return conn_send(conn);
+}
+
+
+/*
+ * Send the first waiting request that has a connection available.
+ * One request per run, as its handler may cancel other requests.
+ */
+static void tmr_wait_handler(void *arg)
+{
+	struct httpc *hc = mem_ref(arg);
+	struct le *le;
+	int err;
+
+	for (le = list_head(&hc->waitl); le; le = le->next) {
+
+		struct httpc_req *req = le->data;
+
+		if (!conn_available(hc, &req->addr))
+			continue;
+
+		list_unlink(&req->le_wait);
+
+		err = req_connect(req);
+		if (err)
+			req_complete(req, err);
+
+		break;
+	}
+
+	wait_schedule(hc);
+	mem_deref(hc);
+}
+
+
+/* a connection became idle or was closed */
+static void wait_schedule(struct httpc *hc)
+{
+	if (!hc->waitl.head)
+		return;
+
+	tmr_start(&hc->tmr_wait, 0, tmr_wait_handler, hc);
+}
+
+
+static void dns_handler(int err, const struct sa *addr, void *arg)
+{
+	struct httpc_req *req = arg;
+
+	req->dq = mem_deref(req->dq);
+	req->t.dns = time_usec() - req->t.ts_start;
+
+	if (err)
+		goto out;
+
+	req->addr = *addr;
+	sa_set_port(&req->addr, req->port);
+
+	err = req_connect(req);
+
+ out:
+	if (err)
+		req_complete(req, err);
+}
+
+
+/*
+ * Decode the pooling mode: "keepalive", "close" or "host[:N]", the
+ * last one with at most N connections per server (default 6)
+ */
+int httpc_conf_decode(struct httpc_conf *conf, const char *str)
+{
+	if (!conf || !str)
+		return EINVAL;
+
+	memset(conf, 0, sizeof(*conf));
+
+	if (0 == str_casecmp(str, "keepalive")) {
+		conf->pool = HTTPC_POOL_KEEPALIVE;
+	}
+	else if (0 == str_casecmp(str, "close")) {
+		conf->pool = HTTPC_POOL_CLOSE;
+	}
+	else if (0 == strncasecmp(str, "host", 4)) {
+		conf->pool = HTTPC_POOL_HOST;
+		conf->max_host = MAX_HOST;
+
+		if (str[4] == ':')
+			conf->max_host = atoi(&str[5]);
+		else if (str[4])
+			return EINVAL;
+
+		if (!conf->max_host)
+			return EINVAL;
+	}
+	else {
+		return EINVAL;
+	}
+
+	return 0;
+}
+
+
+const char *httpc_pool_name(enum httpc_pool pool)
+{
+	switch (pool) {
+
+	case HTTPC_POOL_KEEPALIVE: return "keepalive";
+	case HTTPC_POOL_CLOSE:     return "close";
+	case HTTPC_POOL_HOST:      return "host";
+	default:                   return "?";
+	}
+}
+
+
+/* Print the pooling mode in the format of httpc_conf_decode() */
+int httpc_conf_print(struct re_printf *pf, const struct httpc_conf *conf)
+{
+	if (!conf)
+		return 0;
+
+	if (conf->pool == HTTPC_POOL_HOST)
+		return re_hprintf(pf, "host:%u", conf->max_host);
+
+	return re_hprintf(pf, "%s", httpc_pool_name(conf->pool));
+}
+
+
+int httpc_alloc(struct httpc **hcp, struct dnscache *dc, struct objpool *reqp,
+		struct metrics *metrics, const struct httpc_conf *conf)
+{
+	struct httpc *hc;
+
+	if (!hcp || !dc || !metrics)
+		return EINVAL;
+
+	hc = mem_zalloc(sizeof(*hc), httpc_destructor);
+	if (!hc)
+		return ENOMEM;
+
+	hc->dc = mem_ref(dc);
+	hc->reqp = mem_ref(reqp);
+	hc->metrics = metrics;
+
+	if (conf)
+		hc->conf = *conf;
+
+	tmr_init(&hc->tmr_wait);
+
+	*hcp = hc;
+
+	return 0;
+}
+
+
+/* A pool for the requests of the sessions of a worker */
+int httpc_reqpool_alloc(struct objpool **opp, uint32_t max)
+{
+	return objpool_alloc(opp, sizeof(struct httpc_req), max);
+}
+
+
+/* log each request of the session, see struct reqlog */
+void httpc_set_log(struct httpc *hc, const struct reqlog *log)
+{
+	if (!hc || !log)
+		return;
+
+	hc->log = *log;
+}
+
+
+/* Shape the receive rate of the session to `kbps`, 0 for unlimited */
+void httpc_set_rate(struct httpc *hc, struct shaper *sh, uint32_t kbps)
+{
+	if (!hc)
+		return;
+
+	hc->sh = mem_deref(hc->sh);
+
+	if (!sh || !kbps)
+		return;
+
+	hc->sh = mem_ref(sh);
+	bucket_init(&hc->bucket, kbps, time_usec());
+}
+
+
+/* the last path segment, without query */
+static void name_set(char *name, size_t sz, const struct pl *path)
+{
+	const char *p = path->p, *end = path->p + path->l;
+	const char *q;
+
+	q = memchr(p, '?', path->l);
+	if (q)
+		end = q;
+
+	for (q = p; q < end; q++) {
+		if (*q == '/')
+			p = q + 1;
+	}
+
+	str_ncpy(name, p, min((size_t)(end - p) + 1, sz));
+}
+
+
+/*
+ * Send an HTTP request. The response handler is called once, when the
+ * response is complete, together with the phase timing of the request.
+ * Without a data handler the body is buffered in msg->mb, with a data
+ * handler it is streamed to the data handler as it arrives. The options
+ * `opt` tag the request for the logs, select a byte range and set how
+ * long the request may go without progress; without them the request
+ * is untagged, for the whole resource and has the default timeout.
+ *
+ * The request is cancelled if the caller dereferences *reqp.
+ */
+int httpc_request(struct httpc_req **reqp, struct httpc *hc, const char *met,
+		  const char *uri, const struct httpc_opt *opt,
+		  httpc_resp_h *resph, http_data_h *datah, void *arg)
+{
+	static const struct httpc_opt opt_none = {REQ_OTHER, TRACE_NO_REND,
+						  0, 0, 0};
+	struct pl scheme, host, port, path;
+	struct httpc_req *req;
+	int err;
+
+	if (!hc || !met || !uri)
+		return EINVAL;
+
+	if (!opt)
+		opt = &opt_none;
+
+	if (re_regex(uri, strlen(uri), "[a-z]+://[^:/]+[:]*[0-9]*[^]*",
+		     &scheme, &host, NULL, &port, &path))
+		return EINVAL;
+
+	if (pl_strcasecmp(&scheme, "http")) {
+		DEBUG_WARNING("unsupported scheme: %r\n", &scheme);
+		return ENOTSUP;
+	}
+
+	req = objpool_get(hc->reqp, sizeof(*req), req_destructor);
+	if (!req)
+		return ENOMEM;
+
+	req->pool = mem_ref(hc->reqp);
+
+	list_append(&hc->reql, &req->le, req);
+
+	req->t.ts_start = time_usec();
+	req->hc    = hc;
+	req->resph = resph;
+	req->datah = datah;
+	req->arg   = arg;
+	req->head  = 0 == str_casecmp(met, "HEAD");
+	req->port  = pl_isset(&port) ? pl_u32(&port) : 80;
+
+	err = pl_strcpy(&host, req->host, sizeof(req->host));
+	if (err)
+		goto out;
+
+	req->kind = opt->kind;
+	req->rend = opt->rend;
+	req->timeout = opt->timeout ? opt->timeout : PROGRESS_TMR;
+
+	if (hc->log.rw && pl_isset(&path))
+		name_set(req->name, sizeof(req->name), &path);
+
+	if (hc->log.tr && pl_isset(&path))
+		req->uri_hash = hash_joaat_pl(&path);
+
+	req->mbreq = mbuf_alloc(512);
+	req->body  = mbuf_alloc(datah ? 0 : 8192);
+	if (!req->mbreq || !req->body) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err = mbuf_printf(req->mbreq,
+			  "%s %r HTTP/1.1\r\n"
+			  "Host: %r%s%r\r\n"
+			  "User-Agent: hlsperf\r\n"
+			  "%s",
+			  met, pl_isset(&path) ? &path : &pl_slash,
+			  &host, pl_isset(&port) ? ":" : "", &port,
+			  hc->conf.pool == HTTPC_POOL_CLOSE ?
+			  "Connection: close\r\n" : "");
+
+	if (opt->range_len) {
+		err |= mbuf_printf(req->mbreq, "Range: bytes=%llu-%llu\r\n",
+				   opt->range_off,
+				   opt->range_off + opt->range_len - 1);
+	}
+	else if (opt->range_off) {
+		err |= mbuf_printf(req->mbreq, "Range: bytes=%llu-\r\n",
+				   opt->range_off);
+	}
+
+	err |= mbuf_write_str(req->mbreq, "\r\n");
+	if (err)
+		goto out;
+
+	tmr_start(&req->tmr, req->timeout, tmr_handler, req);
+
+	if (0 == dnscache_get(hc->dc, req->host, &req->addr)) {
+
+		sa_set_port(&req->addr, req->port);
+
+		err = req_connect(req);
+	}
+	else {
+		err = dnscache_query(&req->dq, hc->dc, req->host,
+				     dns_handler, req);
+	}
+
+ out:
+	if (err) {
+		mem_deref(req);
+	}
+	else if (reqp) {
+		*reqp = req;
+		req->reqp = reqp;
+	}
+
+	return err;
+}
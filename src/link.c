@@ -0,0 +1,327 @@
+/**
+ * @file link.c HLS Performance client -- message link
+ *
+ * Copyright (C) 2019 Creytiv.com
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <re.h>
+#include "hlsperf.h"
+
+
+/*
+ * Messages between the controller and its agents, over a stream
+ * socket. Each message is a header with the type and the payload
+ * length, both in network byte order, followed by the payload.
+ * Messages are queued and sent from the event loop, so link_send()
+ * never blocks.
+ */
+
+
+enum {
+	HDR_SIZE  = 8,
+	MAX_MSG   = 4 << 20,
+	RECV_SIZE = 65536,
+};
+
+struct link {
+	int fd;
+	struct mbuf *rx;      /* received, not yet complete messages */
+	struct mbuf *tx;      /* queued for sending, from pos to end */
+	link_msg_h *msgh;
+	link_close_h *closeh;
+	void *arg;
+	bool estab;
+};
+
+
+static void link_fd_handler(int flags, void *arg);
+
+
+static void destructor(void *data)
+{
+	struct link *lk = data;
+
+	if (lk->fd >= 0) {
+		fd_close(lk->fd);
+		(void)close(lk->fd);
+	}
+
+	mem_deref(lk->rx);
+	mem_deref(lk->tx);
+}
+
+
+static void link_close(struct link *lk, int err)
+{
+	link_close_h *closeh = lk->closeh;
+
+	fd_close(lk->fd);
+	(void)close(lk->fd);
+	lk->fd = -1;
+
+	lk->closeh = NULL;
+
+	if (closeh)
+		closeh(err, lk->arg);
+}
+
+
+static int link_flush(struct link *lk)
+{
+	struct mbuf *mb = lk->tx;
+	ssize_t n;
+
+	if (!lk->estab)
+		return 0;
+
+	while (mbuf_get_left(mb)) {
+
+		n = send(lk->fd, mbuf_buf(mb), mbuf_get_left(mb),
+			 MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return fd_listen(lk->fd, FD_READ | FD_WRITE,
+						 link_fd_handler, lk);
+			return errno;
+		}
+
+		mbuf_advance(mb, n);
+	}
+
+	mbuf_rewind(mb);
+
+	return fd_listen(lk->fd, FD_READ, link_fd_handler, lk);
+}
+
+
+/* hand all complete messages to the handler */
+static void link_parse(struct link *lk)
+{
+	struct mbuf *mb = lk->rx;
+
+	while (lk->fd >= 0 && mbuf_get_left(mb) >= HDR_SIZE) {
+
+		struct mbuf msg;
+		uint32_t type, len;
+
+		type = ntohl(mbuf_read_u32(mb));
+		len  = ntohl(mbuf_read_u32(mb));
+
+		if (len > MAX_MSG) {
+			link_close(lk, EBADMSG);
+			return;
+		}
+
+		if (mbuf_get_left(mb) < len) {
+			mbuf_advance(mb, -HDR_SIZE);
+			break;
+		}
+
+		mbuf_init(&msg);
+		msg.buf  = mbuf_buf(mb);
+		msg.size = len;
+		msg.end  = len;
+
+		mbuf_advance(mb, len);
+
+		lk->msgh(type, &msg, lk->arg);
+	}
+
+	if (!mbuf_get_left(mb)) {
+		mbuf_rewind(mb);
+	}
+	else if (mb->pos) {
+		const size_t left = mbuf_get_left(mb);
+
+		memmove(mb->buf, mbuf_buf(mb), left);
+		mb->pos = 0;
+		mb->end = left;
+	}
+}
+
+
+static void link_fd_handler(int flags, void *arg)
+{
+	struct link *lk = arg;
+	uint8_t buf[RECV_SIZE];
+	ssize_t n;
+	int err;
+
+	if (!lk->estab) {
+		socklen_t len = sizeof(err);
+
+		if (getsockopt(lk->fd, SOL_SOCKET, SO_ERROR, &err, &len))
+			err = errno;
+		if (err) {
+			link_close(lk, err);
+			return;
+		}
+
+		lk->estab = true;
+	}
+
+	if (flags & FD_WRITE) {
+		err = link_flush(lk);
+		if (err) {
+			link_close(lk, err);
+			return;
+		}
+	}
+
+	if (!(flags & FD_READ))
+		return;
+
+	n = recv(lk->fd, buf, sizeof(buf), 0);
+	if (n < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+			return;
+		link_close(lk, errno);
+		return;
+	}
+	else if (n == 0) {
+		link_close(lk, 0);
+		return;
+	}
+
+	mbuf_set_pos(lk->rx, lk->rx->end);
+	err = mbuf_write_mem(lk->rx, buf, n);
+	mbuf_set_pos(lk->rx, 0);
+	if (err) {
+		link_close(lk, err);
+		return;
+	}
+
+	mem_ref(lk);
+	link_parse(lk);
+	mem_deref(lk);
+}
+
+
+/*
+ * Create a link on the connected stream socket `fd`, which it takes
+ * over. The socket must be non-blocking.
+ */
+int link_alloc(struct link **lkp, int fd, link_msg_h *msgh,
+	       link_close_h *closeh, void *arg)
+{
+	struct link *lk;
+	int err;
+
+	if (!lkp || fd < 0 || !msgh)
+		return EINVAL;
+
+	lk = mem_zalloc(sizeof(*lk), destructor);
+	if (!lk) {
+		(void)close(fd);
+		return ENOMEM;
+	}
+
+	lk->fd     = fd;
+	lk->estab  = true;
+	lk->msgh   = msgh;
+	lk->closeh = closeh;
+	lk->arg    = arg;
+
+	lk->rx = mbuf_alloc(RECV_SIZE);
+	lk->tx = mbuf_alloc(RECV_SIZE);
+	if (!lk->rx || !lk->tx) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err = fd_listen(lk->fd, FD_READ, link_fd_handler, lk);
+
+ out:
+	if (err)
+		mem_deref(lk);
+	else
+		*lkp = lk;
+
+	return err;
+}
+
+
+/* Connect to `peer`, messages are queued until the link is up */
+int link_connect(struct link **lkp, const struct sa *peer, link_msg_h *msgh,
+		 link_close_h *closeh, void *arg)
+{
+	struct link *lk;
+	int fd, one = 1;
+	int err;
+
+	if (!lkp || !peer)
+		return EINVAL;
+
+	fd = socket(sa_af(peer), SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (fd < 0)
+		return errno;
+
+	(void)setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	err = link_alloc(&lk, fd, msgh, closeh, arg);
+	if (err)
+		return err;
+
+	lk->estab = false;
+
+	if (0 != connect(fd, &peer->u.sa, peer->len) &&
+	    errno != EINPROGRESS) {
+		err = errno;
+		goto out;
+	}
+
+	err = fd_listen(fd, FD_READ | FD_WRITE | FD_EXCEPT,
+			link_fd_handler, lk);
+
+ out:
+	if (err)
+		mem_deref(lk);
+	else
+		*lkp = lk;
+
+	return err;
+}
+
+
+/* Queue the message `type` with a payload of `n` bytes */
+int link_send(struct link *lk, uint32_t type, const uint8_t *p, size_t n)
+{
+	struct mbuf *mb;
+	size_t pos, end;
+	int err;
+
+	if (!lk || (n && !p) || n > MAX_MSG)
+		return EINVAL;
+
+	if (lk->fd < 0)
+		return ENOTCONN;
+
+	mb  = lk->tx;
+	pos = mb->pos;
+	end = mb->end;
+
+	/* append behind the unsent data */
+	mbuf_set_pos(mb, end);
+
+	err  = mbuf_write_u32(mb, htonl(type));
+	err |= mbuf_write_u32(mb, htonl((uint32_t)n));
+	if (n)
+		err |= mbuf_write_mem(mb, p, n);
+
+	if (err)
+		mbuf_set_end(mb, end);
+
+	mbuf_set_pos(mb, pos);
+
+	if (err)
+		return err;
+
+	return link_flush(lk);
+}
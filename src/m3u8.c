@@ -0,0 +1,408 @@
+/**
+ * @file m3u8.c HLS Performance client -- M3U8 tokenizer
+ *
+ * Copyright (C) 2019 Creytiv.com
+ */
+
+#include <string.h>
+#include <re.h>
+#include "hlsperf.h"
+
+
+/*
+ * Single pass over the playlist, without allocation and without
+ * regular expressions. Lines are found with memchr() (vectorized in
+ * libc), tags are dispatched on their length and name.
+ */
+
+
+struct tag {
+	const char *name;
+	size_t len;
+	enum m3u8_tag tag;
+};
+
+#define TAG(name, tag) {name, sizeof(name)-1, tag}
+
+/* names without the leading "#EXT" */
+static const struct tag tagv[] = {
+	TAG("INF",                     M3U8_EXTINF),
+	TAG("-X-MEDIA-SEQUENCE",       M3U8_MEDIA_SEQUENCE),
+	TAG("-X-TARGETDURATION",       M3U8_TARGETDURATION),
+	TAG("-X-ENDLIST",              M3U8_ENDLIST),
+	TAG("-X-MEDIA",                M3U8_MEDIA),
+	TAG("-X-STREAM-INF",           M3U8_STREAM_INF),
+	TAG("-X-PART",                 M3U8_PART),
+	TAG("-X-PART-INF",             M3U8_PART_INF),
+	TAG("-X-PRELOAD-HINT",         M3U8_PRELOAD_HINT),
+	TAG("-X-SERVER-CONTROL",       M3U8_SERVER_CONTROL),
+	TAG("-X-MAP",                  M3U8_MAP),
+	TAG("-X-BYTERANGE",            M3U8_BYTERANGE),
+};
+
+
+static enum m3u8_tag tag_lookup(const char *p, size_t l)
+{
+	size_t i;
+
+	for (i=0; i<ARRAY_SIZE(tagv); i++) {
+
+		if (tagv[i].len == l && 0 == memcmp(tagv[i].name, p, l))
+			return tagv[i].tag;
+	}
+
+	return M3U8_UNKNOWN;
+}
+
+
+/* split one line into tag and value */
+static void line_decode(struct m3u8_line *ml, const char *p, size_t l)
+{
+	const char *colon;
+
+	ml->line.p = p;
+	ml->line.l = l;
+	ml->val.p  = NULL;
+	ml->val.l  = 0;
+
+	if (p[0] != '#') {
+		ml->tag = M3U8_URI;
+		ml->val = ml->line;
+		return;
+	}
+
+	if (l < 4 || memcmp(p, "#EXT", 4)) {
+		ml->tag = M3U8_COMMENT;
+		return;
+	}
+
+	colon = memchr(p, ':', l);
+	if (colon) {
+		ml->val.p = colon + 1;
+		ml->val.l = p + l - ml->val.p;
+	}
+	else {
+		colon = p + l;
+	}
+
+	ml->tag = tag_lookup(p + 4, colon - p - 4);
+}
+
+
+/*
+ * Call `lineh` for each non-empty line of the playlist.
+ * Parsing stops if the handler returns true.
+ */
+void m3u8_parse(const struct pl *pl, m3u8_line_h *lineh, void *arg)
+{
+	const char *p, *end;
+
+	if (!pl || !lineh)
+		return;
+
+	p   = pl->p;
+	end = pl->p + pl->l;
+
+	while (p < end) {
+
+		struct m3u8_line ml;
+		const char *eol;
+		size_t l;
+
+		eol = memchr(p, '\n', end - p);
+		if (!eol)
+			eol = end;
+
+		l = eol - p;
+		if (l && p[l-1] == '\r')
+			--l;
+
+		if (l) {
+			line_decode(&ml, p, l);
+
+			if (lineh(&ml, arg))
+				return;
+		}
+
+		p = eol + 1;
+	}
+}
+
+
+/*
+ * Find attribute `name` in an attribute list, e.g.
+ * BANDWIDTH=1280000,CODECS="avc1.4d401f,mp4a.40.2"
+ *
+ * Quotes are removed from quoted-string values.
+ */
+int m3u8_attr(const struct pl *val, const char *name, struct pl *attr)
+{
+	const size_t nlen = str_len(name);
+	const char *p, *end;
+
+	if (!val || !name || !attr)
+		return EINVAL;
+
+	p   = val->p;
+	end = val->p + val->l;
+
+	while (p < end) {
+
+		const char *eq, *v, *vend;
+
+		eq = memchr(p, '=', end - p);
+		if (!eq)
+			break;
+
+		v = eq + 1;
+
+		if (v < end && *v == '"') {
+			++v;
+			vend = memchr(v, '"', end - v);
+			if (!vend)
+				return EBADMSG;
+		}
+		else {
+			vend = memchr(v, ',', end - v);
+			if (!vend)
+				vend = end;
+		}
+
+		if ((size_t)(eq - p) == nlen && 0 == memcmp(p, name, nlen)) {
+			attr->p = v;
+			attr->l = vend - v;
+			return 0;
+		}
+
+		/* skip closing quote and separator */
+		p = vend;
+		if (p < end && *p == '"')
+			++p;
+		if (p < end && *p == ',')
+			++p;
+	}
+
+	return ENOENT;
+}
+
+
+/* file extension of an URI, ignoring the query string */
+int m3u8_uri_ext(const struct pl *uri, struct pl *ext)
+{
+	const char *p, *end;
+
+	if (!uri || !ext)
+		return EINVAL;
+
+	end = memchr(uri->p, '?', uri->l);
+	if (!end)
+		end = uri->p + uri->l;
+
+	for (p = end; p > uri->p; ) {
+
+		--p;
+
+		if (*p == '/')
+			break;
+
+		if (*p == '.') {
+			ext->p = p + 1;
+			ext->l = end - ext->p;
+			return 0;
+		}
+	}
+
+	return ENOENT;
+}
+
+
+/* true if `uri` starts with a scheme, e.g. "http:" */
+static bool uri_has_scheme(const struct pl *uri)
+{
+	size_t i;
+
+	for (i=0; i<uri->l; i++) {
+
+		const char c = uri->p[i];
+
+		if (c == ':')
+			return i > 0;
+
+		if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))
+			continue;
+
+		if (i == 0)
+			return false;
+
+		if ((c >= '0' && c <= '9') || c == '+' || c == '-' ||
+		    c == '.')
+			continue;
+
+		return false;
+	}
+
+	return false;
+}
+
+
+/*
+ * Resolve `ref` against `base`, the absolute URI of the playlist that
+ * contains it (RFC 8216, section 4.1): an absolute URI is taken as is,
+ * "//host/..." keeps the scheme, "/..." the authority and any other
+ * reference replaces the last path segment of the base. Dot segments
+ * are left to the server.
+ */
+int m3u8_uri_resolve(char *buf, size_t size, const struct pl *base,
+		     const struct pl *ref)
+{
+	const char *auth, *path, *dir, *end;
+	int n;
+
+	if (!buf || !size || !base || !ref)
+		return EINVAL;
+
+	if (uri_has_scheme(ref)) {
+		n = re_snprintf(buf, size, "%r", ref);
+		goto out;
+	}
+
+	/* "scheme://authority/path?query" */
+	end = memchr(base->p, '?', base->l);
+	if (!end)
+		end = base->p + base->l;
+
+	auth = memchr(base->p, ':', end - base->p);
+	if (!auth || end - auth < 3 || auth[1] != '/' || auth[2] != '/')
+		return EINVAL;
+
+	auth += 3;
+
+	path = memchr(auth, '/', end - auth);
+	if (!path)
+		path = end;
+
+	if (ref->l >= 2 && ref->p[0] == '/' && ref->p[1] == '/') {
+		n = re_snprintf(buf, size, "%b%r",
+				base->p, (size_t)(auth - 2 - base->p), ref);
+	}
+	else if (ref->l && ref->p[0] == '/') {
+		n = re_snprintf(buf, size, "%b%r",
+				base->p, (size_t)(path - base->p), ref);
+	}
+	else {
+		for (dir = end; dir > path && dir[-1] != '/'; )
+			--dir;
+
+		n = re_snprintf(buf, size, "%b%s%r",
+				base->p, (size_t)(dir - base->p),
+				dir == path ? "/" : "", ref);
+	}
+
+ out:
+	return n < 0 || (size_t)n >= size ? ENAMETOOLONG : 0;
+}
+
+
+/* value of query parameter `name` in an URI */
+int m3u8_uri_param(const struct pl *uri, const char *name, struct pl *val)
+{
+	const size_t nlen = str_len(name);
+	const char *p, *end;
+
+	if (!uri || !name || !val)
+		return EINVAL;
+
+	end = uri->p + uri->l;
+
+	p = memchr(uri->p, '?', uri->l);
+	if (!p)
+		return ENOENT;
+
+	while (p < end) {
+
+		const char *amp;
+
+		++p;  /* skip '?' or '&' */
+
+		amp = memchr(p, '&', end - p);
+		if (!amp)
+			amp = end;
+
+		if ((size_t)(amp - p) > nlen && p[nlen] == '=' &&
+		    0 == memcmp(p, name, nlen)) {
+			val->p = p + nlen + 1;
+			val->l = amp - val->p;
+			return 0;
+		}
+
+		p = amp;
+	}
+
+	return ENOENT;
+}
+
+
+/* decimal number at the start of `val`, e.g. EXTINF "9.976,title" */
+double m3u8_decimal(const struct pl *val)
+{
+	double v = 0.0, scale = 0.0;
+	size_t i;
+
+	if (!val)
+		return 0.0;
+
+	for (i=0; i<val->l; i++) {
+
+		const char c = val->p[i];
+
+		if (c >= '0' && c <= '9') {
+			if (scale) {
+				v += (c - '0') * scale;
+				scale *= 0.1;
+			}
+			else {
+				v = v*10 + (c - '0');
+			}
+		}
+		else if (c == '.' && !scale) {
+			scale = 0.1;
+		}
+		else {
+			break;
+		}
+	}
+
+	return v;
+}
+
+
+/*
+ * Decode a byte range "<n>[@<o>]". Without an offset, the range starts
+ * at `next`, the end of the previous range of the same resource.
+ */
+int m3u8_byterange(const struct pl *val, uint64_t next,
+		   struct byterange *br)
+{
+	struct pl len, off = PL_INIT;
+	const char *at;
+
+	if (!val || !br)
+		return EINVAL;
+
+	len = *val;
+
+	at = pl_strchr(val, '@');
+	if (at) {
+		len.l = at - val->p;
+		off.p = at + 1;
+		off.l = val->p + val->l - off.p;
+	}
+
+	br->len = pl_u64(&len);
+	br->off = at ? pl_u64(&off) : next;
+
+	if (!br->len || (at && !pl_isset(&off)))
+		return EBADMSG;
+
+	return 0;
+}
@@ -6,7 +6,10 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <math.h>
 #include <getopt.h>
+#include <unistd.h>
+#include <ctype.h>
 #include <pthread.h>
 #include <re.h>
 #include "hlsperf.h"
@@ -17,44 +20,71 @@
 #include <re_dbg.h>
 
 
+enum {
+	MEM_INTERVAL = 1000,      /* memory sampling [ms] */
+};
+
 static const char *uri;
 static uint32_t num_sess = 1;
-static struct client **cliv = NULL;
+static uint32_t num_workers = 0;
+static uint32_t interval = 0;
+static uint32_t timeout = 0;
+static const char *outfile;
+static struct config cfg;
+static struct worker **wv = NULL;
+static struct controller *ctrl;
+static struct report *report;
+static struct tmr tmr;
+static struct tmr tmr_mem;
+static struct memusage memu;
+static bool started;
+static bool done;
 
 
-static void client_error_handler(struct client *cli, int err, void *arg)
+static void tmr_handler(void *arg)
 {
-	if (err) {
-		DEBUG_WARNING("client error (%m)\n", err);
+	if (ctrl) {
+		re_printf("timer elapsed -- stopping the agents\n");
+		controller_stop(ctrl);
+		return;
 	}
 
+	re_printf("timer elapsed -- terminate\n");
 	re_cancel();
 }
 
 
-static void tmr_handler(void *arg)
+/* memory of the local sessions, see memusage */
+static void mem_sample(void)
 {
-	re_printf("timer elapsed -- terminate\n");
-	re_cancel();
+	int64_t n_active = 0;
+	size_t k;
+
+	for (k=0; k<num_workers; k++) {
+
+		const struct metrics *wm = worker_metrics(wv[k]);
+
+		if (wm)
+			n_active += STAT_GET(wm->n_active);
+	}
+
+	memusage_sample(&memu, n_active);
 }
 
 
-static void signal_handler(int signum)
+static void tmr_mem_handler(void *arg)
 {
-	size_t i;
+	tmr_start(&tmr_mem, MEM_INTERVAL, tmr_mem_handler, NULL);
+
+	mem_sample();
+}
 
-	(void)signum;
 
+static void signal_handler(int signum)
+{
 	re_fprintf(stderr, "terminated on signal %d (thread %p)\n",
 		   signum, pthread_self());
 
-	for (i=0; i<num_sess; i++) {
-
-		struct client *cli = cliv[i];
-
-		client_close(cli, 0);
-	}
-
 	re_cancel();
 }
 
@@ -62,194 +92,479 @@ static void signal_handler(int signum)
 static void usage(void)
 {
 	re_fprintf(stderr,
-		   "usage: hlsperf [-n num] [-t timeout] <http-uri>\n"
+		   "usage: hlsperf [-n num] [-t timeout] [-w workers]"
+		   " [-i seconds] [-l] [-V] [-a abr]\n"
+		   "               [-r profile] [-L dist] [-b links]"
+		   " [-c pool] [-o file] [-R file]\n"
+		   "               [-T prefix] [-C agents] <http-uri>\n"
+		   "       hlsperf -A <addr:port>\n"
 		   "\t-n <num>      Number of parallel sessions\n"
-		   "\t-t <timeout>  Timeout in seconds\n");
+		   "\t-t <timeout>  Timeout in seconds\n"
+		   "\t-w <workers>  Number of worker threads"
+		   " (default: one per core)\n"
+		   "\t-i <seconds>  Report interval (default: off)\n"
+		   "\t-l            Low-Latency HLS (parts, preload hints,"
+		   " blocking reload)\n"
+		   "\t-V            Validate the fMP4 boxes of the media\n"
+		   "\t-a <abr>      ABR algorithm: throughput, buffer, hybrid"
+		   " (default: first variant)\n"
+		   "\t-r <profile>  Arrival rate profile RATE[-RATE]/SECS,..."
+		   " or @file\n"
+		   "\t-L <dist>     Session lifetime: fixed:S, uniform:A-B,"
+		   " exp:MEAN, lognormal:MEDIAN,SIGMA\n"
+		   "\t-b <links>    Link speed mix, e.g. %s, speeds in\n"
+		   "\t              kbit/s or 3g, 4g, 5g, dsl, cable, fibre\n"
+		   "\t-c <pool>     Connections: keepalive, close, host[:N]"
+		   " (default: keepalive)\n"
+		   "\t-o <file>     Write the summary as JSON, or CSV"
+		   " if the name ends in .csv\n"
+		   "\t-R <file>     Write a CSV record of every request\n"
+		   "\t-T <prefix>   Binary trace of the requests, one file"
+		   " per worker (<prefix>.N)\n"
+		   "\t-C <agents>   Run on agents at addr:port,..."
+		   " or a number of local agents\n"
+		   "\t-A <addr>     Run as an agent, wait for a controller\n",
+		   "30%3g,50%4g,20%fibre");
 }
 
 
-struct stats {
-	double min;
-	double max;
-	double acc;
-	unsigned count;
+/*
+ * Periodic report, sampled from the worker metrics by the main thread,
+ * or from the latest metrics of the agents
+ */
+struct report {
+	struct tmr tmr;
+	struct metrics cur;       /* sum of all workers */
+	struct metrics prev;
+	struct metrics snap;
+	struct metrics delta;
+	uint64_t ts;              /* [us] */
+	uint64_t ts_start;        /* [us] */
 };
 
 
-static void stats_init(struct stats *stats)
+static void report_destructor(void *data)
 {
-	memset(stats, 0, sizeof(*stats));
+	struct report *rep = data;
+
+	tmr_cancel(&rep->tmr);
 }
 
 
-static void stats_update(struct stats *stats, double val)
+static void metrics_collect(struct metrics *m, struct metrics *snap)
 {
-	if (stats->count) {
+	size_t k;
+
+	metrics_init(m);
 
-		stats->min = min(val, stats->min);
-		stats->max = max(val, stats->max);
-		stats->acc += val;
-		++stats->count;
+	if (ctrl) {
+		controller_metrics(ctrl, m);
+		return;
 	}
-	else {
-		stats->min = val;
-		stats->max = val;
-		stats->acc = val;
-		stats->count = 1;
+
+	for (k=0; k<num_workers; k++) {
+
+		const struct metrics *wm = worker_metrics(wv[k]);
+
+		if (!wm)
+			continue;
+
+		metrics_load(snap, wm);
+		metrics_merge(m, snap);
 	}
 }
 
 
-static double stats_average(const struct stats *stats)
+static void report_tmr_handler(void *arg)
 {
-	if (stats->count)
-		return stats->acc / (double)stats->count;
-	else
-		return -1;
+	struct report *rep = arg;
+	struct metrics *sum = &rep->delta;
+	uint64_t now = time_usec();
+	double secs;
+
+	tmr_start(&rep->tmr, interval * 1000, report_tmr_handler, rep);
+
+	secs = (double)(now - rep->ts) * .000001;
+	rep->ts = now;
+
+	metrics_collect(&rep->cur, &rep->snap);
+	metrics_delta(sum, &rep->cur, &rep->prev);
+	rep->prev = rep->cur;
+
+	re_printf("[%6llus] req/s %.1f  Mbps %.1f  err %llu  sessions %lld"
+		  " (+%llu -%llu)  stalls %llu  switches %llu\n"
+		  "          playlist [ms] %H\n"
+		  "          media [ms]    %H\n"
+		  "          corrected     %H\n",
+		  (now - rep->ts_start) / 1000000,
+		  sum->n_req / secs,
+		  sum->n_bytes * 8 / secs * .000001,
+		  sum->n_err, sum->n_active, sum->n_arrival, sum->n_depart,
+		  sum->n_stall, sum->n_switch,
+		  hist_print, &sum->playlist,
+		  hist_print, &sum->segment,
+		  hist_print, &sum->segment_co);
 }
 
 
-static int stats_print(struct re_printf *pf, const struct stats *stats)
+/* the first report is `delay` [ms] plus one interval from now */
+static int report_alloc(struct report **repp, uint32_t delay)
 {
-	if (!stats)
-		return 0;
+	struct report *rep;
+
+	rep = mem_zalloc(sizeof(*rep), report_destructor);
+	if (!rep)
+		return ENOMEM;
+
+	tmr_init(&rep->tmr);
+
+	rep->ts = rep->ts_start = time_usec() + delay * 1000ULL;
 
-	if (stats->count)
-		return re_hprintf(pf, "%.1f/%.1f/%.1f",
-				  stats->min,
-				  stats_average(stats),
-				  stats->max);
-	else
-		return re_hprintf(pf, "(not set)");
+	tmr_start(&rep->tmr, delay + interval * 1000,
+		  report_tmr_handler, rep);
+
+	*repp = rep;
+
+	return 0;
 }
 
 
-static void show_summary(struct client * const *clivx, size_t clic)
+/* the agents have been told when to start */
+static void start_handler(uint32_t delay, void *arg)
 {
-	struct stats stats_conn, stats_media, stats_bitrate;
-	size_t n_connected = 0;
-	size_t i, j;
+	started = true;
 
-	stats_init(&stats_conn);
-	stats_init(&stats_media);
-	stats_init(&stats_bitrate);
+	re_printf("agents start in %u ms\n", delay);
 
-	for (i=0; i<clic; i++) {
+	if (timeout != 0) {
+		re_printf("starting timeout timer, %u seconds\n", timeout);
+		tmr_start(&tmr, delay + timeout * 1000, tmr_handler, NULL);
+	}
 
-		const struct client *cli = clivx[i];
-		struct media_playlist * const *mplv;
-		int64_t conn_time;
+	if (interval != 0 && !report) {
+		int err = report_alloc(&report, delay);
+		if (err)
+			re_fprintf(stderr, "report: %m\n", err);
+	}
+}
 
-		if (!client_connected(cli))
-			continue;
 
-		++n_connected;
+static void done_handler(int err, void *arg)
+{
+	if (err)
+		re_fprintf(stderr, "controller: %m\n", err);
 
-		conn_time = client_conn_time(cli);
+	done = true;
+	re_cancel();
+}
+
+
+/* agents as "addr:port,...", or the links of the local agents */
+static int agents_add(const char *agents, const int *fdv, const pid_t *pidv,
+		      unsigned n)
+{
+	struct pl pl, addr;
+	struct sa sa;
+	unsigned i;
+	int err;
 
-		stats_update(&stats_conn, conn_time);
+	for (i=0; i<n; i++) {
 
-		mplv = client_playlists(cli);
+		err = controller_attach(ctrl, fdv[i], pidv[i]);
+		if (err)
+			return err;
+	}
 
-		for (j=0; j<MAX_PLAYLISTS; j++) {
+	if (n)
+		return 0;
 
-			struct media_playlist *mpl = mplv[j];
+	pl_set_str(&pl, agents);
 
-			if (!mpl)
-				continue;
+	while (pl.l) {
 
-			if (mpl->media_count) {
-				int64_t media_time;
-				double bitrate;
+		const char *comma = pl_strchr(&pl, ',');
 
-				media_time = mpl->media_time_acc
-					/ mpl->media_count;
+		addr.p = pl.p;
+		addr.l = comma ? (size_t)(comma - pl.p) : pl.l;
 
-				bitrate = (double)mpl->bitrate_acc
-					/ mpl->media_count;
-				bitrate *= .000001;
+		pl_advance(&pl, comma ? addr.l + 1 : addr.l);
 
-				stats_update(&stats_media, media_time);
+		if (!addr.l)
+			continue;
 
-				stats_update(&stats_bitrate, bitrate);
-			}
+		err = sa_decode(&sa, addr.p, addr.l);
+		if (err) {
+			re_fprintf(stderr, "invalid agent address: %r\n",
+				   &addr);
+			return err;
+		}
+
+		err = controller_connect(ctrl, &sa);
+		if (err) {
+			re_fprintf(stderr, "agent %r: %m\n", &addr, err);
+			return err;
 		}
 	}
 
-	re_printf("- - - hlsperf summary - - -\n");
-	re_printf("total sessions:  %zu\n", clic);
-	re_printf("connected:       %zu\n", n_connected);
-	re_printf("conn min/avg/max:   %H ms\n", stats_print, &stats_conn);
-	re_printf("media min/avg/max:  %H ms\n", stats_print, &stats_media);
-	re_printf("peak bitrate min/avg/max:  %H Mbps\n",
-		  stats_print, &stats_bitrate);
-	re_printf("- - - - - - - - - - -  - - -\n");
+	return controller_agents(ctrl) ? 0 : EINVAL;
 }
 
 
-static void *client_thread_handler(void *arg)
+/* the workers must be stopped, or the agents done */
+static void summary_collect(struct metrics *m, struct summary *sum)
 {
-	struct client **clip = arg;
-	int err;
+	size_t k;
 
-	err = re_thread_init();
-	if (err) {
-		DEBUG_WARNING("re thread init: %m\n", err);
-		return NULL;
+	metrics_init(m);
+
+	if (ctrl) {
+		controller_metrics(ctrl, m);
+		controller_summary(ctrl, sum);
+		return;
 	}
 
-	/* must be set per thread.
-	 * must be done after re_thread_init()
-	 */
-	err = fd_setsize(65536);
-	if (err) {
-		re_fprintf(stderr, "fd_setsize error: %m\n", err);
-		goto out;
+	for (k=0; k<num_workers; k++) {
+
+		const struct metrics *wm;
+
+		worker_summary(wv[k], sum);
+
+		wm = worker_metrics(wv[k]);
+		if (wm)
+			metrics_merge(m, wm);
 	}
 
-	err = client_alloc(clip, uri, client_error_handler, NULL);
-	if (err)
-		goto out;
+	sum->mem_bytes = memu.bytes;
+	sum->mem_sess  = memu.n_sess;
+}
 
-	err = client_start(*clip);
-	if (err)
-		goto out;
 
-	/* run the main loop now */
-	re_main(signal_handler);
+static void show_summary(void)
+{
+	static struct summary sum;
+	static struct metrics metrics;
+	struct metrics *m = &metrics;
+	size_t i;
+
+	summary_init(&sum);
+	summary_collect(m, &sum);
 
- out:
-	/* cleanup */
-	re_thread_close();
+	re_printf("- - - hlsperf summary - - -\n");
+	re_printf("total sessions:  %zu\n", sum.n_sess);
+	re_printf("connected:       %zu\n", sum.n_connected);
+	if (ctrl)
+		re_printf("agents:          %u\n", controller_agents(ctrl));
+	re_printf("skipped media:   %llu\n", sum.n_skipped);
+	if (sum.mem_sess)
+		re_printf("memory:          %llu bytes per session"
+			  " (%llu sessions)\n",
+			  sum.mem_bytes / sum.mem_sess, sum.mem_sess);
+	re_printf("dns lookups:     %llu (%llu cached)\n",
+		  m->dns_lookup, m->dns_hit);
+	re_printf("connections:     %llu new, %llu reused, %llu queued,"
+		  " %.3f s in handshakes\n",
+		  m->n_conn_new, m->n_conn_reuse, m->n_conn_wait,
+		  m->conn_time * .000001);
+	if (cfg.validate)
+		re_printf("validation:      %llu invalid,"
+			  " %.1f ms CPU per GB\n", m->n_invalid,
+			  m->check_bytes ?
+			  m->check_time * 1e3 / m->check_bytes : 0.0);
+	re_printf("                    p50/p90/p99/p99.9/max\n");
+	re_printf("dns [ms]:           %H\n", hist_print, &m->dns);
+	re_printf("tcp connect [ms]:   %H\n", hist_print, &m->tcp);
+	re_printf("conn [ms]:          %H\n", hist_print, &m->conn);
+	re_printf("playlist ttfb [ms]: %H\n", hist_print, &m->playlist_ttfb);
+	re_printf("playlist [ms]:      %H\n", hist_print, &m->playlist);
+	re_printf("media ttfb [ms]:    %H\n", hist_print, &m->segment_ttfb);
+	re_printf("media [ms]:         %H\n", hist_print, &m->segment);
+	re_printf("  corrected [ms]:   %H\n", hist_print, &m->segment_co);
+	re_printf("media [Mbps]:       %H\n", hist_print, &m->throughput);
+
+	if (cfg.llhls) {
+		re_printf("part [ms]:          %H\n", hist_print, &m->part);
+		re_printf("preload hint [ms]:  %H\n",
+			  hist_print, &m->part_hint);
+		re_printf("hold back [ms]:     %H\n",
+			  hist_print, &m->hold_back);
+	}
+	re_printf("startup [ms]:       %H\n", hist_print, &m->startup);
+	re_printf("stall [ms]:         %H\n", hist_print, &m->stall);
+	re_printf("rebuffer [%%]:       %H\n", hist_print, &sum.rebuffer);
+	re_printf("stalls:             %llu in %zu sessions,"
+		  " rebuffer ratio %.3f%%\n",
+		  m->n_stall, sum.n_stalled,
+		  sum.play_time + sum.stall_time ?
+		  100.0 * sum.stall_time / (sum.play_time + sum.stall_time) :
+		  0.0);
+
+	if (cfg.abr) {
+		uint64_t total = 0;
+
+		for (i=0; i<sum.vtc; i++)
+			total += sum.vtv[i].time;
+
+		re_printf("abr (%s):  %llu switches\n",
+			  cfg.abr->name, m->n_switch);
+
+		for (i=0; i<sum.vtc; i++) {
+
+			const struct vtime *vt = &sum.vtv[i];
 
-	return NULL;
+			re_printf("  %7u kbit/s %4ux%-4u  %5.1f%%\n",
+				  vt->bandwidth / 1000, vt->width, vt->height,
+				  total ? 100.0 * vt->time / total : 0.0);
+		}
+	}
+
+	if (cfg.rec) {
+		re_printf("request records: %llu dropped\n",
+			  recorder_dropped(cfg.rec));
+	}
+
+	re_printf("- - - - - - - - - - -  - - -\n");
+
+	if (outfile) {
+		int err = output_summary(outfile, &cfg, uri, m, &sum);
+		if (err)
+			re_fprintf(stderr, "%s: %m\n", outfile, err);
+	}
+
+	summary_reset(&sum);
+}
+
+
+/* "N" local agents */
+static unsigned local_agents(const char *agents)
+{
+	const char *p;
+
+	for (p = agents; *p; p++) {
+		if (!isdigit((unsigned char)*p))
+			return 0;
+	}
+
+	return atoi(agents);
 }
 
 
 int main(int argc, char *argv[])
 {
-	struct tmr tmr;
-	pthread_t *tidv = NULL;
-	uint32_t timeout = 0;
+	const char *agent_addr = NULL;
+	const char *agents = NULL;
+	int *fdv = NULL;
+	pid_t *pidv = NULL;
+	unsigned n_local = 0;
 	size_t i;
 	int err = 0;
 
 	for (;;) {
 
-		const int c = getopt(argc, argv, "hn:t:");
+		const int c = getopt(argc, argv,
+				     "A:C:L:R:T:Va:b:c:hi:ln:o:r:t:w:");
 		if (0 > c)
 			break;
 
 		switch (c) {
 
+		case 'A':
+			agent_addr = optarg;
+			break;
+
+		case 'C':
+			agents = optarg;
+			break;
+
+		case 'a':
+			cfg.abr = abr_algo_find(optarg);
+			if (!cfg.abr) {
+				re_fprintf(stderr, "unknown ABR algorithm:"
+					   " %s\n", optarg);
+				usage();
+				return EINVAL;
+			}
+			break;
+
+		case 'c':
+			err = httpc_conf_decode(&cfg.http, optarg);
+			if (err) {
+				re_fprintf(stderr, "invalid connection pool:"
+					   " %s\n", optarg);
+				usage();
+				return err;
+			}
+			break;
+
+		case 'i':
+			interval = atoi(optarg);
+			break;
+
+		case 'l':
+			cfg.llhls = true;
+			break;
+
+		case 'V':
+			cfg.validate = true;
+			break;
+
 		case 'n':
 			num_sess = atoi(optarg);
 			break;
 
+		case 'b':
+			err = linkmix_decode(&cfg.links, optarg);
+			if (err) {
+				re_fprintf(stderr, "invalid link speeds: %s\n",
+					   optarg);
+				usage();
+				return err;
+			}
+			break;
+
+		case 'L':
+			err = dist_decode(&cfg.lifetime, optarg);
+			if (err) {
+				re_fprintf(stderr, "invalid lifetime: %s\n",
+					   optarg);
+				usage();
+				return err;
+			}
+			break;
+
+		case 'o':
+			outfile = optarg;
+			break;
+
+		case 'R':
+			cfg.rec = mem_deref(cfg.rec);
+			err = recorder_alloc(&cfg.rec, optarg);
+			if (err) {
+				re_fprintf(stderr, "%s: %m\n", optarg, err);
+				return err;
+			}
+			break;
+
+		case 'T':
+			cfg.trace = optarg;
+			break;
+
+		case 'r':
+			cfg.profile = mem_deref(cfg.profile);
+			err = profile_decode(&cfg.profile, optarg);
+			if (err) {
+				usage();
+				return err;
+			}
+			break;
+
 		case 't':
 			timeout = atoi(optarg);
 			break;
 
+		case 'w':
+			num_workers = atoi(optarg);
+			break;
+
 		case '?':
 		default:
 			err = EINVAL;
@@ -260,6 +575,18 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (agent_addr) {
+		if (optind != argc) {
+			usage();
+			return EINVAL;
+		}
+
+		err = agent_run(agent_addr);
+		if (err)
+			re_fprintf(stderr, "agent %s: %m\n", agent_addr, err);
+		return err;
+	}
+
 	if (argc < 2 || (argc != (optind + 1))) {
 		usage();
 		return -2;
@@ -267,7 +594,60 @@ int main(int argc, char *argv[])
 
 	uri = argv[optind + 0];
 
-	re_printf("hlsperf -- uri=%s, sessions=%u\n", uri, num_sess);
+	if (agents && (cfg.rec || cfg.trace)) {
+		re_fprintf(stderr, "-R and -T are not supported with -C\n");
+		return EINVAL;
+	}
+
+	/* run the profile to the end, unless told otherwise */
+	if (cfg.profile && timeout == 0)
+		timeout = (uint32_t)ceil(cfg.profile->dur);
+
+	if (!agents && num_workers == 0) {
+		long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		num_workers = ncpu > 0 ? (uint32_t)ncpu : 1;
+	}
+
+	if (agents) {
+		/* 0 workers: one per core of each agent */
+		n_local = local_agents(agents);
+
+		re_printf("hlsperf -- uri=%s, sessions=%u, agents=%s%s\n",
+			  uri, num_sess, agents, n_local ? " (local)" : "");
+	}
+	else if (cfg.profile) {
+		re_printf("hlsperf -- uri=%s, profile=%zu phases/%.0fs,"
+			  " workers=%u\n", uri, cfg.profile->phasec,
+			  cfg.profile->dur, num_workers);
+	}
+	else {
+		num_workers = min(num_workers, max(num_sess, 1));
+
+		re_printf("hlsperf -- uri=%s, sessions=%u, workers=%u\n",
+			  uri, num_sess, num_workers);
+	}
+
+	cfg.workers = num_workers;
+
+	/* local agents are forked before anything else is started */
+	if (n_local) {
+		fdv  = mem_zalloc(n_local * sizeof(*fdv), NULL);
+		pidv = mem_zalloc(n_local * sizeof(*pidv), NULL);
+		if (!fdv || !pidv) {
+			err = ENOMEM;
+			goto out;
+		}
+
+		for (i=0; i<n_local; i++) {
+
+			err = agent_spawn(&fdv[i], &pidv[i], fdv, i);
+			if (err) {
+				re_fprintf(stderr, "local agent: %m\n", err);
+				n_local = (unsigned)i;
+				goto out;
+			}
+		}
+	}
 
 	re_printf("main: thread %p\n", pthread_self());
 
@@ -284,22 +664,57 @@ int main(int argc, char *argv[])
 	}
 
 	tmr_init(&tmr);
+	tmr_init(&tmr_mem);
 
 	(void)sys_coredump_set(true);
 
-	cliv = mem_reallocarray(NULL, num_sess, sizeof(*cliv), NULL);
-	tidv = mem_reallocarray(NULL, num_sess, sizeof(*tidv), NULL);
-	if (!cliv || !tidv) {
+	if (agents) {
+		err = controller_alloc(&ctrl, &cfg, uri, num_sess, num_workers,
+				       start_handler, done_handler, NULL);
+		if (err)
+			goto out;
+
+		err = agents_add(agents, fdv, pidv, n_local);
+		n_local = 0;
+		if (err)
+			goto out;
+
+		(void)re_main(signal_handler);
+
+		/* interrupted: collect the summaries first */
+		if (!done) {
+			re_printf("stopping the agents\n");
+			controller_stop(ctrl);
+			(void)re_main(signal_handler);
+		}
+
+		goto out;
+	}
+
+	wv = mem_zalloc(num_workers * sizeof(*wv), NULL);
+	if (!wv) {
 		err = ENOMEM;
 		goto out;
 	}
 
-	for (i=0; i<num_sess; i++) {
+	started = true;
 
-		err = pthread_create(&tidv[i], NULL,
-				     client_thread_handler, &cliv[i]);
-		if (err)
-			return err;
+	memusage_init(&memu);
+
+	/* spread the sessions evenly over the workers */
+	for (i=0; i<num_workers; i++) {
+
+		uint32_t n = num_sess / num_workers;
+
+		if (i < num_sess % num_workers)
+			++n;
+
+		err = worker_alloc(&wv[i], (unsigned)i, &cfg, uri, n);
+		if (err) {
+			re_fprintf(stderr, "worker %zu: could not start (%m)\n",
+				   i, err);
+			goto out;
+		}
 	}
 
 	if (timeout != 0) {
@@ -307,30 +722,52 @@ int main(int argc, char *argv[])
 		tmr_start(&tmr, timeout * 1000, tmr_handler, NULL);
 	}
 
+	tmr_start(&tmr_mem, MEM_INTERVAL, tmr_mem_handler, NULL);
+
+	if (interval != 0) {
+		err = report_alloc(&report, 0);
+		if (err)
+			goto out;
+	}
+
 	(void)re_main(signal_handler);
 
 	re_printf("Hasta la vista\n");
 
  out:
-	if (cliv && tidv) {
-		for (i=0; i<num_sess; i++) {
+	report = mem_deref(report);
+	tmr_cancel(&tmr_mem);
 
-			struct client *cli = cliv[i];
+	if (wv) {
+		mem_sample();
 
-			client_close(cli, 0);
+		for (i=0; i<num_workers; i++) {
 
 			/* wait for thread to end */
-			pthread_join(tidv[i], NULL);
+			worker_stop(wv[i]);
 		}
+	}
 
-		show_summary(cliv, num_sess);
+	if (started)
+		show_summary();
 
-		for (i=0; i<num_sess; i++) {
-			mem_deref(cliv[i]);
+	if (wv) {
+		for (i=0; i<num_workers; i++) {
+			mem_deref(wv[i]);
 		}
 	}
-	mem_deref(cliv);
-	mem_deref(tidv);
+
+	/* closes the links, the agents exit */
+	ctrl = mem_deref(ctrl);
+
+	for (i=0; i<n_local; i++)
+		(void)close(fdv[i]);
+
+	mem_deref(fdv);
+	mem_deref(pidv);
+	mem_deref(wv);
+	mem_deref(cfg.rec);
+	mem_deref(cfg.profile);
 	tmr_cancel(&tmr);
 
 	libre_close();
@@ -20,25 +20,57 @@ static void mediafile_destructor(void *data)
 
 	list_unlink(&mf->le);
 	mem_deref(mf->filename);
+	mem_deref(mf->map);
+
+	objpool_put(mf->pool, mf);
 }
 
 
-int mediafile_new(struct list *lst, const char *filename, double duration)
+static void mediamap_destructor(void *data)
+{
+	struct mediamap *map = data;
+
+	mem_deref(map->uri);
+}
+
+
+/*
+ * Append a segment. The list is ordered by media sequence number
+ * and only holds segments that have not been played yet. The name is
+ * shared through the string pool and the segment comes from the object
+ * pool of `pools`, if any.
+ */
+int mediafile_new(struct list *lst, const struct pools *pools,
+		  const struct pl *filename, uint64_t msn, double duration)
 {
+	return mediafile_part_new(lst, pools, filename, msn, 0, duration);
+}
+
+
+/* Append a partial segment (EXT-X-PART) of segment `msn` */
+int mediafile_part_new(struct list *lst, const struct pools *pools,
+		       const struct pl *filename, uint64_t msn, uint32_t part,
+		       double duration)
+{
+	struct objpool *op = pools ? pools->mf : NULL;
 	struct mediafile *mf;
 	int err;
 
-	if (!lst || !filename)
+	if (!lst || !pl_isset(filename))
 		return EINVAL;
 
-	mf = mem_zalloc(sizeof(*mf), mediafile_destructor);
+	mf = objpool_get(op, sizeof(*mf), mediafile_destructor);
 	if (!mf)
 		return ENOMEM;
 
-	err = str_dup(&mf->filename, filename);
+	mf->pool = mem_ref(op);
+
+	err = strpool_get(pools ? pools->sp : NULL, &mf->filename, filename);
 	if (err)
 		goto out;
 
+	mf->msn = msn;
+	mf->part = part;
 	mf->duration = duration;
 
 	list_append(lst, &mf->le, mf);
@@ -51,35 +83,99 @@ int mediafile_new(struct list *lst, const char *filename, double duration)
 }
 
 
-struct mediafile *mediafile_find(const struct list *lst, const char *filename)
+/* A pool for the segments and parts of the sessions of a worker */
+int mediafile_pool_alloc(struct objpool **opp, uint32_t max)
 {
-	struct le *le;
+	return objpool_alloc(opp, sizeof(struct mediafile), max);
+}
+
+
+/* the next segment to play, O(1) */
+struct mediafile *mediafile_next(const struct list *lst)
+{
+	return list_ledata(list_head(lst));
+}
 
-	le = list_head(lst);
-	while (le) {
-		struct mediafile *mf = le->data;
-		le = le->next;
 
-		if (0 == str_cmp(filename, mf->filename))
-			return mf;
+/*
+ * Remove segments with a sequence number below `msn`, i.e. segments
+ * that have left the live window. Returns the number of removed segments.
+ */
+unsigned mediafile_evict(struct list *lst, uint64_t msn)
+{
+	unsigned n = 0;
+
+	for (;;) {
+		struct mediafile *mf = list_ledata(list_head(lst));
+
+		if (!mf || mf->msn >= msn)
+			break;
+
+		mem_deref(mf);
+		++n;
 	}
 
-	return NULL;
+	return n;
 }
 
 
-struct mediafile *mediafile_next(const struct list *lst)
+/* total duration of the listed media [s] */
+double mediafile_duration(const struct list *lst)
 {
 	struct le *le;
+	double dur = 0.0;
 
-	le = list_head(lst);
-	while (le) {
-		struct mediafile *mf = le->data;
-		le = le->next;
+	for (le = list_head(lst); le; le = le->next) {
+		const struct mediafile *mf = le->data;
 
-		if (!mf->played)
-			return mf;
+		dur += mf->duration;
 	}
 
-	return NULL;
+	return dur;
+}
+
+
+/* Initialization segment `uri`, all of it if `range` is NULL */
+int mediamap_alloc(struct mediamap **mapp, struct strpool *sp,
+		   const struct pl *uri, const struct byterange *range)
+{
+	struct mediamap *map;
+	int err;
+
+	if (!mapp || !pl_isset(uri))
+		return EINVAL;
+
+	map = mem_zalloc(sizeof(*map), mediamap_destructor);
+	if (!map)
+		return ENOMEM;
+
+	err = strpool_get(sp, &map->uri, uri);
+	if (err)
+		goto out;
+
+	if (range)
+		map->range = *range;
+
+ out:
+	if (err)
+		mem_deref(map);
+	else
+		*mapp = map;
+
+	return err;
+}
+
+
+/* true if `a` and `b` are the same initialization segment */
+bool mediamap_equal(const struct mediamap *a, const struct mediamap *b)
+{
+	if (a == b)
+		return true;
+
+	if (!a || !b)
+		return false;
+
+	return a->range.off == b->range.off &&
+		a->range.len == b->range.len &&
+		0 == str_cmp(a->uri, b->uri);
 }
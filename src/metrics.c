@@ -0,0 +1,131 @@
+/**
+ * @file metrics.c HLS Performance client -- per-worker metrics
+ *
+ * Copyright (C) 2019 Creytiv.com
+ */
+
+#include <string.h>
+#include <re.h>
+#include "hlsperf.h"
+
+
+void metrics_init(struct metrics *m)
+{
+	memset(m, 0, sizeof(*m));
+}
+
+
+void metrics_merge(struct metrics *dst, const struct metrics *src)
+{
+	hist_merge(&dst->dns,           &src->dns);
+	hist_merge(&dst->tcp,           &src->tcp);
+	hist_merge(&dst->conn,          &src->conn);
+	hist_merge(&dst->playlist_ttfb, &src->playlist_ttfb);
+	hist_merge(&dst->playlist,      &src->playlist);
+	hist_merge(&dst->segment_ttfb,  &src->segment_ttfb);
+	hist_merge(&dst->segment,       &src->segment);
+	hist_merge(&dst->segment_co,    &src->segment_co);
+	hist_merge(&dst->throughput,    &src->throughput);
+	hist_merge(&dst->part,          &src->part);
+	hist_merge(&dst->part_hint,     &src->part_hint);
+	hist_merge(&dst->hold_back,     &src->hold_back);
+	hist_merge(&dst->startup,       &src->startup);
+	hist_merge(&dst->stall,         &src->stall);
+
+	dst->dns_lookup += src->dns_lookup;
+	dst->dns_hit    += src->dns_hit;
+	dst->n_req      += src->n_req;
+	dst->n_bytes    += src->n_bytes;
+	dst->n_err      += src->n_err;
+	dst->n_stall    += src->n_stall;
+	dst->n_switch   += src->n_switch;
+	dst->n_arrival  += src->n_arrival;
+	dst->n_depart   += src->n_depart;
+	dst->n_conn_new   += src->n_conn_new;
+	dst->n_conn_reuse += src->n_conn_reuse;
+	dst->n_conn_wait  += src->n_conn_wait;
+	dst->conn_time    += src->conn_time;
+	dst->n_invalid    += src->n_invalid;
+	dst->check_bytes  += src->check_bytes;
+	dst->check_time   += src->check_time;
+	dst->n_active   += src->n_active;
+}
+
+
+/* take a snapshot of metrics that are being written by another thread */
+void metrics_load(struct metrics *dst, const struct metrics *src)
+{
+	hist_load(&dst->dns,           &src->dns);
+	hist_load(&dst->tcp,           &src->tcp);
+	hist_load(&dst->conn,          &src->conn);
+	hist_load(&dst->playlist_ttfb, &src->playlist_ttfb);
+	hist_load(&dst->playlist,      &src->playlist);
+	hist_load(&dst->segment_ttfb,  &src->segment_ttfb);
+	hist_load(&dst->segment,       &src->segment);
+	hist_load(&dst->segment_co,    &src->segment_co);
+	hist_load(&dst->throughput,    &src->throughput);
+	hist_load(&dst->part,          &src->part);
+	hist_load(&dst->part_hint,     &src->part_hint);
+	hist_load(&dst->hold_back,     &src->hold_back);
+	hist_load(&dst->startup,       &src->startup);
+	hist_load(&dst->stall,         &src->stall);
+
+	dst->dns_lookup = STAT_GET(src->dns_lookup);
+	dst->dns_hit    = STAT_GET(src->dns_hit);
+	dst->n_req      = STAT_GET(src->n_req);
+	dst->n_bytes    = STAT_GET(src->n_bytes);
+	dst->n_err      = STAT_GET(src->n_err);
+	dst->n_stall    = STAT_GET(src->n_stall);
+	dst->n_switch   = STAT_GET(src->n_switch);
+	dst->n_arrival  = STAT_GET(src->n_arrival);
+	dst->n_depart   = STAT_GET(src->n_depart);
+	dst->n_conn_new   = STAT_GET(src->n_conn_new);
+	dst->n_conn_reuse = STAT_GET(src->n_conn_reuse);
+	dst->n_conn_wait  = STAT_GET(src->n_conn_wait);
+	dst->conn_time    = STAT_GET(src->conn_time);
+	dst->n_invalid    = STAT_GET(src->n_invalid);
+	dst->check_bytes  = STAT_GET(src->check_bytes);
+	dst->check_time   = STAT_GET(src->check_time);
+	dst->n_active   = STAT_GET(src->n_active);
+}
+
+
+/* activity between two snapshots; gauges are taken from `cur` */
+void metrics_delta(struct metrics *dst, const struct metrics *cur,
+		   const struct metrics *prev)
+{
+	hist_delta(&dst->dns,      &cur->dns,      &prev->dns);
+	hist_delta(&dst->tcp,      &cur->tcp,      &prev->tcp);
+	hist_delta(&dst->conn,     &cur->conn,     &prev->conn);
+	hist_delta(&dst->playlist_ttfb, &cur->playlist_ttfb,
+		   &prev->playlist_ttfb);
+	hist_delta(&dst->playlist, &cur->playlist, &prev->playlist);
+	hist_delta(&dst->segment_ttfb, &cur->segment_ttfb,
+		   &prev->segment_ttfb);
+	hist_delta(&dst->segment,  &cur->segment,  &prev->segment);
+	hist_delta(&dst->segment_co, &cur->segment_co, &prev->segment_co);
+	hist_delta(&dst->throughput, &cur->throughput, &prev->throughput);
+	hist_delta(&dst->part,     &cur->part,     &prev->part);
+	hist_delta(&dst->part_hint, &cur->part_hint, &prev->part_hint);
+	hist_delta(&dst->hold_back, &cur->hold_back, &prev->hold_back);
+	hist_delta(&dst->startup,  &cur->startup,  &prev->startup);
+	hist_delta(&dst->stall,    &cur->stall,    &prev->stall);
+
+	dst->dns_lookup = cur->dns_lookup - prev->dns_lookup;
+	dst->dns_hit    = cur->dns_hit    - prev->dns_hit;
+	dst->n_req      = cur->n_req      - prev->n_req;
+	dst->n_bytes    = cur->n_bytes    - prev->n_bytes;
+	dst->n_err      = cur->n_err      - prev->n_err;
+	dst->n_stall    = cur->n_stall    - prev->n_stall;
+	dst->n_switch   = cur->n_switch   - prev->n_switch;
+	dst->n_arrival  = cur->n_arrival  - prev->n_arrival;
+	dst->n_depart   = cur->n_depart   - prev->n_depart;
+	dst->n_conn_new   = cur->n_conn_new   - prev->n_conn_new;
+	dst->n_conn_reuse = cur->n_conn_reuse - prev->n_conn_reuse;
+	dst->n_conn_wait  = cur->n_conn_wait  - prev->n_conn_wait;
+	dst->conn_time    = cur->conn_time    - prev->conn_time;
+	dst->n_invalid    = cur->n_invalid    - prev->n_invalid;
+	dst->check_bytes  = cur->check_bytes  - prev->check_bytes;
+	dst->check_time   = cur->check_time   - prev->check_time;
+	dst->n_active   = cur->n_active;
+}
@@ -0,0 +1,112 @@
+/**
+ * @file objpool.c HLS Performance client -- object pools
+ *
+ * Copyright (C) 2019 Creytiv.com
+ */
+
+#include <string.h>
+#include <re.h>
+#include "hlsperf.h"
+
+
+/*
+ * Segments, parts and HTTP requests come and go all the time, in every
+ * session. A worker keeps the objects of one type that were released
+ * on a fixed-size free list and hands them out again, instead of going
+ * to the heap for each one.
+ *
+ * The objects stay ordinary mem objects, released with mem_deref():
+ * the destructor of a pooled object calls objpool_put() last, which
+ * takes a new reference to the object. mem_deref() then sees that the
+ * destructor has referenced the object again and does not free it.
+ * Objects on the free list are zeroed, so that releasing them for good
+ * runs their destructor on a zeroed object.
+ *
+ * Each object in use holds a reference to its pool, so the pool stays
+ * valid until the last of them is gone.
+ */
+
+
+struct objpool {
+	void **objv;              /* free list, objc entries used */
+	uint32_t objc;
+	uint32_t max;
+	size_t size;              /* object size */
+};
+
+
+static void destructor(void *data)
+{
+	struct objpool *op = data;
+
+	while (op->objc)
+		mem_deref(op->objv[--op->objc]);
+
+	mem_deref(op->objv);
+}
+
+
+/* A pool for objects of `size` bytes, keeping up to `max` released ones */
+int objpool_alloc(struct objpool **opp, size_t size, uint32_t max)
+{
+	struct objpool *op;
+
+	if (!opp || !size || !max)
+		return EINVAL;
+
+	op = mem_zalloc(sizeof(*op), destructor);
+	if (!op)
+		return ENOMEM;
+
+	op->objv = mem_zalloc(max * sizeof(*op->objv), NULL);
+	if (!op->objv) {
+		mem_deref(op);
+		return ENOMEM;
+	}
+
+	op->max  = max;
+	op->size = size;
+
+	*opp = op;
+
+	return 0;
+}
+
+
+/*
+ * Get a zeroed object of `size` bytes with the destructor `dh`, like
+ * mem_zalloc(). The object must keep a reference to the pool and give
+ * it to objpool_put() at the end of `dh`. Without a pool it is a plain
+ * mem_zalloc(). The size must be the size of the pool.
+ */
+void *objpool_get(struct objpool *op, size_t size, mem_destroy_h *dh)
+{
+	if (op && size != op->size)
+		return NULL;
+
+	if (!op || !op->objc)
+		return mem_zalloc(size, dh);
+
+	/* the reference taken by objpool_put() */
+	return op->objv[--op->objc];
+}
+
+
+/*
+ * Put the object `obj` back into the pool and release the reference
+ * to the pool. Must be called last, from the destructor of `obj`.
+ */
+void objpool_put(struct objpool *op, void *obj)
+{
+	if (!op || !obj)
+		return;
+
+	/* the last reference: the pool goes away, and so does obj */
+	if (mem_nrefs(op) > 1 && op->objc < op->max) {
+
+		memset(obj, 0, op->size);
+		op->objv[op->objc++] = mem_ref(obj);
+	}
+
+	mem_deref(op);
+}
@@ -0,0 +1,322 @@
+/**
+ * @file output.c HLS Performance client -- machine-readable summary
+ *
+ * Copyright (C) 2019 Creytiv.com
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <re.h>
+#include "hlsperf.h"
+
+
+/*
+ * The summary is written as JSON, or as CSV if the file name ends in
+ * ".csv". Both have the same sections: config, counters, histograms
+ * and variants. Values are in their raw unit, e.g. [us] for times.
+ *
+ * CSV columns: section,name,unit,value,p50,p90,p99,p99.9,max
+ * where value is the sample count for histograms.
+ */
+
+
+struct output {
+	FILE *f;
+	const char *section;
+	unsigned nsec;
+	unsigned nitem;
+	bool csv;
+};
+
+
+static void json_str(FILE *f, const char *s)
+{
+	if (!s) {
+		(void)fputs("null", f);
+		return;
+	}
+
+	(void)fputc('"', f);
+
+	for (; *s; s++) {
+
+		if (*s == '"' || *s == '\\')
+			(void)fprintf(f, "\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			(void)fprintf(f, "\\u%04x", *s);
+		else
+			(void)fputc(*s, f);
+	}
+
+	(void)fputc('"', f);
+}
+
+
+static void section(struct output *o, const char *name)
+{
+	o->section = name;
+
+	if (!o->csv) {
+		(void)fprintf(o->f, "%s  \"%s\": {",
+			      o->nsec ? "\n  },\n" : "{\n", name);
+	}
+
+	++o->nsec;
+	o->nitem = 0;
+}
+
+
+/* start an item, JSON only */
+static void item(struct output *o, const char *name)
+{
+	(void)fprintf(o->f, "%s\n    ", o->nitem++ ? "," : "");
+	json_str(o->f, name);
+	(void)fputs(": ", o->f);
+}
+
+
+static void out_str(struct output *o, const char *name, const char *val)
+{
+	if (o->csv) {
+		(void)fprintf(o->f, "%s,%s,,%s,,,,,\n",
+			      o->section, name, val ? val : "");
+		return;
+	}
+
+	item(o, name);
+	json_str(o->f, val);
+}
+
+
+static void out_u64(struct output *o, const char *name, uint64_t val)
+{
+	if (o->csv) {
+		(void)fprintf(o->f, "%s,%s,,%llu,,,,,\n",
+			      o->section, name, (unsigned long long)val);
+		return;
+	}
+
+	item(o, name);
+	(void)fprintf(o->f, "%llu", (unsigned long long)val);
+}
+
+
+static void out_double(struct output *o, const char *name, double val)
+{
+	if (o->csv) {
+		(void)fprintf(o->f, "%s,%s,,%g,,,,,\n", o->section, name, val);
+		return;
+	}
+
+	item(o, name);
+	(void)fprintf(o->f, "%g", val);
+}
+
+
+static void out_bool(struct output *o, const char *name, bool val)
+{
+	if (o->csv) {
+		(void)fprintf(o->f, "%s,%s,,%d,,,,,\n", o->section, name, val);
+		return;
+	}
+
+	item(o, name);
+	(void)fputs(val ? "true" : "false", o->f);
+}
+
+
+static void out_hist(struct output *o, const char *name, const char *unit,
+		     const struct hist *h)
+{
+	const unsigned long long p50  = hist_percentile(h, 50.0);
+	const unsigned long long p90  = hist_percentile(h, 90.0);
+	const unsigned long long p99  = hist_percentile(h, 99.0);
+	const unsigned long long p999 = hist_percentile(h, 99.9);
+
+	if (o->csv) {
+		(void)fprintf(o->f, "%s,%s,%s,%llu,%llu,%llu,%llu,%llu,%llu\n",
+			      o->section, name, unit,
+			      (unsigned long long)h->count,
+			      p50, p90, p99, p999,
+			      (unsigned long long)h->max);
+		return;
+	}
+
+	item(o, name);
+	(void)fprintf(o->f, "{\"unit\": \"%s\", \"count\": %llu,"
+		      " \"p50\": %llu, \"p90\": %llu, \"p99\": %llu,"
+		      " \"p99.9\": %llu, \"max\": %llu}",
+		      unit, (unsigned long long)h->count,
+		      p50, p90, p99, p999, (unsigned long long)h->max);
+}
+
+
+static void write_config(struct output *o, const struct config *cfg,
+			 const char *uri)
+{
+	section(o, "config");
+
+	out_str(o,  "uri",       uri);
+	out_u64(o,  "workers",   cfg->workers);
+	out_bool(o, "llhls",     cfg->llhls);
+	out_bool(o, "validate",  cfg->validate);
+	out_str(o,  "abr",       cfg->abr ? cfg->abr->name : NULL);
+	out_str(o,  "pool",      httpc_pool_name(cfg->http.pool));
+	out_u64(o,  "max_host",  cfg->http.max_host);
+
+	if (cfg->profile) {
+		out_u64(o,    "profile_phases", cfg->profile->phasec);
+		out_double(o, "profile_duration", cfg->profile->dur);
+	}
+
+	if (cfg->links.n) {
+		char links[256];
+
+		(void)re_snprintf(links, sizeof(links), "%H",
+				  linkmix_print, &cfg->links);
+		out_str(o, "links", links);
+	}
+
+	if (cfg->lifetime.type != DIST_NONE) {
+		out_str(o,    "lifetime",   dist_name(cfg->lifetime.type));
+		out_double(o, "lifetime_a", cfg->lifetime.a);
+		out_double(o, "lifetime_b", cfg->lifetime.b);
+	}
+}
+
+
+static void write_counters(struct output *o, const struct config *cfg,
+			   const struct metrics *m, const struct summary *sum)
+{
+	const uint64_t watch = sum->play_time + sum->stall_time;
+
+	section(o, "counters");
+
+	out_u64(o, "sessions",        sum->n_sess);
+	out_u64(o, "connected",       sum->n_connected);
+	out_u64(o, "stalled_sessions", sum->n_stalled);
+	out_u64(o, "skipped",         sum->n_skipped);
+	out_u64(o, "dns_lookups",     m->dns_lookup);
+	out_u64(o, "dns_cached",      m->dns_hit);
+	out_u64(o, "requests",        m->n_req);
+	out_u64(o, "bytes",           m->n_bytes);
+	out_u64(o, "errors",          m->n_err);
+	out_u64(o, "stalls",          m->n_stall);
+	out_u64(o, "switches",        m->n_switch);
+	out_u64(o, "arrivals",        m->n_arrival);
+	out_u64(o, "departures",      m->n_depart);
+	out_u64(o, "conn_new",        m->n_conn_new);
+	out_u64(o, "conn_reused",     m->n_conn_reuse);
+	out_u64(o, "conn_queued",     m->n_conn_wait);
+	out_u64(o, "conn_time_us",    m->conn_time);
+	out_u64(o, "invalid",         m->n_invalid);
+	out_u64(o, "validated_bytes", m->check_bytes);
+	out_double(o, "validate_ms_per_gb", m->check_bytes ?
+		   m->check_time * 1e3 / m->check_bytes : 0.0);
+	out_u64(o, "play_time_us",    sum->play_time);
+	out_u64(o, "stall_time_us",   sum->stall_time);
+	out_double(o, "rebuffer_ratio",
+		   watch ? (double)sum->stall_time / watch : 0.0);
+	out_u64(o, "bytes_per_session",
+		sum->mem_sess ? sum->mem_bytes / sum->mem_sess : 0);
+
+	if (cfg->rec)
+		out_u64(o, "records_dropped", recorder_dropped(cfg->rec));
+}
+
+
+static void write_hists(struct output *o, const struct metrics *m,
+			const struct summary *sum)
+{
+	section(o, "histograms");
+
+	out_hist(o, "dns",           "us",     &m->dns);
+	out_hist(o, "tcp",           "us",     &m->tcp);
+	out_hist(o, "conn",          "us",     &m->conn);
+	out_hist(o, "playlist_ttfb", "us",     &m->playlist_ttfb);
+	out_hist(o, "playlist",      "us",     &m->playlist);
+	out_hist(o, "segment_ttfb",  "us",     &m->segment_ttfb);
+	out_hist(o, "segment",       "us",     &m->segment);
+	out_hist(o, "segment_co",    "us",     &m->segment_co);
+	out_hist(o, "throughput",    "kbit/s", &m->throughput);
+	out_hist(o, "part",          "us",     &m->part);
+	out_hist(o, "part_hint",     "us",     &m->part_hint);
+	out_hist(o, "hold_back",     "us",     &m->hold_back);
+	out_hist(o, "startup",       "us",     &m->startup);
+	out_hist(o, "stall",         "us",     &m->stall);
+	out_hist(o, "rebuffer",      "0.001%", &sum->rebuffer);
+}
+
+
+/* time per variant, named by bandwidth [bit/s] */
+static void write_variants(struct output *o, const struct summary *sum)
+{
+	char name[32];
+	size_t i;
+
+	section(o, "variants");
+
+	for (i=0; i<sum->vtc; i++) {
+
+		const struct vtime *vt = &sum->vtv[i];
+
+		if (o->csv) {
+			(void)fprintf(o->f, "variants,%u,%ux%u,%llu,,,,,\n",
+				      vt->bandwidth, vt->width, vt->height,
+				      (unsigned long long)vt->time);
+			continue;
+		}
+
+		(void)re_snprintf(name, sizeof(name), "%u", vt->bandwidth);
+
+		item(o, name);
+		(void)fprintf(o->f, "{\"width\": %u, \"height\": %u,"
+			      " \"time_us\": %llu}",
+			      vt->width, vt->height,
+			      (unsigned long long)vt->time);
+	}
+}
+
+
+/* Write the summary of the run to the file `path` */
+int output_summary(const char *path, const struct config *cfg,
+		   const char *uri, const struct metrics *m,
+		   const struct summary *sum)
+{
+	struct output o;
+	const char *ext;
+	int err = 0;
+
+	if (!path || !cfg || !m || !sum)
+		return EINVAL;
+
+	memset(&o, 0, sizeof(o));
+
+	ext = strrchr(path, '.');
+	o.csv = ext && 0 == str_casecmp(ext, ".csv");
+
+	o.f = fopen(path, "w");
+	if (!o.f)
+		return errno;
+
+	if (o.csv)
+		(void)fputs("section,name,unit,value,p50,p90,p99,p99.9,max\n",
+			    o.f);
+
+	write_config(&o, cfg, uri);
+	write_counters(&o, cfg, m, sum);
+	write_hists(&o, m, sum);
+	write_variants(&o, sum);
+
+	if (!o.csv)
+		(void)fputs("\n  }\n}\n", o.f);
+
+	if (ferror(o.f))
+		err = EIO;
+
+	if (fclose(o.f) && !err)
+		err = errno;
+
+	return err;
+}
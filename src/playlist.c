@@ -15,11 +15,33 @@
 
 
 enum {
-	RELOAD_INTERVAL = 6  /* seconds */
+	TARGET_DURATION = 6,     /* seconds, until the playlist is read */
+	BUFFER_MAX      = 30,    /* seconds of media buffered ahead */
+	BLOCK_MARGIN    = 2000   /* ms on top of a blocking request */
 };
 
 
 static void start_player(struct media_playlist *mpl);
+static void timeout_reload(void *data);
+static void fetch_part(struct media_playlist *mpl);
+
+
+/*
+ * Timeout of a request the origin holds until the part exists, a
+ * blocking reload or a preload hint: it may take up to three target
+ * durations (RFC 8216bis, section 6.2.5.2)
+ */
+static uint32_t block_timeout(const struct media_playlist *mpl)
+{
+	return 3 * mpl->target_dur * 1000 + BLOCK_MARGIN;
+}
+
+
+/* the next reload is held by the origin until the next part exists */
+static bool blocking(const struct media_playlist *mpl)
+{
+	return mpl->ll && mpl->can_block && mpl->end_msn;
+}
 
 
 static void destructor(void *data)
@@ -30,18 +52,98 @@ static void destructor(void *data)
 
 	tmr_cancel(&pl->tmr_play);
 	tmr_cancel(&pl->tmr_reload);
-	mem_deref(pl->filename);
+	mem_deref(pl->uri);
 	mem_deref(pl->req);
 	mem_deref(pl->req_media);
+	mem_deref(pl->req_part);
+	mem_deref(pl->req_hint);
+	mem_deref(pl->hint_uri);
 	list_flush(&pl->playlist);
+	list_flush(&pl->parts);
+	mem_deref(pl->fmp4);
+	mem_deref(pl->fmp4_part);
+	mem_deref(pl->map);
+	mem_deref(pl->parse_map);
+}
+
+
+/*
+ * URI of `name`, which is relative to the media playlist (RFC 8216,
+ * section 4.1), not to the master playlist
+ */
+static int media_uri(const struct media_playlist *mpl, char *buf,
+		     size_t size, const char *name)
+{
+	struct pl base, ref;
+
+	pl_set_str(&base, mpl->uri);
+	pl_set_str(&ref, name);
+
+	return m3u8_uri_resolve(buf, size, &base, &ref);
+}
+
+
+/* record what has changed in the player buffer since `prev` */
+static void player_metrics(struct media_playlist *mpl,
+			   const struct playout *prev)
+{
+	struct metrics *m = client_metrics(mpl->cli);
+	const struct playout *po = &mpl->po;
+
+	if (po->n_stall > prev->n_stall)
+		STAT_ADD(m->n_stall, po->n_stall - prev->n_stall);
+
+	if (po->stall_time > prev->stall_time)
+		hist_record(&m->stall, po->stall_time - prev->stall_time);
+
+	if (po->startup && !prev->startup)
+		hist_record(&m->startup, po->startup);
+}
+
+
+static void player_update(struct media_playlist *mpl)
+{
+	const struct playout prev = mpl->po;
+
+	playout_update(&mpl->po, time_usec());
+	player_metrics(mpl, &prev);
+}
+
+
+/* downloaded media goes into the player buffer */
+static void player_add(struct media_playlist *mpl, double duration)
+{
+	const struct playout prev = mpl->po;
+
+	playout_add(&mpl->po, duration, time_usec());
+	player_metrics(mpl, &prev);
+}
+
+
+/* the last media of an EXT-X-ENDLIST playlist is in the buffer */
+static void player_end(struct media_playlist *mpl)
+{
+	const struct playout prev = mpl->po;
+
+	if (!mpl->endlist)
+		return;
+
+	playout_end(&mpl->po, time_usec());
+	player_metrics(mpl, &prev);
 }
 
 
 void playlist_close(struct media_playlist *mpl, int err)
 {
+	struct playout prev;
+
 	if (!mpl)
 		return;
 
+	prev = mpl->po;
+	playout_close(&mpl->po, time_usec());
+	player_metrics(mpl, &prev);
+
 	mpl->terminated = true;
 
 	tmr_cancel(&mpl->tmr_play);
@@ -49,22 +151,222 @@ void playlist_close(struct media_playlist *mpl, int err)
 
 	mpl->req       = mem_deref(mpl->req);
 	mpl->req_media = mem_deref(mpl->req_media);
+	mpl->req_part  = mem_deref(mpl->req_part);
+	mpl->req_hint  = mem_deref(mpl->req_hint);
+	mpl->seg_bytes = 0;
+}
+
+
+/* MPEG-TS media is not validated */
+static bool is_fmp4(const char *filename)
+{
+	struct pl pl, ext;
+
+	pl_set_str(&pl, filename);
+
+	return m3u8_uri_ext(&pl, &ext) || pl_strcasecmp(&ext, "ts");
+}
+
+
+/* walk the body with the fMP4 validation, timed */
+static void check_data(struct media_playlist *mpl, struct fmp4 *f,
+		       const uint8_t *buf, size_t size)
+{
+	struct metrics *m = client_metrics(mpl->cli);
+	uint64_t t0 = time_nsec();
+
+	(void)fmp4_walk(f, buf, size);
+
+	STAT_ADD(m->check_time, time_nsec() - t0);
+	STAT_ADD(m->check_bytes, size);
+}
+
+
+/* false if the body that has ended is not valid fMP4 */
+static bool check_end(struct media_playlist *mpl, struct fmp4 *f,
+		      const char *what)
+{
+	struct metrics *m = client_metrics(mpl->cli);
+
+	if (!f || !fmp4_end(f))
+		return true;
+
+	DEBUG_NOTICE("playlist: invalid %s: %s\n", what, f->what);
+
+	STAT_ADD(m->n_invalid, 1);
+	STAT_ADD(m->n_err, 1);
+
+	return false;
 }
 
 
 static int http_data_handler(const uint8_t *buf, size_t size,
 			     const struct http_msg *msg, void *arg)
 {
-	/* ignore data */
+	struct media_playlist *mpl = arg;
+	(void)msg;
+
+	/* count the body bytes, the data is only validated */
+	mpl->seg_bytes += size;
+
+	if (mpl->check)
+		check_data(mpl, mpl->fmp4, buf, size);
+
+	return 0;
+}
+
+
+static int part_data_handler(const uint8_t *buf, size_t size,
+			     const struct http_msg *msg, void *arg)
+{
+	struct media_playlist *mpl = arg;
+	(void)msg;
+
+	if (mpl->check_part)
+		check_data(mpl, mpl->fmp4_part, buf, size);
 
 	return 0;
 }
 
 
+/* parts and hints are counted from the request timing */
+static int discard_data_handler(const uint8_t *buf, size_t size,
+				const struct http_msg *msg, void *arg)
+{
+	(void)buf;
+	(void)size;
+	(void)msg;
+	(void)arg;
+
+	return 0;
+}
+
+
+/* the audio rendition follows the AUDIO group of the new variant */
+static void select_audio(struct media_playlist *mpl, const char *group)
+{
+	struct media_playlist *ampl = client_playlists(mpl->cli)[MEDIA_AUDIO];
+	const struct rendtab *rt = client_renditions(mpl->cli);
+	const struct rendition *r;
+	int err;
+
+	if (!ampl || ampl->terminated)
+		return;
+
+	r = rendtab_group(rt, RENDITION_AUDIO, group);
+	if (!r || ampl->rend == (uint16_t)(r - rt->rendv))
+		return;
+
+	ampl->rend = (uint16_t)(r - rt->rendv);
+
+	err = playlist_switch(ampl, r->uri);
+	if (err) {
+		re_printf("playlist: switch to %s failed (%m)\n",
+			  r->uri, err);
+		playlist_close(ampl, err);
+	}
+}
+
+
+/*
+ * Let the ABR controller pick the variant of the next segment, or of
+ * the next part in LL-HLS mode, from the `bytes` just received.
+ */
+static void select_variant(struct media_playlist *mpl, uint64_t bytes,
+			   const struct httpc_timing *t)
+{
+	struct abr *abr = client_abr(mpl->cli);
+	const struct rendition *r;
+	int err;
+
+	if (!abr || client_playlists(mpl->cli)[MEDIA_VIDEO] != mpl)
+		return;
+
+	/* request to last byte, as seen by the player [kbit/s] */
+	abr_sample(abr, bytes * 8000.0 / max(t->total, 1), mpl->req_dur);
+
+	r = abr_select(abr, mpl->po.level, mpl->req_dur, BUFFER_MAX);
+	if (!r)
+		return;
+
+	STAT_ADD(client_metrics(mpl->cli)->n_switch, 1);
+
+	mpl->rend = (uint16_t)(r - client_renditions(mpl->cli)->rendv);
+
+	err = playlist_switch(mpl, r->uri);
+	if (err) {
+		re_printf("playlist: switch to %s failed (%m)\n",
+			  r->uri, err);
+		playlist_close(mpl, err);
+		return;
+	}
+
+	select_audio(mpl, r->group);
+}
+
+
+/*
+ * Segment schedule
+ *
+ * Each segment has an intended send time, the moment a player keeping
+ * up with the playout would have requested it: when the segment was
+ * due to be published and the buffer had room for it. Publishing is
+ * due one segment duration after the previous segment; room is due
+ * when the buffer has drained to BUFFER_MAX, or one segment duration
+ * after the previous intended time, whichever comes first.
+ *
+ * The request is often sent later, when the previous download was
+ * slow, a timer fired late or a playlist reload came late. Measuring
+ * from the intended time counts that delay as latency, instead of
+ * omitting it (coordinated omission).
+ */
+
+
+/* a new segment is due one duration after the previous one */
+static void sched_avail(struct media_playlist *mpl, struct mediafile *mf)
+{
+	const uint64_t now = time_usec();
+
+	mf->ts_avail = now;
+
+	if (mpl->ts_avail && mpl->ts_avail < now)
+		mf->ts_avail = mpl->ts_avail;
+
+	mpl->ts_avail = mf->ts_avail + (uint64_t)(mf->duration * 1e6);
+}
+
+
+/* the current segment was added to the buffer at `now` */
+static void sched_room(struct media_playlist *mpl, uint64_t now)
+{
+	uint64_t room = now, next;
+
+	if (mpl->po.level > BUFFER_MAX)
+		room += (uint64_t)((mpl->po.level - BUFFER_MAX) * 1e6);
+
+	next = mpl->ts_intended + (uint64_t)(mpl->req_dur * 1e6);
+
+	mpl->ts_room = min(room, next);
+}
+
+
+/* intended send time of `mf`, never later than now */
+static uint64_t sched_intended(const struct media_playlist *mpl,
+			       const struct mediafile *mf)
+{
+	const uint64_t now = time_usec();
+	const uint64_t ts = max(mpl->ts_room, mf->ts_avail);
+
+	return ts && ts < now ? ts : now;
+}
+
+
 static void media_http_resp_handler(int err, const struct http_msg *msg,
-				    void *arg)
+				    const struct httpc_timing *t, void *arg)
 {
 	struct media_playlist *mpl = arg;
+	struct metrics *m = client_metrics(mpl->cli);
+	uint64_t now;
 
 	if (mpl->terminated)
 		return;
@@ -82,28 +384,34 @@ static void media_http_resp_handler(int err, const struct http_msg *msg,
 	}
 
 	if (msg_ctype_cmp(&msg->ctyp, "video", "mp4") ||
+	    msg_ctype_cmp(&msg->ctyp, "video", "mp2t") ||
 	    msg_ctype_cmp(&msg->ctyp, "application", "octet-stream")) {
 
-		int64_t media_time;
-		double bitrate;
+		now = time_usec();
 
-		mpl->ts_media_resp = tmr_jiffies();
+		hist_record(&m->segment_ttfb, t->ttfb);
+		hist_record(&m->segment, t->total);
+		hist_record(&m->segment_co, now - mpl->ts_intended);
 
-		media_time = mpl->ts_media_resp - mpl->ts_media_req;
+		/* body bytes over the body transfer window [kbit/s] */
+		hist_record(&m->throughput,
+			    mpl->seg_bytes * 8000 / max(t->download, 1));
 
-		mpl->media_time_acc += media_time;
-		++mpl->media_count;
+		mpl->bytes += mpl->seg_bytes;
 
-		mpl->bytes += msg->clen;
+		/* a player cannot buffer what it cannot decode */
+		if (check_end(mpl, mpl->check ? mpl->fmp4 : NULL, "segment"))
+			player_add(mpl, mpl->req_dur);
+		sched_room(mpl, now);
 
-		bitrate = (double)(mpl->bytes * 8000) / media_time;
-
-		mpl->bitrate_acc += bitrate;
+		select_variant(mpl, mpl->seg_bytes, t);
 	}
 	else {
 		DEBUG_NOTICE("unknown content-type: %r/%r\n",
 			  &msg->ctyp.type, &msg->ctyp.subtype);
 	}
+
+	start_player(mpl);
 }
 
 
@@ -118,139 +426,773 @@ static void tmr_play_handler(void *data)
 static int get_media_file(struct media_playlist *mpl, struct mediafile *mf,
 			  const char *uri)
 {
+	struct httpc_opt opt;
 	int err;
 
-	mpl->req_media = mem_deref(mpl->req_media);
+	mpl->seg_bytes   = 0;
+	mpl->req_dur     = mf->duration;
+	mpl->ts_intended = sched_intended(mpl, mf);
+	mpl->check       = mpl->fmp4 && is_fmp4(mf->filename);
+
+	if (mpl->check)
+		fmp4_begin(mpl->fmp4);
+
+	opt.kind      = REQ_SEGMENT;
+	opt.rend      = mpl->rend;
+	opt.range_off = mf->range.off;
+	opt.range_len = mf->range.len;
+	opt.timeout   = 0;
 
-	err = http_request(&mpl->req_media, client_http_cli(mpl->cli),
-			   "GET", uri,
-			   media_http_resp_handler,
-			   http_data_handler, mpl, NULL);
+	err = httpc_request(&mpl->req_media, client_httpc(mpl->cli),
+			    "GET", uri, &opt,
+			    media_http_resp_handler,
+			    http_data_handler, mpl);
 	if (err) {
 		re_printf("http request failed (%m)\n", err);
 		return err;
 	}
 
-	mf->played = true;
+	/* played segments are not kept */
+	mem_deref(mf);
 
 	return 0;
 }
 
 
+static void init_resp_handler(int err, const struct http_msg *msg,
+			      const struct httpc_timing *t, void *arg)
+{
+	struct media_playlist *mpl = arg;
+	(void)t;
+
+	if (mpl->terminated)
+		return;
+
+	if (err) {
+		re_printf("playlist: init: http error: %m\n", err);
+		playlist_close(mpl, err);
+		return;
+	}
+	else if (msg->scode >= 300) {
+		re_printf("playlist: init request failed (%u %r)\n",
+			  msg->scode, &msg->reason);
+		playlist_close(mpl, EPROTO);
+		return;
+	}
+
+	mpl->bytes += mpl->seg_bytes;
+
+	(void)check_end(mpl, mpl->check ? mpl->fmp4 : NULL, "init segment");
+
+	start_player(mpl);
+	fetch_part(mpl);
+}
+
+
+/*
+ * Get the initialization segment (EXT-X-MAP) of the next media, unless
+ * it is the one loaded already. Returns true if it is being fetched.
+ */
+static bool fetch_init(struct media_playlist *mpl, struct mediamap *map)
+{
+	struct httpc_opt opt;
+	char uri[512];
+	int err;
+
+	if (!map || mediamap_equal(map, mpl->map))
+		return false;
+
+	err = media_uri(mpl, uri, sizeof(uri), map->uri);
+	if (err) {
+		re_printf("playlist: invalid uri %s (%m)\n", map->uri, err);
+		playlist_close(mpl, err);
+		return true;
+	}
+
+	mpl->seg_bytes = 0;
+	mpl->check     = mpl->fmp4 && is_fmp4(map->uri);
+
+	if (mpl->check)
+		fmp4_begin(mpl->fmp4);
+
+	opt.kind      = REQ_INIT;
+	opt.rend      = mpl->rend;
+	opt.range_off = map->range.off;
+	opt.range_len = map->range.len;
+	opt.timeout   = 0;
+
+	err = httpc_request(&mpl->req_media, client_httpc(mpl->cli),
+			    "GET", uri, &opt, init_resp_handler,
+			    http_data_handler, mpl);
+	if (err) {
+		re_printf("http request failed (%m)\n", err);
+		playlist_close(mpl, err);
+		return true;
+	}
+
+	/* failures close the playlist, it is loaded from now on */
+	mem_deref(mpl->map);
+	mpl->map = mem_ref(map);
+
+	return true;
+}
+
+
+/*
+ * Download the next segment, one at a time, as long as the player
+ * buffer has room for it. At the live edge the player is restarted
+ * by the next playlist reload.
+ */
 static void start_player(struct media_playlist *mpl)
 {
 	struct mediafile *mf;
-	char *uri = NULL;
-	uint32_t delay = 10000;
+	char uri[512];
 	int err;
 
+	if (mpl->terminated || mpl->ll || mpl->req_media)
+		return;
+
+	player_update(mpl);
+
+	/* buffer full, wait until it has drained to the limit */
+	if (mpl->po.level > BUFFER_MAX) {
+		tmr_start(&mpl->tmr_play,
+			  (uint64_t)((mpl->po.level - BUFFER_MAX) * 1000),
+			  tmr_play_handler, mpl);
+		return;
+	}
+
 	/* get the next playlist item */
 	mf = mediafile_next(&mpl->playlist);
-	if (mf) {
+	if (!mf) {
+		player_end(mpl);
+		return;
+	}
 
-		delay = mf->duration*1000;
+	/* the initialization segment comes first */
+	if (fetch_init(mpl, mf->map))
+		return;
 
-		/* download the media file */
-		err = re_sdprintf(&uri, "%r%s",
-				  client_path(mpl->cli), mf->filename);
-		if (err)
-			goto out;
+	/* download the media file */
+	err = media_uri(mpl, uri, sizeof(uri), mf->filename);
+	if (err) {
+		re_printf("playlist: invalid uri %s (%m)\n",
+			  mf->filename, err);
+		playlist_close(mpl, err);
+		return;
+	}
+
+	err = get_media_file(mpl, mf, uri);
+	if (err) {
+		/* try again later */
+		tmr_start(&mpl->tmr_play, 1000, tmr_play_handler, mpl);
+	}
+}
+
+
+/*
+ * Low-Latency HLS
+ *
+ * Parts are fetched back to back, starting PART-HOLD-BACK behind the
+ * live edge. The part announced by EXT-X-PRELOAD-HINT is requested
+ * before it exists and is held by the origin until it is complete;
+ * when it shows up in the playlist later, with the same URI and byte
+ * offset, it is not fetched again.
+ */
+
+
+/* ordering position of part `ix` of segment `msn` */
+static uint64_t part_pos(uint64_t msn, uint32_t ix)
+{
+	return msn << 16 | ix;
+}
 
-		mpl->ts_media_req = tmr_jiffies();
 
-		get_media_file(mpl, mf, uri);
+static void part_resp_handler(int err, const struct http_msg *msg,
+			      const struct httpc_timing *t, void *arg)
+{
+	struct media_playlist *mpl = arg;
+
+	if (mpl->terminated)
+		return;
+
+	if (err) {
+		re_printf("playlist: part: http error: %m\n", err);
+		playlist_close(mpl, err);
+		return;
+	}
+	else if (msg->scode >= 300) {
+		re_printf("playlist: part request failed (%u %r)\n",
+			  msg->scode, &msg->reason);
+		playlist_close(mpl, EPROTO);
+		return;
 	}
 
- out:
-	tmr_start(&mpl->tmr_play, delay, tmr_play_handler, mpl);
+	hist_record(&client_metrics(mpl->cli)->part, t->total);
+	mpl->bytes += t->bytes;
+
+	if (check_end(mpl, mpl->check_part ? mpl->fmp4_part : NULL, "part"))
+		player_add(mpl, mpl->req_dur);
+
+	select_variant(mpl, t->bytes, t);
+	if (mpl->terminated)
+		return;
+
+	fetch_part(mpl);
+}
+
+
+static void hint_resp_handler(int err, const struct http_msg *msg,
+			      const struct httpc_timing *t, void *arg)
+{
+	struct media_playlist *mpl = arg;
+
+	if (mpl->terminated)
+		return;
+
+	/* the origin may drop a hint, the part is then fetched normally */
+	if (err || msg->scode >= 300) {
+		DEBUG_NOTICE("playlist: preload hint failed (%m %u)\n",
+			     err, err ? 0 : msg->scode);
+		mpl->hint_uri = mem_deref(mpl->hint_uri);
+		return;
+	}
+
+	hist_record(&client_metrics(mpl->cli)->part_hint, t->total);
+	mpl->bytes += t->bytes;
 
-	mem_deref(uri);
+	/* the hinted part has no duration yet */
+	player_add(mpl, mpl->part_target);
 }
 
 
-static void handle_line(struct media_playlist *mpl, const struct pl *line)
+static void fetch_part(struct media_playlist *mpl)
 {
-	struct pl file, ext;
-	int err = 0;
+	struct mediafile *mf;
+	struct httpc_opt opt;
+	char uri[512];
+	int err;
+
+	/* the initialization segment is loaded on its own */
+	if (mpl->req_part || mpl->req_media)
+		return;
+
+	mf = mediafile_next(&mpl->parts);
+	if (!mf) {
+		player_end(mpl);
+		return;
+	}
+
+	if (fetch_init(mpl, mf->map))
+		return;
 
-	/* ignore comment */
-	if (line->p[0] == '#') {
+	err = media_uri(mpl, uri, sizeof(uri), mf->filename);
+	if (err) {
+		re_printf("playlist: invalid uri %s (%m)\n",
+			  mf->filename, err);
+		playlist_close(mpl, err);
+		return;
+	}
 
-		struct pl pl_dur;
+	opt.kind      = REQ_PART;
+	opt.rend      = mpl->rend;
+	opt.range_off = mf->range.off;
+	opt.range_len = mf->range.len;
+	opt.timeout   = 0;
 
-		/* field: #EXTINF:10.000000 */
-		if (0 == re_regex(line->p, line->l,
-				  "EXTINF:[0-9.]+", &pl_dur)) {
+	mpl->check_part = mpl->fmp4_part && is_fmp4(mf->filename);
 
-			double dur = pl_float(&pl_dur);
+	if (mpl->check_part)
+		fmp4_begin(mpl->fmp4_part);
 
-			if (dur > 1.0)
-				mpl->last_dur = dur;
+	err = httpc_request(&mpl->req_part, client_httpc(mpl->cli),
+			    "GET", uri, &opt, part_resp_handler,
+			    mpl->check_part ? part_data_handler :
+			    discard_data_handler, mpl);
+	if (err) {
+		re_printf("http request failed (%m)\n", err);
+		playlist_close(mpl, err);
+		return;
+	}
+
+	mpl->req_dur = mf->duration;
+
+	mem_deref(mf);
+}
+
+
+static void fetch_hint(struct media_playlist *mpl)
+{
+	struct httpc_opt opt;
+	char uri[512];
+	int err;
+
+	if (!pl_isset(&mpl->parse_hint))
+		return;
+
+	/* in byte-range mode all parts of a segment share one URI */
+	if (mpl->hint_uri &&
+	    0 == pl_strcmp(&mpl->parse_hint, mpl->hint_uri) &&
+	    mpl->parse_hint_range.off == mpl->hint_range.off &&
+	    mpl->parse_hint_range.len == mpl->hint_range.len)
+		return;
+
+	mpl->hint_uri = mem_deref(mpl->hint_uri);
+	mpl->req_hint = mem_deref(mpl->req_hint);
+
+	err = strpool_get(mpl->pools.sp, &mpl->hint_uri, &mpl->parse_hint);
+	if (err)
+		return;
+
+	mpl->hint_range = mpl->parse_hint_range;
+
+	err = media_uri(mpl, uri, sizeof(uri), mpl->hint_uri);
+	if (err) {
+		re_printf("playlist: invalid uri %s (%m)\n",
+			  mpl->hint_uri, err);
+		mpl->hint_uri = mem_deref(mpl->hint_uri);
+		return;
+	}
+
+	opt.kind      = REQ_HINT;
+	opt.rend      = mpl->rend;
+	opt.range_off = mpl->hint_range.off;
+	opt.range_len = mpl->hint_range.len;
+	opt.timeout   = block_timeout(mpl);
+
+	err = httpc_request(&mpl->req_hint, client_httpc(mpl->cli),
+			    "GET", uri, &opt, hint_resp_handler,
+			    discard_data_handler, mpl);
+	if (err)
+		re_printf("http request failed (%m)\n", err);
+}
+
+
+static void handle_part(struct media_playlist *mpl, const struct pl *val)
+{
+	const uint32_t ix = mpl->parse_part++;
+	struct byterange range = {0, 0};
+	struct mediafile *mf;
+	struct pl uri, dur, br;
+	uint64_t pos;
+	int err;
+
+	if (!mpl->ll)
+		return;
+
+	/* a range without offset follows the range of the previous part */
+	if (0 == m3u8_attr(val, "BYTERANGE", &br)) {
+
+		if (m3u8_byterange(&br, mpl->parse_part_end, &range)) {
+			DEBUG_NOTICE("could not parse part (%r)\n", val);
+			return;
 		}
 
+		mpl->parse_part_end = range.off + range.len;
+	}
+
+	pos = part_pos(mpl->parse_msn, ix);
+
+	/* already known, nothing to allocate */
+	if (pos < mpl->next_part)
+		return;
+
+	mpl->next_part = pos + 1;
+
+	if (m3u8_attr(val, "URI", &uri) || m3u8_attr(val, "DURATION", &dur)) {
+		DEBUG_NOTICE("could not parse part (%r)\n", val);
 		return;
 	}
 
-	if (re_regex(line->p, line->l, "[^.]+.[a-z0-9]+", &file, &ext)) {
-		DEBUG_NOTICE("could not parse line (%r)\n", line);
+	/* requested as preload hint already */
+	if (mpl->hint_uri && 0 == pl_strcmp(&uri, mpl->hint_uri) &&
+	    range.off == mpl->hint_range.off)
+		return;
+
+	err = mediafile_part_new(&mpl->parts, &mpl->pools, &uri,
+				 mpl->parse_msn, ix, m3u8_decimal(&dur));
+	if (err) {
+		re_printf("parse error\n");
 		return;
 	}
 
-	if (0 == pl_strcasecmp(&ext, "m4s")) {
+	mf = list_ledata(list_tail(&mpl->parts));
+	mf->range = range;
+	mf->map   = mem_ref(mpl->parse_map);
+}
 
-		char *filename;
 
-		err = pl_strdup(&filename, line);
-		if (err)
-			goto out;
+static void handle_server_control(struct media_playlist *mpl,
+				  const struct pl *val)
+{
+	struct pl attr;
+
+	if (0 == m3u8_attr(val, "CAN-BLOCK-RELOAD", &attr))
+		mpl->can_block = 0 == pl_strcmp(&attr, "YES");
+
+	if (0 == m3u8_attr(val, "PART-HOLD-BACK", &attr))
+		mpl->part_hold_back = m3u8_decimal(&attr);
+}
+
+
+static void handle_parts(struct media_playlist *mpl)
+{
+	struct metrics *m = client_metrics(mpl->cli);
+
+	/* parts of segments that have left the live window */
+	mediafile_evict(&mpl->parts, mpl->seq);
+
+	/* join PART-HOLD-BACK behind the live edge */
+	if (!mpl->part_started) {
+
+		double hold_back = mpl->part_hold_back;
+
+		if (hold_back <= 0.0)
+			hold_back = 3 * mpl->part_target;
+
+		while (mediafile_duration(&mpl->parts) > hold_back)
+			mem_deref(mediafile_next(&mpl->parts));
+
+		mpl->part_started = true;
+	}
+
+	hist_record(&m->hold_back, mediafile_duration(&mpl->parts) * 1e6);
+
+	fetch_hint(mpl);
+	fetch_part(mpl);
+}
+
+
+static void handle_media_sequence(struct media_playlist *mpl, uint64_t seq)
+{
+	/* sequence went backwards: the stream was restarted */
+	if (seq < mpl->seq) {
+		DEBUG_NOTICE("hls: media sequence reset (%llu -> %llu)\n",
+			     mpl->seq, seq);
+		list_flush(&mpl->playlist);
+		list_flush(&mpl->parts);
+		mpl->next_msn  = 0;
+		mpl->next_part = 0;
+		mpl->ts_avail  = 0;
+
+		/* so are the fragment sequence numbers */
+		fmp4_restart(mpl->fmp4);
+		fmp4_restart(mpl->fmp4_part);
+	}
+
+	mpl->seq       = seq;
+	mpl->parse_msn = seq;
+}
+
+
+/* EXT-X-MAP applies to the segments that follow it */
+static void handle_map(struct media_playlist *mpl, const struct pl *val)
+{
+	struct byterange range = {0, 0};
+	struct mediamap *map;
+	struct pl uri, br;
+	int err;
+
+	if (m3u8_attr(val, "URI", &uri) ||
+	    (0 == m3u8_attr(val, "BYTERANGE", &br) &&
+	     m3u8_byterange(&br, 0, &range))) {
+		DEBUG_NOTICE("could not parse map (%r)\n", val);
+		return;
+	}
+
+	/* the same map on every reload */
+	if (mpl->parse_map &&
+	    0 == pl_strcmp(&uri, mpl->parse_map->uri) &&
+	    range.off == mpl->parse_map->range.off &&
+	    range.len == mpl->parse_map->range.len)
+		return;
+
+	err = mediamap_alloc(&map, mpl->pools.sp, &uri, &range);
+	if (err) {
+		re_printf("parse error\n");
+		return;
+	}
+
+	mem_deref(mpl->parse_map);
+	mpl->parse_map = map;
+}
+
+
+/* segment formats, by URI extension */
+static bool is_media(const struct pl *ext)
+{
+	static const char * const extv[] = {"m4s", "mp4", "m4v", "m4a", "ts"};
+	size_t i;
+
+	for (i=0; i<ARRAY_SIZE(extv); i++) {
+
+		if (0 == pl_strcasecmp(ext, extv[i]))
+			return true;
+	}
+
+	return false;
+}
+
+
+static void handle_uri(struct media_playlist *mpl, const struct pl *uri)
+{
+	const struct byterange range = mpl->parse_range;
+	struct mediafile *mf;
+	struct pl ext;
+	uint64_t msn;
+	int err;
+
+	/* every URI line is a segment and has a sequence number */
+	msn = mpl->parse_msn++;
+	mpl->parse_part = 0;
+
+	/* EXT-X-BYTERANGE applies to the next segment only */
+	mpl->parse_range.off = 0;
+	mpl->parse_range.len = 0;
 
-		if (!mediafile_find(&mpl->playlist, filename))
-			mediafile_new(&mpl->playlist, filename, mpl->last_dur);
+	/* in LL-HLS mode only parts are fetched */
+	if (mpl->ll)
+		return;
+
+	/* already known, nothing to allocate */
+	if (msn < mpl->next_msn)
+		return;
+
+	if (m3u8_uri_ext(uri, &ext)) {
+		DEBUG_NOTICE("could not parse line (%r)\n", uri);
+		return;
+	}
+
+	/* without a duration it would not fill the buffer */
+	if (mpl->last_dur <= 0.0) {
+		DEBUG_NOTICE("hls: invalid segment duration: %r (%f)\n",
+			     uri, mpl->last_dur);
+		mpl->next_msn = msn + 1;
+		return;
+	}
+
+	if (is_media(&ext)) {
+
+		err = mediafile_new(&mpl->playlist, &mpl->pools, uri, msn,
+				    mpl->last_dur);
+		if (err) {
+			re_printf("parse error\n");
+			return;
+		}
 
-		mem_deref(filename);
+		mf = list_ledata(list_tail(&mpl->playlist));
+		mf->range = range;
+		mf->map   = mem_ref(mpl->parse_map);
+
+		sched_avail(mpl, mf);
+
+		mpl->next_msn = msn + 1;
 	}
 	else {
 		DEBUG_NOTICE("hls: unknown extension: %r\n", &ext);
 	}
+}
 
- out:
-	if (err)
-		re_printf("parse error\n");
+
+static bool handle_line(const struct m3u8_line *ml, void *arg)
+{
+	struct media_playlist *mpl = arg;
+	struct pl val;
+
+	switch (ml->tag) {
+
+	case M3U8_EXTINF: {
+		/* field: #EXTINF:10.000000, */
+		double dur = m3u8_decimal(&ml->val);
+
+		/* any duration counts, short segments included */
+		mpl->last_dur = dur;
+	}
+		break;
+
+	case M3U8_MEDIA_SEQUENCE:
+		handle_media_sequence(mpl, pl_u64(&ml->val));
+		break;
+
+	case M3U8_TARGETDURATION:
+		if (pl_u32(&ml->val))
+			mpl->target_dur = pl_u32(&ml->val);
+		break;
+
+	case M3U8_ENDLIST:
+		mpl->endlist = true;
+		break;
+
+	case M3U8_PART_INF:
+		if (0 == m3u8_attr(&ml->val, "PART-TARGET", &val)) {
+			mpl->part_target = m3u8_decimal(&val);
+			mpl->ll = client_config(mpl->cli)->llhls;
+		}
+		break;
+
+	case M3U8_SERVER_CONTROL:
+		handle_server_control(mpl, &ml->val);
+		break;
+
+	case M3U8_PART:
+		handle_part(mpl, &ml->val);
+		break;
+
+	case M3U8_PRELOAD_HINT:
+		if (0 == m3u8_attr(&ml->val, "TYPE", &val) &&
+		    0 == pl_strcmp(&val, "PART") &&
+		    0 == m3u8_attr(&ml->val, "URI", &val)) {
+
+			mpl->parse_hint = val;
+
+			/* the part starts at BYTERANGE-START, if set */
+			if (0 == m3u8_attr(&ml->val, "BYTERANGE-START",
+					   &val))
+				mpl->parse_hint_range.off = pl_u64(&val);
+
+			if (0 == m3u8_attr(&ml->val, "BYTERANGE-LENGTH",
+					   &val))
+				mpl->parse_hint_range.len = pl_u64(&val);
+		}
+		break;
+
+	case M3U8_MAP:
+		handle_map(mpl, &ml->val);
+		break;
+
+	case M3U8_BYTERANGE:
+		/* without offset, it follows the previous segment */
+		if (m3u8_byterange(&ml->val, mpl->parse_range_end,
+				   &mpl->parse_range)) {
+			DEBUG_NOTICE("could not parse byte range (%r)\n",
+				     &ml->val);
+			break;
+		}
+
+		mpl->parse_range_end = mpl->parse_range.off +
+			mpl->parse_range.len;
+		break;
+
+	case M3U8_URI:
+		handle_uri(mpl, &ml->val);
+		break;
+
+	default:
+		break;
+	}
+
+	return false;
+}
+
+
+/*
+ * Update the media playlist from the reloaded `m3u8`, without starting
+ * any requests. Returns true if it has changed since the last reload.
+ */
+bool playlist_parse(struct media_playlist *mpl, const struct pl *m3u8)
+{
+	bool changed;
+
+	if (!mpl || !m3u8)
+		return false;
+
+	/* media sequence defaults to 0 if the tag is missing */
+	mpl->parse_msn  = 0;
+	mpl->parse_part = 0;
+	mpl->parse_hint = pl_null;
+	mpl->parse_hint_range.off = 0;
+	mpl->parse_hint_range.len = 0;
+	mpl->parse_range.off = 0;
+	mpl->parse_range.len = 0;
+	mpl->parse_range_end = 0;
+	mpl->parse_part_end  = 0;
+
+	m3u8_parse(m3u8, handle_line, mpl);
+
+	/* drop unplayed segments that have left the live window */
+	mpl->n_skipped += mediafile_evict(&mpl->playlist, mpl->seq);
+
+	if (mpl->ll)
+		handle_parts(mpl);
+
+	changed = mpl->parse_msn != mpl->end_msn ||
+		mpl->parse_part != mpl->end_part;
+
+	mpl->end_msn  = mpl->parse_msn;
+	mpl->end_part = mpl->parse_part;
+
+	return changed;
 }
 
 
-static int handle_hls_playlist(struct media_playlist *mpl,
-			       const struct http_msg *msg)
+/* returns true if the playlist has changed since the last reload */
+static bool handle_hls_playlist(struct media_playlist *mpl,
+				const struct http_msg *msg)
 {
 	struct pl pl;
+	bool changed;
 
 	pl_set_mbuf(&pl, msg->mb);
 
-	while (pl.l > 1) {
+	changed = playlist_parse(mpl, &pl);
 
-		const char *end;
-		struct pl line;
+	start_player(mpl);
 
-		end = pl_strchr(&pl, '\n');
-		if (!end)
-			break;
+	return changed;
+}
 
-		line.p = pl.p;
-		line.l = end - pl.p;
 
-		handle_line(mpl, &line);
+/*
+ * Schedule the next reload (RFC 8216, section 6.3.4): one target
+ * duration after the last reload was started, or half of it if the
+ * playlist has not changed. A playlist with EXT-X-ENDLIST is final.
+ *
+ * With blocking reload (LL-HLS) the next request for the following
+ * part is sent right away and held by the origin until it exists.
+ */
+static void schedule_reload(struct media_playlist *mpl, bool changed,
+			    uint64_t elapsed)
+{
+	uint64_t interval;
+	uint32_t delay = 0;
 
-		pl_advance(&pl, line.l + 1);
+	if (mpl->endlist) {
+		tmr_cancel(&mpl->tmr_reload);
+		return;
 	}
 
-	return 0;
+	if (mpl->ll && mpl->can_block)
+		interval = changed ? 0 : mpl->part_target * 1000;
+	else
+		interval = mpl->target_dur * 1000ULL;
+
+	if (!changed)
+		interval /= 2;
+
+	elapsed /= 1000;  /* [ms] */
+	if (interval > elapsed)
+		delay = (uint32_t)(interval - elapsed);
+
+	tmr_start(&mpl->tmr_reload, delay, timeout_reload, mpl);
 }
 
 
 /* Response: content of media_0.m3u8 */
-static void http_resp_handler(int err, const struct http_msg *msg, void *arg)
+static void http_resp_handler(int err, const struct http_msg *msg,
+			      const struct httpc_timing *t, void *arg)
 {
 	struct media_playlist *pl = arg;
+	bool changed = false;
+
+	if (pl->terminated)
+		return;
+
+	/* a held reload may outlast its timeout, ask again */
+	if (err == ETIMEDOUT && blocking(pl)) {
+		DEBUG_NOTICE("playlist: blocking reload timed out\n");
+		tmr_start(&pl->tmr_reload, 0, timeout_reload, pl);
+		return;
+	}
 
 	if (err) {
 		re_printf("playlist: http error: %m\n", err);
@@ -269,25 +1211,51 @@ static void http_resp_handler(int err, const struct http_msg *msg, void *arg)
 
 	if (msg_ctype_cmp(&msg->ctyp, "application", "vnd.apple.mpegurl")) {
 
-		handle_hls_playlist(pl, msg);
+		struct metrics *m = client_metrics(pl->cli);
+
+		hist_record(&m->playlist_ttfb, t->ttfb);
+		hist_record(&m->playlist, t->total);
+
+		changed = handle_hls_playlist(pl, msg);
 	}
 	else {
 		DEBUG_NOTICE("unknown content-type: %r/%r\n",
 			  &msg->ctyp.type, &msg->ctyp.subtype);
 	}
+
+	/* the playlist may have been closed by the player */
+	if (pl->terminated)
+		return;
+
+	schedule_reload(pl, changed, t->total);
 }
 
 
 static int load_playlist(struct media_playlist *mpl)
 {
+	struct httpc_opt opt;
 	char uri[512];
 	int err;
 
-	re_snprintf(uri, sizeof(uri), "%r%s",
-		    client_path(mpl->cli), mpl->filename);
+	/* blocking reload: ask for the playlist with the next part */
+	if (blocking(mpl)) {
+		re_snprintf(uri, sizeof(uri),
+			    "%s%c_HLS_msn=%llu&_HLS_part=%u",
+			    mpl->uri, strchr(mpl->uri, '?') ? '&' : '?',
+			    mpl->end_msn, mpl->end_part);
+	}
+	else {
+		str_ncpy(uri, mpl->uri, sizeof(uri));
+	}
+
+	opt.kind      = REQ_PLAYLIST;
+	opt.rend      = mpl->rend;
+	opt.range_off = 0;
+	opt.range_len = 0;
+	opt.timeout   = blocking(mpl) ? block_timeout(mpl) : 0;
 
-	err = http_request(&mpl->req, client_http_cli(mpl->cli), "GET", uri,
-			   http_resp_handler, NULL, mpl, NULL);
+	err = httpc_request(&mpl->req, client_httpc(mpl->cli), "GET", uri,
+			    &opt, http_resp_handler, NULL, mpl);
 	if (err) {
 		re_printf("http request failed (%m)\n", err);
 		return err;
@@ -300,10 +1268,40 @@ static int load_playlist(struct media_playlist *mpl)
 static void timeout_reload(void *data)
 {
 	struct media_playlist *pl = data;
+	int err;
 
-	tmr_start(&pl->tmr_reload, RELOAD_INTERVAL*1000, timeout_reload, pl);
+	/* the response handler schedules the next reload */
+	err = load_playlist(pl);
+	if (err)
+		playlist_close(pl, err);
+}
+
+
+/* the URI of a rendition, `filename` is relative to the master playlist */
+static int set_uri(struct media_playlist *mpl, const char *filename)
+{
+	struct pl base, ref, pl;
+	char buf[512];
+	char *uri;
+	int err;
 
-	load_playlist(pl);
+	pl_set_str(&base, client_uri(mpl->cli));
+	pl_set_str(&ref, filename);
+
+	err = m3u8_uri_resolve(buf, sizeof(buf), &base, &ref);
+	if (err)
+		return err;
+
+	pl_set_str(&pl, buf);
+
+	err = strpool_get(mpl->pools.sp, &uri, &pl);
+	if (err)
+		return err;
+
+	mem_deref(mpl->uri);
+	mpl->uri = uri;
+
+	return 0;
 }
 
 
@@ -321,12 +1319,28 @@ int playlist_new(struct media_playlist **plp, const struct client *cli,
 		return ENOMEM;
 
 	pl->cli = cli;
+	pl->pools = *client_pools(cli);
 	pl->last_dur = 10.0;
+	pl->target_dur = TARGET_DURATION;
+	pl->rend = TRACE_NO_REND;
 
-	err = str_dup(&pl->filename, filename);
+	err = set_uri(pl, filename);
 	if (err)
 		goto out;
 
+	if (client_config(cli)->validate) {
+
+		pl->fmp4      = mem_zalloc(sizeof(*pl->fmp4), NULL);
+		pl->fmp4_part = mem_zalloc(sizeof(*pl->fmp4_part), NULL);
+		if (!pl->fmp4 || !pl->fmp4_part) {
+			err = ENOMEM;
+			goto out;
+		}
+
+		fmp4_init(pl->fmp4);
+		fmp4_init(pl->fmp4_part);
+	}
+
 	tmr_init(&pl->tmr_reload);
 
  out:
@@ -341,18 +1355,63 @@ int playlist_new(struct media_playlist **plp, const struct client *cli,
 
 int playlist_start(struct media_playlist *pl)
 {
+	if (!pl)
+		return EINVAL;
+
+	playout_init(&pl->po, time_usec());
+
+	return load_playlist(pl);
+}
+
+
+/*
+ * Continue with another rendition of the same content. Playback goes
+ * on at the next media sequence number, with the same player buffer.
+ */
+int playlist_switch(struct media_playlist *mpl, const char *filename)
+{
+	const struct mediafile *mf;
 	int err;
 
-	if (!pl)
+	if (!mpl || !filename)
 		return EINVAL;
 
-	err = load_playlist(pl);
+	err = set_uri(mpl, filename);
 	if (err)
 		return err;
 
-	tmr_start(&pl->tmr_reload, RELOAD_INTERVAL*1000, timeout_reload, pl);
+	/* the new rendition resumes at the first media not played */
+	mf = mediafile_next(&mpl->playlist);
+	if (mf)
+		mpl->next_msn = mf->msn;
+
+	mf = mediafile_next(&mpl->parts);
+	if (mf)
+		mpl->next_part = part_pos(mf->msn, mf->part);
+
+	/* known segments are those of the old rendition */
+	list_flush(&mpl->playlist);
+	list_flush(&mpl->parts);
+	mpl->end_msn  = 0;
+	mpl->end_part = 0;
+	mpl->parse_part_end = 0;
+
+	/* so is the preload hint, its media must not be buffered */
+	mpl->req_hint = mem_deref(mpl->req_hint);
+	mpl->hint_uri = mem_deref(mpl->hint_uri);
+	mpl->hint_range.off = 0;
+	mpl->hint_range.len = 0;
+
+	/* and its own initialization segment */
+	mpl->map       = mem_deref(mpl->map);
+	mpl->parse_map = mem_deref(mpl->parse_map);
+
+	/* another rendition has its own fragment sequence numbers */
+	fmp4_restart(mpl->fmp4);
+	fmp4_restart(mpl->fmp4_part);
 
-	tmr_start(&pl->tmr_play, 5*1000, tmr_play_handler, pl);
+	tmr_cancel(&mpl->tmr_reload);
+	mpl->req = mem_deref(mpl->req);
 
-	return err;
+	return load_playlist(mpl);
 }
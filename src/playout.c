@@ -0,0 +1,146 @@
+/**
+ * @file playout.c HLS Performance client -- playout buffer model
+ *
+ * Copyright (C) 2019 Creytiv.com
+ */
+
+#include <string.h>
+#include <re.h>
+#include "hlsperf.h"
+
+
+/*
+ * The buffer is filled with the duration of each downloaded segment
+ * and drained in real time once playback has started. Playback
+ * starts when STARTUP_LEVEL seconds are buffered; an empty buffer is
+ * a stall, which ends with the next downloaded segment. Once the last
+ * segment of the content has been added, an empty buffer is the end
+ * of playback and not a stall.
+ *
+ * The level is only updated on events, no timer is needed: the time
+ * the buffer ran dry is computed from the level at the last update.
+ */
+
+
+enum {
+	STARTUP_LEVEL = 1  /* seconds of media needed to start playback */
+};
+
+
+void playout_init(struct playout *po, uint64_t now)
+{
+	if (!po)
+		return;
+
+	memset(po, 0, sizeof(*po));
+
+	po->ts = po->ts_start = now;
+}
+
+
+/* drain the buffer up to `now` [us] */
+void playout_update(struct playout *po, uint64_t now)
+{
+	uint64_t level, elapsed;
+
+	if (!po || !po->playing || po->ts_stall || now <= po->ts)
+		return;
+
+	level   = (uint64_t)(po->level * 1e6);
+	elapsed = now - po->ts;
+
+	if (elapsed < level) {
+		po->level     -= elapsed * 1e-6;
+		po->play_time += elapsed;
+	}
+	else if (po->ended) {
+		/* played to the end of the content */
+		po->level      = 0.0;
+		po->play_time += level;
+		po->playing    = false;
+	}
+	else {
+		/* ran dry in between */
+		po->level      = 0.0;
+		po->play_time += level;
+		po->ts_stall   = po->ts + level;
+		++po->n_stall;
+	}
+
+	po->ts = now;
+}
+
+
+/* add `duration` seconds of downloaded media */
+void playout_add(struct playout *po, double duration, uint64_t now)
+{
+	if (!po)
+		return;
+
+	playout_update(po, now);
+
+	po->level += duration;
+	po->ts = now;
+
+	if (!po->startup) {
+
+		if (po->level >= STARTUP_LEVEL) {
+			po->playing = true;
+			po->startup = now - po->ts_start;
+		}
+	}
+	else if (po->ts_stall) {
+
+		po->stall_time += now - po->ts_stall;
+		po->ts_stall = 0;
+	}
+}
+
+
+/* all media of the content has been added, nothing more will follow */
+void playout_end(struct playout *po, uint64_t now)
+{
+	if (!po || po->ended)
+		return;
+
+	playout_update(po, now);
+
+	if (po->ts_stall) {
+		po->stall_time += now - po->ts_stall;
+		po->ts_stall = 0;
+	}
+
+	po->ended = true;
+}
+
+
+/* end of the session, an ongoing stall is accounted for */
+void playout_close(struct playout *po, uint64_t now)
+{
+	if (!po)
+		return;
+
+	playout_update(po, now);
+
+	if (po->ts_stall) {
+		po->stall_time += now - po->ts_stall;
+		po->ts_stall = 0;
+	}
+
+	/* freeze the counters */
+	po->playing = false;
+}
+
+
+/* stall time relative to the watch time, 0.0 - 1.0 */
+double playout_rebuffer_ratio(const struct playout *po)
+{
+	uint64_t total;
+
+	if (!po)
+		return 0.0;
+
+	total = po->play_time + po->stall_time;
+
+	return total ? (double)po->stall_time / (double)total : 0.0;
+}
@@ -0,0 +1,396 @@
+/**
+ * @file profile.c HLS Performance client -- load profile
+ *
+ * Copyright (C) 2019 Creytiv.com
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <math.h>
+#include <re.h>
+#include "hlsperf.h"
+
+
+/*
+ * Arrival-rate profile: a list of phases "RATE[-RATE]/SECONDS",
+ * separated by commas or newlines. The rate is in new sessions per
+ * second and is ramped linearly if two rates are given, e.g.
+ *
+ *   0-500/60,500/300,5000/10,200/600
+ *
+ * is a one minute ramp, a plateau, a ten second spike and a lower
+ * plateau. "@file" reads the phases from a file, '#' starts a comment.
+ */
+
+
+enum {
+	MAX_PHASES = 256,
+};
+
+
+static void destructor(void *data)
+{
+	struct profile *prof = data;
+
+	mem_deref(prof->phasev);
+}
+
+
+static int phase_decode(struct phase *ph, const char *s, const char **end)
+{
+	char *e;
+
+	ph->rate0 = strtod(s, &e);
+	if (e == s)
+		return EINVAL;
+
+	ph->rate1 = ph->rate0;
+
+	if (*e == '-') {
+		s = e + 1;
+		ph->rate1 = strtod(s, &e);
+		if (e == s)
+			return EINVAL;
+	}
+
+	if (*e != '/')
+		return EINVAL;
+
+	s = e + 1;
+	ph->dur = strtod(s, &e);
+	if (e == s)
+		return EINVAL;
+
+	if (ph->rate0 < 0 || ph->rate1 < 0 || ph->dur < 0)
+		return EINVAL;
+
+	*end = e;
+
+	return 0;
+}
+
+
+static int phases_decode(struct profile *prof, const char *str)
+{
+	const char *p = str;
+
+	while (*p) {
+
+		struct phase *ph;
+		int err;
+
+		/* separators, white space and comments */
+		if (*p == ',' || *p == ' ' || *p == '\t' ||
+		    *p == '\r' || *p == '\n') {
+			++p;
+			continue;
+		}
+		if (*p == '#') {
+			p += strcspn(p, "\n");
+			continue;
+		}
+
+		if (prof->phasec >= MAX_PHASES)
+			return E2BIG;
+
+		ph = &prof->phasev[prof->phasec];
+
+		err = phase_decode(ph, p, &p);
+		if (err) {
+			re_fprintf(stderr, "profile: invalid phase at '%s'\n",
+				   p);
+			return err;
+		}
+
+		prof->dur += ph->dur;
+		++prof->phasec;
+	}
+
+	return prof->phasec ? 0 : EINVAL;
+}
+
+
+static int file_read(char **strp, const char *path)
+{
+	FILE *f;
+	long sz;
+	char *str;
+	int err = 0;
+
+	f = fopen(path, "r");
+	if (!f)
+		return errno;
+
+	if (fseek(f, 0, SEEK_END) || (sz = ftell(f)) < 0 ||
+	    fseek(f, 0, SEEK_SET)) {
+		err = errno;
+		goto out;
+	}
+
+	str = mem_alloc(sz + 1, NULL);
+	if (!str) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	str[fread(str, 1, sz, f)] = '\0';
+
+	*strp = str;
+
+ out:
+	fclose(f);
+
+	return err;
+}
+
+
+/* Decode a profile from the command line, or a file with "@file" */
+int profile_decode(struct profile **profp, const char *str)
+{
+	struct profile *prof;
+	char *buf = NULL;
+	int err;
+
+	if (!profp || !str)
+		return EINVAL;
+
+	if (str[0] == '@') {
+		err = file_read(&buf, str + 1);
+		if (err) {
+			re_fprintf(stderr, "profile: %s: %m\n", str + 1, err);
+			return err;
+		}
+
+		str = buf;
+	}
+
+	prof = mem_zalloc(sizeof(*prof), destructor);
+	if (!prof) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	prof->phasev = mem_zalloc(MAX_PHASES * sizeof(*prof->phasev), NULL);
+	if (!prof->phasev) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err = phases_decode(prof, str);
+
+ out:
+	if (err)
+		mem_deref(prof);
+	else
+		*profp = prof;
+
+	mem_deref(buf);
+
+	return err;
+}
+
+
+/* Print the phases in the format of profile_decode() */
+int profile_print(struct re_printf *pf, const struct profile *prof)
+{
+	size_t i;
+	int err = 0;
+
+	if (!prof)
+		return 0;
+
+	for (i=0; i<prof->phasec; i++) {
+
+		const struct phase *ph = &prof->phasev[i];
+
+		err |= re_hprintf(pf, "%s%f-%f/%f", i ? "," : "",
+				  ph->rate0, ph->rate1, ph->dur);
+	}
+
+	return err;
+}
+
+
+/* multiply all rates by `factor`, e.g. to split the load */
+void profile_scale(struct profile *prof, double factor)
+{
+	size_t i;
+
+	if (!prof)
+		return;
+
+	for (i=0; i<prof->phasec; i++) {
+		prof->phasev[i].rate0 *= factor;
+		prof->phasev[i].rate1 *= factor;
+	}
+}
+
+
+/*
+ * The phase at time `t` [s] since the start, and its start time.
+ * Returns NULL at the end of the profile.
+ */
+const struct phase *profile_phase(const struct profile *prof, double t,
+				  double *t0)
+{
+	double start = 0.0;
+	size_t i;
+
+	if (!prof)
+		return NULL;
+
+	for (i=0; i<prof->phasec; i++) {
+
+		const struct phase *ph = &prof->phasev[i];
+
+		if (t < start + ph->dur) {
+			if (t0)
+				*t0 = start;
+			return ph;
+		}
+
+		start += ph->dur;
+	}
+
+	return NULL;
+}
+
+
+/* arrival rate at `t` [s] into the phase */
+double phase_rate(const struct phase *ph, double t)
+{
+	if (!ph || ph->dur <= 0.0)
+		return 0.0;
+
+	return ph->rate0 + (ph->rate1 - ph->rate0) * t / ph->dur;
+}
+
+
+/* uniform in (0, 1) */
+double rand_uniform(void)
+{
+	return (rand_u32() + 0.5) / 4294967296.0;
+}
+
+
+/*
+ * Distribution of a random variable, e.g. the session lifetime:
+ * "fixed:600", "uniform:60-600", "exp:300" (mean) or
+ * "lognormal:300,1.2" (median, sigma)
+ */
+int dist_decode(struct dist *d, const char *str)
+{
+	const char *colon;
+	char *e;
+
+	if (!d || !str)
+		return EINVAL;
+
+	memset(d, 0, sizeof(*d));
+
+	colon = strchr(str, ':');
+	if (!colon)
+		return EINVAL;
+
+	if (0 == strncmp(str, "fixed:", 6))
+		d->type = DIST_FIXED;
+	else if (0 == strncmp(str, "uniform:", 8))
+		d->type = DIST_UNIFORM;
+	else if (0 == strncmp(str, "exp:", 4))
+		d->type = DIST_EXP;
+	else if (0 == strncmp(str, "lognormal:", 10))
+		d->type = DIST_LOGNORMAL;
+	else
+		return EINVAL;
+
+	d->a = strtod(colon + 1, &e);
+	if (e == colon + 1 || d->a < 0)
+		return EINVAL;
+
+	d->b = d->a;
+
+	switch (d->type) {
+
+	case DIST_UNIFORM:
+	case DIST_LOGNORMAL:
+		if (*e != (d->type == DIST_UNIFORM ? '-' : ','))
+			return EINVAL;
+
+		str = e + 1;
+		d->b = strtod(str, &e);
+		if (e == str || d->b < 0)
+			return EINVAL;
+		break;
+
+	default:
+		break;
+	}
+
+	return *e ? EINVAL : 0;
+}
+
+
+const char *dist_name(enum dist_type type)
+{
+	switch (type) {
+
+	case DIST_FIXED:     return "fixed";
+	case DIST_UNIFORM:   return "uniform";
+	case DIST_EXP:       return "exp";
+	case DIST_LOGNORMAL: return "lognormal";
+	default:             return NULL;
+	}
+}
+
+
+/* Print the distribution in the format of dist_decode() */
+int dist_print(struct re_printf *pf, const struct dist *d)
+{
+	if (!d || d->type == DIST_NONE)
+		return 0;
+
+	switch (d->type) {
+
+	case DIST_UNIFORM:
+		return re_hprintf(pf, "uniform:%f-%f", d->a, d->b);
+
+	case DIST_LOGNORMAL:
+		return re_hprintf(pf, "lognormal:%f,%f", d->a, d->b);
+
+	default:
+		return re_hprintf(pf, "%s:%f", dist_name(d->type), d->a);
+	}
+}
+
+
+double dist_sample(const struct dist *d)
+{
+	double u, v;
+
+	if (!d)
+		return 0.0;
+
+	switch (d->type) {
+
+	case DIST_FIXED:
+		return d->a;
+
+	case DIST_UNIFORM:
+		return d->a + (d->b - d->a) * rand_uniform();
+
+	case DIST_EXP:
+		return -d->a * log(rand_uniform());
+
+	case DIST_LOGNORMAL:
+		/* Box-Muller */
+		u = rand_uniform();
+		v = rand_uniform();
+		return d->a * exp(d->b * sqrt(-2 * log(u)) *
+				  cos(2 * M_PI * v));
+
+	default:
+		return 0.0;
+	}
+}
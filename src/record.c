@@ -0,0 +1,310 @@
+/**
+ * @file record.c HLS Performance client -- per-request records
+ *
+ * Copyright (C) 2019 Creytiv.com
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <pthread.h>
+#include <re.h>
+#include "hlsperf.h"
+
+
+#define DEBUG_MODULE "hlsperf"
+#define DEBUG_LEVEL 6
+#include <re_dbg.h>
+
+
+/*
+ * Every completed request can be written as one CSV line. The event
+ * loops only copy a fixed size record into a per-worker buffer. Full
+ * buffers are handed to a writer thread, which formats and writes
+ * them, and hands them back for reuse.
+ *
+ * The workers never wait for the disk: when MAX_PENDING buffers are
+ * queued, further records are dropped and counted.
+ */
+
+
+enum {
+	RECBUF_SIZE = 1024,  /* records per buffer */
+	MAX_PENDING = 64,    /* full buffers queued for the writer */
+	MAX_FREE    = 16,    /* empty buffers kept for reuse */
+};
+
+struct recbuf {
+	struct le le;
+	unsigned n;
+	struct reqrec v[RECBUF_SIZE];
+};
+
+struct recorder {
+	pthread_t tid;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	FILE *f;
+	struct list fullq;
+	struct list freeq;
+	unsigned n_full;
+	uint64_t n_drop;
+	uint64_t ts_start;     /* [us] */
+	bool run;
+};
+
+struct recwriter {
+	struct recorder *rec;
+	struct recbuf *buf;
+	unsigned ix;
+};
+
+
+static void recorder_destructor(void *data)
+{
+	struct recorder *rec = data;
+
+	if (rec->run) {
+		pthread_mutex_lock(&rec->mutex);
+		rec->run = false;
+		pthread_cond_signal(&rec->cond);
+		pthread_mutex_unlock(&rec->mutex);
+
+		pthread_join(rec->tid, NULL);
+	}
+
+	list_flush(&rec->fullq);
+	list_flush(&rec->freeq);
+
+	if (rec->f)
+		(void)fclose(rec->f);
+
+	pthread_cond_destroy(&rec->cond);
+	pthread_mutex_destroy(&rec->mutex);
+}
+
+
+static void write_buf(struct recorder *rec, const struct recbuf *buf)
+{
+	unsigned i;
+
+	for (i=0; i<buf->n; i++) {
+
+		const struct reqrec *r = &buf->v[i];
+		char rend[8] = "";
+
+		if (r->rend != TRACE_NO_REND)
+			(void)re_snprintf(rend, sizeof(rend), "%u", r->rend);
+
+		(void)fprintf(rec->f, "%llu,%u,%u,%s,%s,%s,%u,%d,%llu,%llu,"
+			      "%llu,%llu,%llu,%d\n",
+			      (unsigned long long)(r->ts - rec->ts_start),
+			      r->worker, r->sess, req_kind_name(r->kind), rend,
+			      r->name, r->scode, r->err,
+			      (unsigned long long)r->bytes,
+			      (unsigned long long)r->dns,
+			      (unsigned long long)r->connect,
+			      (unsigned long long)r->ttfb,
+			      (unsigned long long)r->total, r->reused);
+	}
+}
+
+
+static void *writer_thread(void *arg)
+{
+	struct recorder *rec = arg;
+
+	pthread_mutex_lock(&rec->mutex);
+
+	for (;;) {
+		struct recbuf *buf;
+
+		while (!rec->fullq.head && rec->run)
+			pthread_cond_wait(&rec->cond, &rec->mutex);
+
+		/* stopped and drained */
+		if (!rec->fullq.head)
+			break;
+
+		buf = rec->fullq.head->data;
+		list_unlink(&buf->le);
+		--rec->n_full;
+
+		pthread_mutex_unlock(&rec->mutex);
+
+		write_buf(rec, buf);
+		buf->n = 0;
+
+		pthread_mutex_lock(&rec->mutex);
+
+		if (list_count(&rec->freeq) < MAX_FREE)
+			list_append(&rec->freeq, &buf->le, buf);
+		else
+			mem_deref(buf);
+	}
+
+	pthread_mutex_unlock(&rec->mutex);
+
+	(void)fflush(rec->f);
+
+	return NULL;
+}
+
+
+/* Write per-request records to the file `path`, as CSV */
+int recorder_alloc(struct recorder **recp, const char *path)
+{
+	struct recorder *rec;
+	int err;
+
+	if (!recp || !path)
+		return EINVAL;
+
+	rec = mem_zalloc(sizeof(*rec), recorder_destructor);
+	if (!rec)
+		return ENOMEM;
+
+	pthread_mutex_init(&rec->mutex, NULL);
+	pthread_cond_init(&rec->cond, NULL);
+
+	rec->ts_start = time_usec();
+
+	rec->f = fopen(path, "w");
+	if (!rec->f) {
+		err = errno;
+		goto out;
+	}
+
+	(void)fprintf(rec->f, "ts_us,worker,session,kind,rendition,name,"
+		      "status,error,bytes,dns_us,connect_us,ttfb_us,total_us,"
+		      "reused\n");
+
+	rec->run = true;
+
+	err = pthread_create(&rec->tid, NULL, writer_thread, rec);
+	if (err)
+		rec->run = false;
+
+ out:
+	if (err)
+		mem_deref(rec);
+	else
+		*recp = rec;
+
+	return err;
+}
+
+
+/* records dropped because the writer could not keep up */
+uint64_t recorder_dropped(struct recorder *rec)
+{
+	uint64_t n;
+
+	if (!rec)
+		return 0;
+
+	pthread_mutex_lock(&rec->mutex);
+	n = rec->n_drop;
+	pthread_mutex_unlock(&rec->mutex);
+
+	return n;
+}
+
+
+/*
+ * Queue a full buffer for the writer and get an empty one. The buffer
+ * is reused for the next records if the queue is full.
+ */
+static struct recbuf *handover(struct recorder *rec, struct recbuf *buf)
+{
+	pthread_mutex_lock(&rec->mutex);
+
+	if (buf && buf->n) {
+
+		if (rec->n_full < MAX_PENDING) {
+			list_append(&rec->fullq, &buf->le, buf);
+			++rec->n_full;
+			pthread_cond_signal(&rec->cond);
+			buf = NULL;
+		}
+		else {
+			rec->n_drop += buf->n;
+			buf->n = 0;
+		}
+	}
+
+	if (!buf && rec->freeq.head) {
+		buf = rec->freeq.head->data;
+		list_unlink(&buf->le);
+	}
+
+	pthread_mutex_unlock(&rec->mutex);
+
+	if (!buf)
+		buf = mem_zalloc(sizeof(*buf), NULL);
+
+	return buf;
+}
+
+
+static void recwriter_destructor(void *data)
+{
+	struct recwriter *rw = data;
+
+	recwriter_flush(rw);
+	mem_deref(rw->buf);
+}
+
+
+/*
+ * Per-worker side of the recorder, used from the worker thread only.
+ * The recorder must outlive its writers.
+ */
+int recwriter_alloc(struct recwriter **rwp, struct recorder *rec,
+		    unsigned ix)
+{
+	struct recwriter *rw;
+
+	if (!rwp || !rec)
+		return EINVAL;
+
+	rw = mem_zalloc(sizeof(*rw), recwriter_destructor);
+	if (!rw)
+		return ENOMEM;
+
+	rw->rec = rec;
+	rw->ix  = ix;
+
+	*rwp = rw;
+
+	return 0;
+}
+
+
+void recwriter_add(struct recwriter *rw, const struct reqrec *r)
+{
+	if (!rw || !r)
+		return;
+
+	if (!rw->buf) {
+		rw->buf = handover(rw->rec, NULL);
+		if (!rw->buf)
+			return;
+	}
+
+	rw->buf->v[rw->buf->n] = *r;
+	rw->buf->v[rw->buf->n].worker = rw->ix;
+
+	if (++rw->buf->n == RECBUF_SIZE)
+		rw->buf = handover(rw->rec, rw->buf);
+}
+
+
+/* hand the records written so far to the writer */
+void recwriter_flush(struct recwriter *rw)
+{
+	if (!rw || !rw->buf || !rw->buf->n)
+		return;
+
+	rw->buf = handover(rw->rec, rw->buf);
+}
@@ -0,0 +1,269 @@
+/**
+ * @file rendition.c HLS Performance client -- master playlist renditions
+ *
+ * Copyright (C) 2019 Creytiv.com
+ */
+
+#include <string.h>
+#include <re.h>
+#include "hlsperf.h"
+
+
+#define DEBUG_MODULE "hlsperf"
+#define DEBUG_LEVEL 6
+#include <re_dbg.h>
+
+
+/*
+ * The master playlist is decoded in two passes. The first pass counts
+ * the renditions and the size of their strings, the second fills a
+ * single allocation holding the table and all strings.
+ */
+
+
+struct decoder {
+	struct rendtab *rt;
+	char *str;               /* next free string byte, NULL when sizing */
+	size_t strsz;
+	struct pl stream_inf;    /* attributes waiting for the URI line */
+	bool pending;
+};
+
+
+static const char *str_add(struct decoder *dec, const struct pl *pl)
+{
+	char *s;
+
+	if (!pl_isset(pl))
+		return NULL;
+
+	if (!dec->str) {
+		dec->strsz += pl->l + 1;
+		return NULL;
+	}
+
+	s = dec->str;
+	memcpy(s, pl->p, pl->l);
+	s[pl->l] = '\0';
+
+	dec->str += pl->l + 1;
+
+	return s;
+}
+
+
+static struct rendition *rend_add(struct decoder *dec)
+{
+	if (!dec->rt->rendv) {
+		++dec->rt->rendc;
+		return NULL;
+	}
+
+	return &dec->rt->rendv[dec->rt->rendc++];
+}
+
+
+static void attr_get(const struct pl *val, const char *name, struct pl *pl)
+{
+	if (m3u8_attr(val, name, pl))
+		*pl = pl_null;
+}
+
+
+static void add_variant(struct decoder *dec, const struct pl *uri)
+{
+	struct rendition *r = rend_add(dec);
+	struct pl bw, res, codecs, audio;
+	const char *x;
+
+	attr_get(&dec->stream_inf, "BANDWIDTH",  &bw);
+	attr_get(&dec->stream_inf, "RESOLUTION", &res);
+	attr_get(&dec->stream_inf, "CODECS",     &codecs);
+	attr_get(&dec->stream_inf, "AUDIO",      &audio);
+
+	if (!r) {
+		str_add(dec, uri);
+		str_add(dec, &codecs);
+		str_add(dec, &audio);
+		return;
+	}
+
+	r->type      = RENDITION_VARIANT;
+	r->uri       = str_add(dec, uri);
+	r->codecs    = str_add(dec, &codecs);
+	r->group     = str_add(dec, &audio);
+	r->bandwidth = pl_u32(&bw);
+
+	/* RESOLUTION=1280x720 */
+	x = pl_isset(&res) ? memchr(res.p, 'x', res.l) : NULL;
+	if (x) {
+		struct pl w, h;
+
+		w.p = res.p;
+		w.l = x - res.p;
+		h.p = x + 1;
+		h.l = res.p + res.l - h.p;
+
+		r->width  = pl_u32(&w);
+		r->height = pl_u32(&h);
+	}
+}
+
+
+static void add_media(struct decoder *dec, const struct pl *val)
+{
+	struct rendition *r;
+	struct pl type, uri, group, dflt;
+
+	attr_get(val, "TYPE",     &type);
+	attr_get(val, "URI",      &uri);
+	attr_get(val, "GROUP-ID", &group);
+	attr_get(val, "DEFAULT",  &dflt);
+
+	/* without URI the media is in the variant stream */
+	if (!pl_isset(&uri))
+		return;
+
+	r = rend_add(dec);
+	if (!r) {
+		str_add(dec, &uri);
+		str_add(dec, &group);
+		return;
+	}
+
+	if (0 == pl_strcmp(&type, "AUDIO"))
+		r->type = RENDITION_AUDIO;
+	else if (0 == pl_strcmp(&type, "SUBTITLES"))
+		r->type = RENDITION_SUBTITLES;
+	else
+		r->type = RENDITION_VIDEO;
+
+	r->uri   = str_add(dec, &uri);
+	r->group = str_add(dec, &group);
+	r->dflt  = 0 == pl_strcmp(&dflt, "YES");
+}
+
+
+static bool handle_line(const struct m3u8_line *ml, void *arg)
+{
+	struct decoder *dec = arg;
+
+	switch (ml->tag) {
+
+	case M3U8_STREAM_INF:
+		dec->stream_inf = ml->val;
+		dec->pending = true;
+		break;
+
+	case M3U8_MEDIA:
+		add_media(dec, &ml->val);
+		break;
+
+	case M3U8_URI:
+		if (dec->pending)
+			add_variant(dec, &ml->val);
+		else
+			DEBUG_NOTICE("rendition: URI without"
+				     " EXT-X-STREAM-INF (%r)\n", &ml->val);
+
+		dec->pending = false;
+		break;
+
+	default:
+		break;
+	}
+
+	return false;
+}
+
+
+/* Decode the renditions of a master playlist */
+int rendtab_decode(struct rendtab **rtp, const struct pl *m3u8)
+{
+	struct decoder dec;
+	struct rendtab sz;
+	struct rendtab *rt;
+	size_t tabsz;
+
+	if (!rtp || !m3u8)
+		return EINVAL;
+
+	/* pass 1: size */
+	memset(&dec, 0, sizeof(dec));
+	memset(&sz, 0, sizeof(sz));
+	dec.rt = &sz;
+
+	m3u8_parse(m3u8, handle_line, &dec);
+
+	if (!sz.rendc)
+		return ENOENT;
+
+	tabsz = sz.rendc * sizeof(*rt->rendv);
+
+	rt = mem_zalloc(sizeof(*rt) + tabsz + dec.strsz, NULL);
+	if (!rt)
+		return ENOMEM;
+
+	/* pass 2: fill */
+	rt->rendv = (struct rendition *)(void *)(rt + 1);
+
+	memset(&dec, 0, sizeof(dec));
+	dec.rt  = rt;
+	dec.str = (char *)rt->rendv + tabsz;
+
+	m3u8_parse(m3u8, handle_line, &dec);
+
+	*rtp = rt;
+
+	return 0;
+}
+
+
+/*
+ * The rendition of `type` in `group`: the DEFAULT=YES one, or the
+ * first one listed.
+ */
+const struct rendition *rendtab_group(const struct rendtab *rt,
+				      enum rendition_type type,
+				      const char *group)
+{
+	const struct rendition *first = NULL;
+	uint32_t i;
+
+	if (!rt || !group)
+		return NULL;
+
+	for (i=0; i<rt->rendc; i++) {
+
+		const struct rendition *r = &rt->rendv[i];
+
+		if (r->type != type || str_cmp(r->group, group))
+			continue;
+
+		if (r->dflt)
+			return r;
+
+		if (!first)
+			first = r;
+	}
+
+	return first;
+}
+
+
+/* the first variant stream listed, where players start */
+const struct rendition *rendtab_variant(const struct rendtab *rt)
+{
+	uint32_t i;
+
+	if (!rt)
+		return NULL;
+
+	for (i=0; i<rt->rendc; i++) {
+
+		if (rt->rendv[i].type == RENDITION_VARIANT)
+			return &rt->rendv[i];
+	}
+
+	return NULL;
+}
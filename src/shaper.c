@@ -0,0 +1,343 @@
+/**
+ * @file shaper.c HLS Performance client -- link speed emulation
+ *
+ * Copyright (C) 2019 Creytiv.com
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <re.h>
+#include "hlsperf.h"
+
+
+/*
+ * Each shaped session has a token bucket for the bytes it receives.
+ * When the bucket is empty the session stops reading its sockets, the
+ * receive buffer fills up and TCP closes the window towards the
+ * server, like a slow access link would.
+ *
+ * Sockets waiting for tokens are kept on a timer wheel, one per
+ * worker: a single timer ticks every TICK ms while any socket is
+ * waiting, and wakes the sockets of the slot that has come due.
+ */
+
+
+enum {
+	TICK      = 5,        /* wheel resolution [ms] */
+	TICK_US   = TICK * 1000,
+	SLOTS     = 256,      /* wheel size, covers 1.28 s */
+	BURST_MS  = 50,       /* bucket depth, in time at the link rate */
+	BURST_MIN = 16384,    /* [bytes] */
+};
+
+struct shaper {
+	struct list slotv[SLOTS];
+	struct tmr tmr;
+	uint64_t tick;            /* next tick to run, in ticks */
+	unsigned n;               /* sockets waiting */
+};
+
+struct link_preset {
+	const char *name;
+	uint32_t kbps;
+};
+
+/* typical downlink rates */
+static const struct link_preset presetv[] = {
+	{"3g",       1600},
+	{"4g",      12000},
+	{"5g",     100000},
+	{"dsl",      8000},
+	{"cable",   50000},
+	{"fibre",  100000},
+	{"fiber",  100000},
+	{"none",        0},
+};
+
+
+/*
+ * Link speed mix, "SHARE%SPEED,...": SPEED is a preset name or a rate
+ * in kbit/s, with an "M" suffix for Mbit/s, e.g. "30%3g,50%4g,20%fibre"
+ * or "50%5M,50%2500". The shares are relative.
+ */
+int linkmix_decode(struct linkmix *lm, const char *str)
+{
+	const char *p;
+	char *e;
+
+	if (!lm || !str)
+		return EINVAL;
+
+	memset(lm, 0, sizeof(*lm));
+
+	for (p = str; *p; ) {
+
+		double share, kbps = -1;
+		size_t i;
+
+		if (lm->n == LINKMIX_MAX)
+			return E2BIG;
+
+		share = strtod(p, &e);
+		if (e == p || *e != '%' || share <= 0)
+			return EINVAL;
+
+		p = e + 1;
+
+		for (i=0; i<ARRAY_SIZE(presetv); i++) {
+
+			const size_t len = strlen(presetv[i].name);
+
+			if (0 == strncmp(p, presetv[i].name, len) &&
+			    (p[len] == ',' || p[len] == '\0')) {
+
+				kbps = presetv[i].kbps;
+				p += len;
+				break;
+			}
+		}
+
+		if (kbps < 0) {
+
+			kbps = strtod(p, &e);
+			if (e == p || kbps <= 0)
+				return EINVAL;
+
+			if (*e == 'M') {
+				kbps *= 1000;
+				++e;
+			}
+
+			p = e;
+		}
+
+		if (kbps > UINT32_MAX)
+			return ERANGE;
+
+		lm->sharev[lm->n] = share;
+		lm->kbpsv[lm->n]  = (uint32_t)kbps;
+		++lm->n;
+
+		if (*p == ',')
+			++p;
+		else if (*p)
+			return EINVAL;
+	}
+
+	return lm->n ? 0 : EINVAL;
+}
+
+
+/* Print the mix in the format of linkmix_decode() */
+int linkmix_print(struct re_printf *pf, const struct linkmix *lm)
+{
+	unsigned i;
+	int err = 0;
+
+	if (!lm)
+		return 0;
+
+	for (i=0; i<lm->n; i++) {
+
+		err |= re_hprintf(pf, "%s%f%c%u", i ? "," : "",
+				  lm->sharev[i], '%', lm->kbpsv[i]);
+	}
+
+	return err;
+}
+
+
+/* The link speed of a new session [kbit/s], 0 for unlimited */
+uint32_t linkmix_sample(const struct linkmix *lm)
+{
+	double total = 0.0, u;
+	unsigned i;
+
+	if (!lm || !lm->n)
+		return 0;
+
+	for (i=0; i<lm->n; i++)
+		total += lm->sharev[i];
+
+	u = rand_uniform() * total;
+
+	for (i=0; i<lm->n - 1; i++) {
+
+		if (u < lm->sharev[i])
+			break;
+
+		u -= lm->sharev[i];
+	}
+
+	return lm->kbpsv[i];
+}
+
+
+/* A full bucket for `kbps` kbit/s, 0 for unlimited */
+void bucket_init(struct bucket *b, uint32_t kbps, uint64_t now)
+{
+	if (!b)
+		return;
+
+	b->rate   = kbps * 125.0;
+	b->burst  = max(b->rate * BURST_MS / 1000, (double)BURST_MIN);
+	b->tokens = b->burst;
+	b->ts     = now;
+}
+
+
+/* Refill the bucket, returns the bytes that may be received now */
+size_t bucket_avail(struct bucket *b, uint64_t now)
+{
+	if (!b || !b->rate)
+		return SIZE_MAX;
+
+	if (now > b->ts) {
+		b->tokens = min(b->tokens + (now - b->ts) * b->rate * 1e-6,
+				b->burst);
+		b->ts = now;
+	}
+
+	return b->tokens > 0 ? (size_t)b->tokens : 0;
+}
+
+
+void bucket_take(struct bucket *b, size_t n)
+{
+	if (!b || !b->rate)
+		return;
+
+	b->tokens -= n;
+}
+
+
+/* time until `n` bytes may be received [us] */
+uint64_t bucket_delay(const struct bucket *b, size_t n)
+{
+	if (!b || !b->rate || b->tokens >= n)
+		return 0;
+
+	return (uint64_t)((n - b->tokens) * 1e6 / b->rate) + 1;
+}
+
+
+static void destructor(void *data)
+{
+	struct shaper *sh = data;
+	unsigned i;
+
+	tmr_cancel(&sh->tmr);
+
+	/* the sockets still waiting are not woken */
+	for (i=0; i<SLOTS; i++) {
+
+		while (sh->slotv[i].head)
+			list_unlink(sh->slotv[i].head);
+	}
+}
+
+
+static void slot_insert(struct shaper *sh, struct shaper_wait *sw)
+{
+	uint64_t t = sw->ts_wake / TICK_US;
+
+	/* past due goes to the next tick, far ahead to the last slot */
+	t = max(t, sh->tick);
+	t = min(t, sh->tick + SLOTS - 2);
+
+	list_append(&sh->slotv[t % SLOTS], &sw->le, sw);
+}
+
+
+static void tick_handler(void *arg)
+{
+	struct shaper *sh = arg;
+	const uint64_t end = time_usec() / TICK_US;
+	unsigned k;
+
+	for (k=0; k<SLOTS && sh->tick <= end; k++) {
+
+		struct list *slot = &sh->slotv[sh->tick % SLOTS];
+		struct le *le;
+
+		++sh->tick;
+
+		while ((le = list_head(slot))) {
+
+			struct shaper_wait *sw = le->data;
+
+			list_unlink(le);
+
+			/* beyond the wheel, wait for another turn */
+			if (sw->ts_wake / TICK_US > end) {
+				slot_insert(sh, sw);
+				continue;
+			}
+
+			--sh->n;
+			sw->wakeh(sw->arg);
+		}
+	}
+
+	sh->tick = max(sh->tick, end + 1);
+
+	if (sh->n)
+		tmr_start(&sh->tmr, TICK, tick_handler, sh);
+}
+
+
+int shaper_alloc(struct shaper **shp)
+{
+	struct shaper *sh;
+
+	if (!shp)
+		return EINVAL;
+
+	sh = mem_zalloc(sizeof(*sh), destructor);
+	if (!sh)
+		return ENOMEM;
+
+	tmr_init(&sh->tmr);
+
+	*shp = sh;
+
+	return 0;
+}
+
+
+/*
+ * Call `wakeh` at `ts_wake` [us], within one tick. `sw` is owned by
+ * the caller and must be cancelled before it is released.
+ */
+void shaper_wait(struct shaper *sh, struct shaper_wait *sw, uint64_t ts_wake,
+		 shaper_wake_h *wakeh, void *arg)
+{
+	if (!sh || !sw || !wakeh)
+		return;
+
+	shaper_cancel(sw);
+
+	/* idle until now, the wheel starts at the current tick */
+	if (!sh->n) {
+		sh->tick = time_usec() / TICK_US;
+		tmr_start(&sh->tmr, TICK, tick_handler, sh);
+	}
+
+	sw->sh      = sh;
+	sw->ts_wake = ts_wake;
+	sw->wakeh   = wakeh;
+	sw->arg     = arg;
+
+	slot_insert(sh, sw);
+	++sh->n;
+}
+
+
+void shaper_cancel(struct shaper_wait *sw)
+{
+	if (!sw || !sw->le.list)
+		return;
+
+	list_unlink(&sw->le);
+	--sw->sh->n;
+}
@@ -4,8 +4,29 @@
 # Copyright (C) 2010 Creytiv.com
 #
 
+SRCS	+= abr.c
+SRCS	+= agent.c
 SRCS	+= client.c
+SRCS	+= controller.c
+SRCS	+= dnscache.c
+SRCS	+= fmp4.c
+SRCS	+= hist.c
+SRCS	+= httpc.c
+SRCS	+= link.c
+SRCS	+= m3u8.c
 SRCS	+= main.c
 SRCS	+= mediafile.c
+SRCS	+= metrics.c
+SRCS	+= objpool.c
+SRCS	+= output.c
 SRCS	+= playlist.c
+SRCS	+= playout.c
+SRCS	+= profile.c
+SRCS	+= record.c
+SRCS	+= rendition.c
+SRCS	+= shaper.c
+SRCS	+= strpool.c
+SRCS	+= summary.c
+SRCS	+= trace.c
 SRCS	+= util.c
+SRCS	+= worker.c
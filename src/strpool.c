@@ -0,0 +1,125 @@
+/**
+ * @file strpool.c HLS Performance client -- shared strings
+ *
+ * Copyright (C) 2019 Creytiv.com
+ */
+
+#include <string.h>
+#include <re.h>
+#include "hlsperf.h"
+
+
+/*
+ * Sessions watching the same stream see the same segment names, so
+ * a worker keeps one copy of each name and the sessions share it by
+ * reference. Each string is a mem object with its hash element stored
+ * behind the characters; it leaves the pool when the last reference
+ * is gone. Strings from the pool must not be modified.
+ */
+
+
+struct strpool {
+	struct hash *ht;
+};
+
+
+/* offset of the hash element, behind the characters */
+static size_t le_offset(size_t len)
+{
+	return (len + 1 + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+}
+
+
+static void str_destructor(void *data)
+{
+	char *str = data;
+
+	hash_unlink((struct le *)(void *)(str + le_offset(strlen(str))));
+}
+
+
+static void destructor(void *data)
+{
+	struct strpool *sp = data;
+
+	/* strings still referenced stay valid, outside of the pool */
+	hash_clear(sp->ht);
+	mem_deref(sp->ht);
+}
+
+
+static bool cmp_handler(struct le *le, void *arg)
+{
+	const struct pl *pl = arg;
+
+	return 0 == pl_strcmp(pl, le->data);
+}
+
+
+int strpool_alloc(struct strpool **spp, uint32_t bsize)
+{
+	struct strpool *sp;
+	int err;
+
+	if (!spp || !bsize)
+		return EINVAL;
+
+	sp = mem_zalloc(sizeof(*sp), destructor);
+	if (!sp)
+		return ENOMEM;
+
+	err = hash_alloc(&sp->ht, bsize);
+	if (err)
+		mem_deref(sp);
+	else
+		*spp = sp;
+
+	return err;
+}
+
+
+/*
+ * Get a reference to the string `pl`, added to the pool if it is not
+ * there yet. Without a pool, it is a copy. Release it with mem_deref().
+ */
+int strpool_get(struct strpool *sp, char **strp, const struct pl *pl)
+{
+	struct le *le;
+	uint32_t key;
+	size_t off;
+	char *str;
+
+	if (!strp || !pl_isset(pl))
+		return EINVAL;
+
+	/* the length is taken from the string when it is released */
+	if (!sp || memchr(pl->p, '\0', pl->l))
+		return pl_strdup(strp, pl);
+
+	key = hash_joaat((const uint8_t *)pl->p, pl->l);
+
+	le = hash_lookup(sp->ht, key, cmp_handler, (void *)pl);
+	if (le) {
+		*strp = mem_ref(le->data);
+		return 0;
+	}
+
+	off = le_offset(pl->l);
+
+	str = mem_alloc(off + sizeof(struct le), str_destructor);
+	if (!str)
+		return ENOMEM;
+
+	memcpy(str, pl->p, pl->l);
+	str[pl->l] = '\0';
+
+	le = (struct le *)(void *)(str + off);
+	memset(le, 0, sizeof(*le));
+
+	hash_append(sp->ht, key, le, str);
+
+	*strp = str;
+
+	return 0;
+}
+
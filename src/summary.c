@@ -0,0 +1,253 @@
+/**
+ * @file summary.c HLS Performance client -- per-session summary
+ *
+ * Copyright (C) 2019 Creytiv.com
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <re.h>
+#include "hlsperf.h"
+
+
+/*
+ * Statistics kept in the sessions themselves, collected when a
+ * session ends or at the end of the run. Summaries of different
+ * workers are merged by the main thread.
+ */
+
+
+enum {
+	VTIME_MAX = 1024  /* variants in a decoded summary */
+};
+
+
+void summary_init(struct summary *sum)
+{
+	if (!sum)
+		return;
+
+	memset(sum, 0, sizeof(*sum));
+	hist_init(&sum->rebuffer);
+}
+
+
+void summary_reset(struct summary *sum)
+{
+	if (!sum)
+		return;
+
+	mem_deref(sum->vtv);
+	summary_init(sum);
+}
+
+
+static void vtime_add(struct summary *sum, const struct vtime *add)
+{
+	size_t k;
+
+	for (k=0; k<sum->vtc; k++) {
+		if (sum->vtv[k].bandwidth == add->bandwidth)
+			break;
+	}
+
+	if (k == sum->vtc) {
+		const size_t sz = (k+1) * sizeof(struct vtime);
+		struct vtime *vtv;
+
+		if (sum->vtv)
+			vtv = mem_realloc(sum->vtv, sz);
+		else
+			vtv = mem_alloc(sz, NULL);
+		if (!vtv)
+			return;
+
+		/* keep the order by bandwidth */
+		while (k > 0 && vtv[k-1].bandwidth > add->bandwidth) {
+			vtv[k] = vtv[k-1];
+			--k;
+		}
+
+		vtv[k] = *add;
+		vtv[k].time = 0;
+
+		sum->vtv = vtv;
+		++sum->vtc;
+	}
+
+	sum->vtv[k].time += add->time;
+}
+
+
+static void summary_add_abr(struct summary *sum, const struct abr *abr)
+{
+	const struct rendition *r;
+	struct vtime vt;
+	uint32_t i;
+
+	for (i=0; (r = abr_variant(abr, i, &vt.time)); i++) {
+
+		vt.bandwidth = r->bandwidth;
+		vt.width     = r->width;
+		vt.height    = r->height;
+
+		vtime_add(sum, &vt);
+	}
+}
+
+
+/*
+ * NOTE: the session must not be running, i.e. it has been closed or
+ *       its worker has been stopped
+ */
+void summary_add_client(struct summary *sum, const struct client *cli)
+{
+	struct media_playlist * const *mplv;
+	uint32_t n_stall = 0;
+	double ratio = 0.0;
+	size_t j;
+
+	if (!sum || !cli)
+		return;
+
+	++sum->n_sess;
+
+	if (!client_connected(cli))
+		return;
+
+	++sum->n_connected;
+
+	mplv = client_playlists(cli);
+
+	for (j=0; j<MEDIA_TYPES; j++) {
+
+		const struct playout *po;
+
+		if (!mplv[j])
+			continue;
+
+		po = &mplv[j]->po;
+
+		sum->n_skipped  += mplv[j]->n_skipped;
+		sum->play_time  += po->play_time;
+		sum->stall_time += po->stall_time;
+
+		/* the session stalls if any of its playlists stalls */
+		ratio = max(ratio, playout_rebuffer_ratio(po));
+		n_stall += po->n_stall;
+	}
+
+	hist_record(&sum->rebuffer, (uint64_t)(ratio * 1e5));
+
+	if (n_stall)
+		++sum->n_stalled;
+
+	summary_add_abr(sum, client_abr(cli));
+}
+
+
+void summary_merge(struct summary *dst, const struct summary *src)
+{
+	size_t i;
+
+	if (!dst || !src)
+		return;
+
+	hist_merge(&dst->rebuffer, &src->rebuffer);
+
+	for (i=0; i<src->vtc; i++)
+		vtime_add(dst, &src->vtv[i]);
+
+	dst->n_sess      += src->n_sess;
+	dst->n_connected += src->n_connected;
+	dst->n_stalled   += src->n_stalled;
+	dst->n_skipped   += src->n_skipped;
+	dst->play_time   += src->play_time;
+	dst->stall_time  += src->stall_time;
+	dst->mem_bytes   += src->mem_bytes;
+	dst->mem_sess    += src->mem_sess;
+}
+
+
+/*
+ * Append the summary to `mb`, to be sent to another process of the
+ * same build. The variants are appended after the fixed fields.
+ */
+int summary_encode(struct mbuf *mb, const struct summary *sum)
+{
+	size_t i;
+	int err;
+
+	if (!mb || !sum)
+		return EINVAL;
+
+	err  = mbuf_write_mem(mb, (uint8_t *)&sum->rebuffer,
+			      sizeof(sum->rebuffer));
+	err |= mbuf_write_u64(mb, sum->n_sess);
+	err |= mbuf_write_u64(mb, sum->n_connected);
+	err |= mbuf_write_u64(mb, sum->n_stalled);
+	err |= mbuf_write_u64(mb, sum->n_skipped);
+	err |= mbuf_write_u64(mb, sum->play_time);
+	err |= mbuf_write_u64(mb, sum->stall_time);
+	err |= mbuf_write_u64(mb, sum->mem_bytes);
+	err |= mbuf_write_u64(mb, sum->mem_sess);
+	err |= mbuf_write_u32(mb, (uint32_t)sum->vtc);
+
+	for (i=0; i<sum->vtc; i++) {
+
+		const struct vtime *vt = &sum->vtv[i];
+
+		err |= mbuf_write_u32(mb, vt->bandwidth);
+		err |= mbuf_write_u16(mb, vt->width);
+		err |= mbuf_write_u16(mb, vt->height);
+		err |= mbuf_write_u64(mb, vt->time);
+	}
+
+	return err;
+}
+
+
+/* Decode a summary written by summary_encode() and add it to `sum` */
+int summary_decode(struct summary *sum, struct mbuf *mb)
+{
+	static struct summary dec;
+	struct vtime vt;
+	uint32_t i, vtc;
+
+	if (!sum || !mb)
+		return EINVAL;
+
+	if (mbuf_get_left(mb) < sizeof(dec.rebuffer) + 8*8 + 4)
+		return EBADMSG;
+
+	summary_init(&dec);
+
+	(void)mbuf_read_mem(mb, (uint8_t *)&dec.rebuffer,
+			    sizeof(dec.rebuffer));
+	dec.n_sess      = (size_t)mbuf_read_u64(mb);
+	dec.n_connected = (size_t)mbuf_read_u64(mb);
+	dec.n_stalled   = (size_t)mbuf_read_u64(mb);
+	dec.n_skipped   = mbuf_read_u64(mb);
+	dec.play_time   = mbuf_read_u64(mb);
+	dec.stall_time  = mbuf_read_u64(mb);
+	dec.mem_bytes   = mbuf_read_u64(mb);
+	dec.mem_sess    = mbuf_read_u64(mb);
+	vtc             = mbuf_read_u32(mb);
+
+	if (vtc > VTIME_MAX || mbuf_get_left(mb) < (uint64_t)vtc * 16)
+		return EBADMSG;
+
+	summary_merge(sum, &dec);
+
+	for (i=0; i<vtc; i++) {
+
+		vt.bandwidth = mbuf_read_u32(mb);
+		vt.width     = mbuf_read_u16(mb);
+		vt.height    = mbuf_read_u16(mb);
+		vt.time      = mbuf_read_u64(mb);
+
+		vtime_add(sum, &vt);
+	}
+
+	return 0;
+}
@@ -0,0 +1,142 @@
+/**
+ * @file trace.c HLS Performance client -- binary request trace
+ *
+ * Copyright (C) 2019 Creytiv.com
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <re.h>
+#include "hlsperf.h"
+
+
+/*
+ * Each worker writes fixed size records into a ring buffer, which is
+ * a file mapped into memory. The worker is the only writer, so no
+ * locks are needed: the record is written first, then the head is
+ * advanced with release semantics, so that a reader of a live trace
+ * never sees a head pointing to an unwritten record.
+ *
+ * When the ring is full the oldest records are overwritten. The file
+ * can be decoded with hlsperf-trace.
+ */
+
+
+struct trace {
+	struct trace_hdr *hdr;
+	struct trace_rec *recv;
+	size_t size;              /* of the mapping */
+};
+
+
+static const char * const kindv[] = {
+	"other", "master", "playlist", "segment", "part", "hint", "init"
+};
+
+
+static void destructor(void *data)
+{
+	struct trace *tr = data;
+
+	if (tr->hdr) {
+		(void)msync(tr->hdr, tr->size, MS_ASYNC);
+		(void)munmap(tr->hdr, tr->size);
+	}
+}
+
+
+/*
+ * Create the trace file "<prefix>.<ix>" holding the last `capacity`
+ * records, which must be a power of two
+ */
+int trace_alloc(struct trace **trp, const char *prefix, unsigned ix,
+		uint64_t capacity)
+{
+	struct trace *tr;
+	char path[256];
+	void *p;
+	int fd, err = 0;
+
+	if (!trp || !prefix || !capacity || (capacity & (capacity - 1)))
+		return EINVAL;
+
+	if (re_snprintf(path, sizeof(path), "%s.%u", prefix, ix) < 0)
+		return ENAMETOOLONG;
+
+	tr = mem_zalloc(sizeof(*tr), destructor);
+	if (!tr)
+		return ENOMEM;
+
+	tr->size = sizeof(*tr->hdr) + capacity * sizeof(*tr->recv);
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		err = errno;
+		goto out;
+	}
+
+	if (ftruncate(fd, tr->size)) {
+		err = errno;
+		goto out;
+	}
+
+	p = mmap(NULL, tr->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED) {
+		err = errno;
+		goto out;
+	}
+
+	tr->hdr  = p;
+	tr->recv = (struct trace_rec *)(tr->hdr + 1);
+
+	memcpy(tr->hdr->magic, TRACE_MAGIC, sizeof(tr->hdr->magic));
+	tr->hdr->version    = TRACE_VERSION;
+	tr->hdr->recsize    = sizeof(*tr->recv);
+	tr->hdr->capacity   = capacity;
+	tr->hdr->ts_start   = time_usec();
+	tr->hdr->wall_start = time_wall();
+	tr->hdr->worker     = ix;
+
+ out:
+	if (fd >= 0)
+		(void)close(fd);
+
+	if (err)
+		mem_deref(tr);
+	else
+		*trp = tr;
+
+	return err;
+}
+
+
+/* append a record, from the worker thread only */
+void trace_add(struct trace *tr, const struct trace_rec *r)
+{
+	uint64_t head;
+
+	if (!tr || !r)
+		return;
+
+	head = tr->hdr->head;
+
+	tr->recv[head & (tr->hdr->capacity - 1)] = *r;
+
+	__atomic_store_n(&tr->hdr->head, head + 1, __ATOMIC_RELEASE);
+}
+
+
+/* trace start time [us], record times are relative to it */
+uint64_t trace_start(const struct trace *tr)
+{
+	return tr ? tr->hdr->ts_start : 0;
+}
+
+
+const char *req_kind_name(enum req_kind kind)
+{
+	return kind < ARRAY_SIZE(kindv) ? kindv[kind] : "?";
+}
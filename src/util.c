@@ -5,8 +5,11 @@
  */
 
 #include <string.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <getopt.h>
+#include <unistd.h>
+#include <time.h>
 #include <re.h>
 #include "hlsperf.h"
 
@@ -39,3 +42,90 @@ int dns_init(struct dnsc **dnsc)
  out:
 	return err;
 }
+
+
+/* monotonic time in microseconds */
+uint64_t time_usec(void)
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+/* monotonic time in nanoseconds, for short intervals */
+uint64_t time_nsec(void)
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/* wall clock time in microseconds, comparable between hosts */
+uint64_t time_wall(void)
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_REALTIME, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+
+/* resident set size of the process in bytes, 0 if not known */
+static uint64_t mem_rss(void)
+{
+	unsigned long size, rss;
+	FILE *f;
+	int n;
+
+	f = fopen("/proc/self/statm", "r");
+	if (!f)
+		return 0;
+
+	n = fscanf(f, "%lu %lu", &size, &rss);
+	(void)fclose(f);
+
+	if (n != 2)
+		return 0;
+
+	return (uint64_t)rss * sysconf(_SC_PAGESIZE);
+}
+
+
+/* Start measuring, before any session is allocated */
+void memusage_init(struct memusage *mu)
+{
+	if (!mu)
+		return;
+
+	memset(mu, 0, sizeof(*mu));
+	mu->base = mem_rss();
+}
+
+
+/*
+ * Sample the memory in use with `n_active` sessions. The sample with
+ * the most sessions is kept.
+ */
+void memusage_sample(struct memusage *mu, int64_t n_active)
+{
+	uint64_t rss;
+
+	if (!mu || !mu->base || n_active <= 0 ||
+	    (uint64_t)n_active <= mu->n_sess)
+		return;
+
+	rss = mem_rss();
+	if (rss < mu->base)
+		return;
+
+	mu->bytes  = rss - mu->base;
+	mu->n_sess = n_active;
+}
@@ -0,0 +1,511 @@
+/**
+ * @file worker.c HLS Performance client -- worker threads
+ *
+ * Copyright (C) 2019 Creytiv.com
+ */
+
+#include <string.h>
+#include <signal.h>
+#include <math.h>
+#include <pthread.h>
+#include <re.h>
+#include "hlsperf.h"
+
+
+#define DEBUG_MODULE "hlsperf"
+#define DEBUG_LEVEL 6
+#include <re_dbg.h>
+
+
+enum {
+	TRACE_RECORDS = 1 << 20,  /* trace ring size, 64 MiB per worker */
+	STRPOOL_SIZE  = 1024,     /* hash buckets of the shared names */
+	MF_POOL_SIZE  = 8192,     /* released segments and parts kept */
+	REQ_POOL_SIZE = 1024,     /* released HTTP requests kept */
+};
+
+
+/*
+ * A worker owns one event loop (re_main) and hosts a share of the
+ * sessions. All sessions of a worker run in the worker thread, so
+ * no locking is needed between them.
+ *
+ * Sessions are either started all at once (-n), or arrive as an
+ * open-loop Poisson process following the load profile, each worker
+ * taking 1/workers of the rate. Sessions with a lifetime are removed
+ * when it expires and their statistics are kept in the summary. The
+ * sessions still running when the worker stops are added to the
+ * summary and released in the worker thread.
+ */
+struct worker {
+	pthread_t tid;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct mqueue *mqueue;
+	struct dnscache *dc;
+	struct pools pools;         /* shared by the sessions */
+	struct shaper *sh;          /* link speed shaping, optional */
+	struct recwriter *rw;       /* per-request records, optional */
+	struct trace *tr;           /* binary trace, optional */
+	struct metrics metrics;
+	struct summary summary;     /* sessions that have ended */
+	const struct config *cfg;
+	const char *uri;
+	struct list sessl;
+	uint32_t num_sess;
+	uint32_t n_sess;            /* sessions started, numbers them */
+	struct tmr tmr_arrival;
+	uint64_t ts_start;          /* [ms] jiffies */
+	double t_arrival;           /* next arrival, since start [s] */
+	unsigned ix;
+	bool running;
+	bool ready;
+	int err;
+};
+
+struct session {
+	struct le le;
+	struct worker *w;
+	struct client *cli;
+	struct tmr tmr_life;
+};
+
+
+static void destructor(void *data)
+{
+	struct worker *w = data;
+
+	if (w->running)
+		pthread_join(w->tid, NULL);
+
+	mem_deref(w->pools.sp);
+	summary_reset(&w->summary);
+	mem_deref(w->rw);
+	mem_deref(w->tr);
+
+	pthread_cond_destroy(&w->cond);
+	pthread_mutex_destroy(&w->mutex);
+}
+
+
+static void session_destructor(void *data)
+{
+	struct session *sess = data;
+
+	tmr_cancel(&sess->tmr_life);
+	list_unlink(&sess->le);
+	mem_deref(sess->cli);
+}
+
+
+static void tmr_life_handler(void *arg);
+
+
+/*
+ * The session has stopped on its own. Called from the HTTP callback
+ * of the client, so it is released from a timer.
+ */
+static void client_error_handler(struct client *cli, int err, void *arg)
+{
+	struct session *sess = arg;
+	(void)cli;
+
+	if (err) {
+		DEBUG_WARNING("worker %u: client error (%m)\n",
+			      sess->w->ix, err);
+	}
+
+	tmr_start(&sess->tmr_life, 0, tmr_life_handler, sess);
+}
+
+
+/*
+ * Close the remaining sessions, keep their statistics in the summary
+ * and release them.
+ *
+ * note: sessions must be released from worker thread context, their
+ *       timers and sockets belong to the event loop of the worker
+ */
+static void sessions_close(struct worker *w)
+{
+	struct le *le;
+
+	tmr_cancel(&w->tmr_arrival);
+
+	while ((le = w->sessl.head)) {
+		struct session *sess = le->data;
+
+		client_close(sess->cli, 0);
+		summary_add_client(&w->summary, sess->cli);
+
+		mem_deref(sess);
+	}
+}
+
+
+static void mqueue_handler(int id, void *data, void *arg)
+{
+	struct worker *w = arg;
+	(void)id;
+	(void)data;
+
+	sessions_close(w);
+
+	re_cancel();
+}
+
+
+/* the session has reached the end of its lifetime, or has stopped */
+static void tmr_life_handler(void *arg)
+{
+	struct session *sess = arg;
+	struct worker *w = sess->w;
+
+	client_close(sess->cli, 0);
+
+	summary_add_client(&w->summary, sess->cli);
+	STAT_ADD(w->metrics.n_depart, 1);
+
+	mem_deref(sess);
+}
+
+
+static int session_add(struct worker *w, uint32_t delay)
+{
+	struct session *sess;
+	struct reqlog log;
+	int err;
+
+	sess = mem_zalloc(sizeof(*sess), session_destructor);
+	if (!sess)
+		return ENOMEM;
+
+	sess->w = w;
+	tmr_init(&sess->tmr_life);
+	list_append(&w->sessl, &sess->le, sess);
+
+	log.rw   = w->rw;
+	log.tr   = w->tr;
+	log.sess = w->n_sess++;
+
+	err = client_alloc(&sess->cli, w->cfg, w->uri, w->dc, &w->pools,
+			   &w->metrics, &log, client_error_handler, sess);
+	if (err)
+		goto out;
+
+	if (w->sh) {
+		httpc_set_rate(client_httpc(sess->cli), w->sh,
+			       linkmix_sample(&w->cfg->links));
+	}
+
+	err = client_start(sess->cli, delay);
+	if (err)
+		goto out;
+
+	if (w->cfg->lifetime.type != DIST_NONE) {
+
+		const double life = dist_sample(&w->cfg->lifetime);
+
+		tmr_start(&sess->tmr_life, delay + (uint64_t)(life * 1000),
+			  tmr_life_handler, sess);
+	}
+
+	STAT_ADD(w->metrics.n_arrival, 1);
+
+ out:
+	if (err)
+		mem_deref(sess);
+
+	return err;
+}
+
+
+static void tmr_arrival_handler(void *arg);
+
+
+/*
+ * Schedule the next candidate arrival. The rate may change within a
+ * phase, so candidates are drawn at the peak rate of the phase and
+ * thinned to the actual rate when they are due.
+ */
+static void arrival_next(struct worker *w)
+{
+	const struct phase *ph;
+	uint64_t due, now;
+	double t0, rmax, t;
+
+	for (;;) {
+		ph = profile_phase(w->cfg->profile, w->t_arrival, &t0);
+		if (!ph)
+			return;  /* end of profile */
+
+		rmax = max(ph->rate0, ph->rate1) / w->cfg->workers;
+
+		t = w->t_arrival;
+		if (rmax > 0.0)
+			t -= log(rand_uniform()) / rmax;
+
+		if (rmax > 0.0 && t < t0 + ph->dur) {
+			w->t_arrival = t;
+			break;
+		}
+
+		/* none in this phase, continue with the next one */
+		w->t_arrival = t0 + ph->dur;
+	}
+
+	due = w->ts_start + (uint64_t)(w->t_arrival * 1000);
+	now = tmr_jiffies();
+
+	tmr_start(&w->tmr_arrival, due > now ? due - now : 0,
+		  tmr_arrival_handler, w);
+}
+
+
+static void tmr_arrival_handler(void *arg)
+{
+	struct worker *w = arg;
+	const struct phase *ph;
+	double t0, rate, rmax;
+	int err;
+
+	ph = profile_phase(w->cfg->profile, w->t_arrival, &t0);
+	if (ph) {
+		rmax = max(ph->rate0, ph->rate1);
+		rate = phase_rate(ph, w->t_arrival - t0);
+
+		/* thinning: accept with probability rate/rmax */
+		if (rand_uniform() * rmax < rate) {
+
+			err = session_add(w, 0);
+			if (err) {
+				DEBUG_WARNING("worker %u: session (%m)\n",
+					      w->ix, err);
+			}
+		}
+	}
+
+	arrival_next(w);
+}
+
+
+static void set_ready(struct worker *w, int err)
+{
+	pthread_mutex_lock(&w->mutex);
+	w->ready = true;
+	w->err = err;
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->mutex);
+}
+
+
+static void *worker_thread_handler(void *arg)
+{
+	struct worker *w = arg;
+	sigset_t set;
+	uint32_t i;
+	int err;
+
+	/* signals are handled by the main thread only */
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGTERM);
+	sigaddset(&set, SIGALRM);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	err = re_thread_init();
+	if (err) {
+		DEBUG_WARNING("re thread init: %m\n", err);
+		set_ready(w, err);
+		return NULL;
+	}
+
+	/* must be set per thread.
+	 * must be done after re_thread_init()
+	 */
+	err = fd_setsize(65536);
+	if (err) {
+		re_fprintf(stderr, "fd_setsize error: %m\n", err);
+		goto out;
+	}
+
+	err = mqueue_alloc(&w->mqueue, mqueue_handler, w);
+	if (err)
+		goto out;
+
+	/* one resolver cache for all sessions of the worker */
+	err = dnscache_alloc(&w->dc, &w->metrics);
+	if (err)
+		goto out;
+
+	err = strpool_alloc(&w->pools.sp, STRPOOL_SIZE);
+	if (err)
+		goto out;
+
+	/* released objects are reused by the next session that needs one */
+	err = mediafile_pool_alloc(&w->pools.mf, MF_POOL_SIZE);
+	if (err)
+		goto out;
+
+	err = httpc_reqpool_alloc(&w->pools.req, REQ_POOL_SIZE);
+	if (err)
+		goto out;
+
+	/* one timer for all shaped sockets of the worker */
+	if (w->cfg->links.n) {
+		err = shaper_alloc(&w->sh);
+		if (err)
+			goto out;
+	}
+
+	if (w->cfg->rec) {
+		err = recwriter_alloc(&w->rw, w->cfg->rec, w->ix);
+		if (err)
+			goto out;
+	}
+
+	if (w->cfg->trace) {
+		err = trace_alloc(&w->tr, w->cfg->trace, w->ix, TRACE_RECORDS);
+		if (err) {
+			re_fprintf(stderr, "trace %s.%u: %m\n",
+				   w->cfg->trace, w->ix, err);
+			goto out;
+		}
+	}
+
+	w->ts_start = tmr_jiffies();
+
+	if (w->cfg->profile) {
+		arrival_next(w);
+	}
+	else {
+		/* spread the start over 10 seconds */
+		for (i=0; i<w->num_sess; i++) {
+
+			err = session_add(w, rand_u32() % 10000);
+			if (err)
+				goto out;
+		}
+	}
+
+	set_ready(w, 0);
+
+	/* run the main loop now */
+	re_main(NULL);
+
+ out:
+	sessions_close(w);
+
+	if (err)
+		set_ready(w, err);
+
+	/* cleanup
+	 *
+	 * note: anything that owns a struct tmr or an fd_listen() socket
+	 *       must be released here, before re_thread_close() frees the
+	 *       timer list and the fd table of the thread
+	 */
+	recwriter_flush(w->rw);
+	w->sh        = mem_deref(w->sh);
+	w->pools.req = mem_deref(w->pools.req);
+	w->pools.mf  = mem_deref(w->pools.mf);
+	w->dc        = mem_deref(w->dc);
+	w->mqueue    = mem_deref(w->mqueue);
+
+	re_thread_close();
+
+	return NULL;
+}
+
+
+/*
+ * Start a worker thread hosting `num_sess` sessions, or a share of
+ * the sessions of the load profile. Returns when the sessions have
+ * been allocated.
+ */
+int worker_alloc(struct worker **wp, unsigned ix, const struct config *cfg,
+		 const char *uri, uint32_t num_sess)
+{
+	struct worker *w;
+	int err;
+
+	if (!wp || !cfg || !uri)
+		return EINVAL;
+
+	w = mem_zalloc(sizeof(*w), destructor);
+	if (!w)
+		return ENOMEM;
+
+	pthread_mutex_init(&w->mutex, NULL);
+	pthread_cond_init(&w->cond, NULL);
+
+	metrics_init(&w->metrics);
+
+	w->cfg = cfg;
+	w->uri = uri;
+	w->ix  = ix;
+	w->num_sess = num_sess;
+
+	summary_init(&w->summary);
+	tmr_init(&w->tmr_arrival);
+
+	err = pthread_create(&w->tid, NULL, worker_thread_handler, w);
+	if (err)
+		goto out;
+
+	w->running = true;
+
+	pthread_mutex_lock(&w->mutex);
+	while (!w->ready)
+		pthread_cond_wait(&w->cond, &w->mutex);
+	err = w->err;
+	pthread_mutex_unlock(&w->mutex);
+
+ out:
+	if (err)
+		mem_deref(w);
+	else
+		*wp = w;
+
+	return err;
+}
+
+
+/*
+ * Stop the event loop of the worker and wait for the thread to end
+ *
+ * NOTE: may be called from any thread
+ */
+void worker_stop(struct worker *w)
+{
+	if (!w || !w->running)
+		return;
+
+	mqueue_push(w->mqueue, 0, NULL);
+
+	pthread_join(w->tid, NULL);
+	w->running = false;
+}
+
+
+/*
+ * Add the sessions of the worker to `sum`
+ *
+ * NOTE: the worker must be stopped
+ */
+void worker_summary(const struct worker *w, struct summary *sum)
+{
+	if (!w || !sum)
+		return;
+
+	summary_merge(sum, &w->summary);
+}
+
+
+/*
+ * NOTE: use metrics_load() to read while the worker is running
+ */
+const struct metrics *worker_metrics(const struct worker *w)
+{
+	return w ? &w->metrics : NULL;
+}
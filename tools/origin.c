@@ -0,0 +1,1018 @@
+/**
+ * @file origin.c HLS Performance client -- synthetic origin
+ *
+ * Copyright (C) 2019 Creytiv.com
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <math.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <re.h>
+#include "../src/hlsperf.h"
+
+
+/*
+ * A live HLS origin that is never the bottleneck of a benchmark: the
+ * playlists are generated, the segments are fixed-size fMP4 fragments
+ * of one sample of zeros and everything is served from memory.
+ *
+ *   <any path>/master.m3u8     master playlist, one variant per rendition
+ *   <any path>/vN.m3u8         media playlist of rendition N
+ *   <any path>/vN_MSN.m4s      segment MSN of rendition N
+ *
+ * All names are relative to the directory of the master playlist. With
+ * -D each rendition has its own directory instead, vN/vN.m3u8, and its
+ * segments are only served from there, vN/vN_MSN.m4s, as the names in
+ * a media playlist are relative to the media playlist. The live window
+ * slides by one segment every segment duration, and starts full. Each
+ * thread has its own listening socket (SO_REUSEPORT) and event loop,
+ * and its own cache of the current media playlists.
+ */
+
+
+#define CTYPE_M3U8 "application/vnd.apple.mpegurl"
+
+enum {
+	MAX_RENDITIONS = 8,
+	MAX_THREADS    = 64,
+	MAX_REQ_SIZE   = 8192,
+	RECV_SIZE      = 16384,
+	MOOF_SIZE      = 72,      /* moof, mfhd, traf, tfhd and trun */
+	FRAG_HDR       = MOOF_SIZE + 8,  /* ... and the mdat header */
+};
+
+/* rendition ladder, the bandwidth is a multiple of the base */
+static const struct {
+	uint16_t width;
+	uint16_t height;
+	double factor;
+} ladder[MAX_RENDITIONS] = {
+	{ 416,  234,  1.0},
+	{ 640,  360,  2.0},
+	{ 768,  432,  3.5},
+	{ 960,  540,  5.0},
+	{1280,  720,  8.0},
+	{1920, 1080, 12.0},
+	{2560, 1440, 20.0},
+	{3840, 2160, 32.0},
+};
+
+struct origin {
+	double seg_dur;           /* [s] */
+	unsigned rendc;
+	unsigned window;          /* segments in the live window */
+	uint32_t bandwidth;       /* of the first rendition [bit/s] */
+	size_t seg_size;          /* fixed size, 0 for the bandwidth */
+	bool subdirs;             /* a directory per rendition */
+	uint64_t ts_start;        /* [us] */
+	size_t segv[MAX_RENDITIONS];   /* segment size per rendition */
+	uint8_t *zero;            /* body of all segments */
+	struct mbuf *master;
+};
+
+/* media playlist, shared by the responses while being sent */
+struct plcache {
+	struct mbuf *mb;
+	uint64_t msn;             /* last segment in the window */
+};
+
+struct server {
+	pthread_t tid;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct mqueue *mqueue;
+	const struct origin *org;
+	struct list connl;
+	struct plcache plv[MAX_RENDITIONS];
+	int lfd;
+	uint64_t n_req;
+	uint64_t n_bytes;
+	bool running;
+	bool ready;
+	int err;
+};
+
+struct conn {
+	struct le le;
+	struct server *srv;
+	struct mbuf *rx;
+	struct mbuf *hdr;         /* response header being sent */
+	struct mbuf *body;        /* referenced body, playlists only */
+	const uint8_t *bodyp;
+	size_t body_len;
+	size_t body_off;
+	int fd;
+	bool close;               /* after this response */
+	bool busy;                /* a response is being sent */
+};
+
+
+static struct origin org;
+
+
+static void conn_fd_handler(int flags, void *arg);
+
+
+static void usage(void)
+{
+	re_fprintf(stderr,
+		   "usage: hlsperf-origin [-a addr] [-p port] [-d secs]"
+		   " [-r renditions] [-l window]\n"
+		   "                      [-b kbit/s] [-s bytes]"
+		   " [-w threads] [-D]\n"
+		   "\t-a <addr>     Listen address (default: 127.0.0.1)\n"
+		   "\t-p <port>     Listen port (default: 8080)\n"
+		   "\t-d <secs>     Segment duration (default: 2)\n"
+		   "\t-r <num>      Renditions, 1-%u (default: 3)\n"
+		   "\t-l <num>      Segments in the live window"
+		   " (default: 6)\n"
+		   "\t-b <kbit/s>   Bandwidth of the first rendition"
+		   " (default: 400)\n"
+		   "\t-s <bytes>    Fixed segment size for all renditions\n"
+		   "\t-w <num>      Threads (default: 1)\n"
+		   "\t-D            A directory per rendition\n",
+		   MAX_RENDITIONS);
+}
+
+
+/* last segment of the live window */
+static uint64_t live_msn(const struct origin *o)
+{
+	const uint64_t t = time_usec() - o->ts_start;
+
+	return o->window - 1 + (uint64_t)(t * .000001 / o->seg_dur);
+}
+
+
+static int master_alloc(struct origin *o)
+{
+	unsigned i;
+	int err = 0;
+
+	o->master = mbuf_alloc(1024);
+	if (!o->master)
+		return ENOMEM;
+
+	err |= mbuf_printf(o->master, "#EXTM3U\n#EXT-X-VERSION:6\n");
+
+	for (i=0; i<o->rendc; i++) {
+
+		err |= mbuf_printf(o->master,
+				   "#EXT-X-STREAM-INF:BANDWIDTH=%u,"
+				   "RESOLUTION=%ux%u,"
+				   "CODECS=\"avc1.64001f,mp4a.40.2\"\n",
+				   (uint32_t)(o->bandwidth * ladder[i].factor),
+				   ladder[i].width, ladder[i].height);
+
+		if (o->subdirs)
+			err |= mbuf_printf(o->master, "v%u/", i);
+
+		err |= mbuf_printf(o->master, "v%u.m3u8\n", i);
+	}
+
+	return err;
+}
+
+
+static struct mbuf *playlist_get(struct server *srv, unsigned rend)
+{
+	const struct origin *o = srv->org;
+	struct plcache *pc = &srv->plv[rend];
+	const uint64_t msn = live_msn(o);
+	uint64_t first, i;
+	struct mbuf *mb;
+	int err;
+
+	if (pc->mb && pc->msn == msn)
+		return pc->mb;
+
+	mb = mbuf_alloc(256 + o->window * 32);
+	if (!mb)
+		return NULL;
+
+	first = msn + 1 - o->window;
+
+	err = mbuf_printf(mb, "#EXTM3U\n#EXT-X-VERSION:6\n"
+			  "#EXT-X-TARGETDURATION:%u\n"
+			  "#EXT-X-MEDIA-SEQUENCE:%llu\n",
+			  (unsigned)ceil(o->seg_dur), first);
+
+	for (i=first; i<=msn; i++) {
+		err |= mbuf_printf(mb, "#EXTINF:%.3f,\nv%u_%llu.m4s\n",
+				   o->seg_dur, rend, i);
+	}
+
+	if (err) {
+		mem_deref(mb);
+		return NULL;
+	}
+
+	/* responses being sent keep a reference */
+	mem_deref(pc->mb);
+	pc->mb  = mb;
+	pc->msn = msn;
+
+	return mb;
+}
+
+
+static void conn_destructor(void *data)
+{
+	struct conn *conn = data;
+
+	list_unlink(&conn->le);
+
+	if (conn->fd >= 0) {
+		fd_close(conn->fd);
+		(void)close(conn->fd);
+	}
+
+	mem_deref(conn->rx);
+	mem_deref(conn->hdr);
+	mem_deref(conn->body);
+}
+
+
+static int conn_send(struct conn *conn)
+{
+	struct mbuf *hdr = conn->hdr;
+
+	while (mbuf_get_left(hdr) || conn->body_off < conn->body_len) {
+
+		struct iovec iov[2];
+		size_t left = mbuf_get_left(hdr);
+		ssize_t n;
+
+		iov[0].iov_base = mbuf_buf(hdr);
+		iov[0].iov_len  = left;
+		iov[1].iov_base = (void *)(conn->bodyp + conn->body_off);
+		iov[1].iov_len  = conn->body_len - conn->body_off;
+
+		n = writev(conn->fd, iov, 2);
+		if (n < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return fd_listen(conn->fd, FD_READ | FD_WRITE,
+						 conn_fd_handler, conn);
+			return errno;
+		}
+
+		conn->srv->n_bytes += n;
+
+		if ((size_t)n <= left) {
+			mbuf_advance(hdr, n);
+		}
+		else {
+			mbuf_skip_to_end(hdr);
+			conn->body_off += n - left;
+		}
+	}
+
+	/* response complete */
+	conn->busy = false;
+	conn->body = mem_deref(conn->body);
+	mbuf_rewind(hdr);
+
+	return fd_listen(conn->fd, FD_READ, conn_fd_handler, conn);
+}
+
+
+static int respond_hdr(struct conn *conn, uint16_t scode,
+		       const char *reason, const char *ctype,
+		       const char *cache, size_t len)
+{
+	mbuf_rewind(conn->hdr);
+
+	return mbuf_printf(conn->hdr,
+			   "HTTP/1.1 %u %s\r\n"
+			   "Content-Type: %s\r\n"
+			   "Content-Length: %zu\r\n"
+			   "Cache-Control: %s\r\n"
+			   "%s"
+			   "\r\n",
+			   scode, reason, ctype, len, cache,
+			   conn->close ? "Connection: close\r\n" : "");
+}
+
+
+/* send the header, then `len` bytes at `p` kept alive by `body` */
+static int respond_body(struct conn *conn, struct mbuf *body,
+			const uint8_t *p, size_t len)
+{
+	mbuf_set_pos(conn->hdr, 0);
+
+	conn->body     = mem_ref(body);
+	conn->bodyp    = p;
+	conn->body_len = len;
+	conn->body_off = 0;
+	conn->busy     = true;
+
+	++conn->srv->n_req;
+
+	return conn_send(conn);
+}
+
+
+static int respond(struct conn *conn, uint16_t scode, const char *reason,
+		   const char *ctype, const char *cache,
+		   struct mbuf *body, const uint8_t *p, size_t len)
+{
+	int err;
+
+	err = respond_hdr(conn, scode, reason, ctype, cache, len);
+	if (err)
+		return err;
+
+	return respond_body(conn, body, p, len);
+}
+
+
+static int box_hdr(struct mbuf *mb, uint32_t size, const char *type)
+{
+	int err;
+
+	err  = mbuf_write_u32(mb, htonl(size));
+	err |= mbuf_write_mem(mb, (const uint8_t *)type, 4);
+
+	return err;
+}
+
+
+/*
+ * The boxes in front of the payload: a moof with one track fragment of
+ * one sample, sequence number `seq`, and the header of its mdat
+ */
+static int fragment_write(struct mbuf *mb, uint32_t seq, size_t payload)
+{
+	int err;
+
+	err  = box_hdr(mb, MOOF_SIZE, "moof");
+
+	err |= box_hdr(mb, 16, "mfhd");
+	err |= mbuf_write_u32(mb, 0);                   /* version, flags */
+	err |= mbuf_write_u32(mb, htonl(seq));
+
+	err |= box_hdr(mb, 48, "traf");
+
+	err |= box_hdr(mb, 16, "tfhd");
+	err |= mbuf_write_u32(mb, htonl(0x020000));     /* base is moof */
+	err |= mbuf_write_u32(mb, htonl(1));            /* track ID */
+
+	err |= box_hdr(mb, 24, "trun");
+	err |= mbuf_write_u32(mb, htonl(0x000201));     /* offset, size */
+	err |= mbuf_write_u32(mb, htonl(1));            /* sample count */
+	err |= mbuf_write_u32(mb, htonl(FRAG_HDR));     /* data offset */
+	err |= mbuf_write_u32(mb, htonl((uint32_t)payload));
+
+	err |= box_hdr(mb, (uint32_t)(8 + payload), "mdat");
+
+	return err;
+}
+
+
+
+static int not_found(struct conn *conn)
+{
+	static const char msg[] = "not found\n";
+
+	return respond(conn, 404, "Not Found", "text/plain", "no-cache",
+		       NULL, (const uint8_t *)msg, sizeof(msg) - 1);
+}
+
+
+/* "vN.m3u8" or "vN_MSN.m4s", in the directory `dir` */
+static int serve_media(struct conn *conn, const struct pl *dir,
+		       const struct pl *name)
+{
+	const struct origin *o = conn->srv->org;
+	struct pl rest = *name;
+	uint64_t msn, last;
+	unsigned rend = 0;
+	size_t payload;
+	struct mbuf *mb;
+	int err;
+
+	if (!rest.l || rest.p[0] != 'v')
+		return not_found(conn);
+
+	pl_advance(&rest, 1);
+
+	if (!rest.l || rest.p[0] < '0' || rest.p[0] > '9')
+		return not_found(conn);
+
+	while (rest.l && rest.p[0] >= '0' && rest.p[0] <= '9') {
+		rend = rend * 10 + (rest.p[0] - '0');
+		pl_advance(&rest, 1);
+	}
+
+	if (rend >= o->rendc)
+		return not_found(conn);
+
+	/* only from the directory of the rendition */
+	if (o->subdirs) {
+		char vdir[16];
+
+		re_snprintf(vdir, sizeof(vdir), "v%u", rend);
+
+		if (pl_strcmp(dir, vdir))
+			return not_found(conn);
+	}
+
+	if (0 == pl_strcmp(&rest, ".m3u8")) {
+
+		mb = playlist_get(conn->srv, rend);
+		if (!mb)
+			return ENOMEM;
+
+		return respond(conn, 200, "OK", CTYPE_M3U8, "no-cache",
+			       mb, mb->buf, mb->end);
+	}
+
+	if (!rest.l || rest.p[0] != '_')
+		return not_found(conn);
+
+	pl_advance(&rest, 1);
+
+	msn = 0;
+	while (rest.l && rest.p[0] >= '0' && rest.p[0] <= '9') {
+		msn = msn * 10 + (rest.p[0] - '0');
+		pl_advance(&rest, 1);
+	}
+
+	if (pl_strcmp(&rest, ".m4s"))
+		return not_found(conn);
+
+	/* published, and not too long ago */
+	last = live_msn(o);
+	if (msn > last || msn + 2 * o->window < last)
+		return not_found(conn);
+
+	/* the fragment boxes go out with the header */
+	payload = o->segv[rend] > FRAG_HDR ? o->segv[rend] - FRAG_HDR : 0;
+
+	err = respond_hdr(conn, 200, "OK", "video/mp4", "max-age=3600",
+			  FRAG_HDR + payload);
+	err |= fragment_write(conn->hdr, (uint32_t)(msn + 1), payload);
+	if (err)
+		return err;
+
+	return respond_body(conn, NULL, o->zero, payload);
+}
+
+
+/* the request line and headers of one request, without the CRLFCRLF */
+static int handle_request(struct conn *conn, const struct pl *req)
+{
+	struct pl line, met, target, ver, dir, name, hdrs;
+	const char *p;
+
+	p = pl_strchr(req, '\n');
+
+	line.p = req->p;
+	line.l = p ? (size_t)(p - req->p) : req->l;
+
+	hdrs.p = line.p + line.l;
+	hdrs.l = req->l - line.l;
+
+	if (re_regex(line.p, line.l, "[A-Z]+ [^ ]+ HTTP/[0-9.]+",
+		     &met, &target, &ver)) {
+		conn->close = true;
+		return respond(conn, 400, "Bad Request", "text/plain",
+			       "no-cache", NULL, NULL, 0);
+	}
+
+	/* HTTP/1.0 closes, unless told otherwise */
+	if (0 == pl_strcmp(&ver, "1.0"))
+		conn->close = true;
+
+	while (hdrs.l) {
+		struct pl hline, hname, hval;
+
+		pl_advance(&hdrs, 1);   /* '\n' */
+
+		p = pl_strchr(&hdrs, '\n');
+		hline.p = hdrs.p;
+		hline.l = p ? (size_t)(p - hdrs.p) : hdrs.l;
+		pl_advance(&hdrs, hline.l);
+
+		if (re_regex(hline.p, hline.l, "[^:]+:[ \t]*[^\r]*",
+			     &hname, NULL, &hval))
+			continue;
+
+		if (0 == pl_strcasecmp(&hname, "connection")) {
+
+			if (0 == pl_strcasecmp(&hval, "close"))
+				conn->close = true;
+			else if (0 == pl_strcasecmp(&hval, "keep-alive"))
+				conn->close = false;
+		}
+	}
+
+	if (pl_strcmp(&met, "GET")) {
+		conn->close = true;
+		return respond(conn, 405, "Method Not Allowed", "text/plain",
+			       "no-cache", NULL, NULL, 0);
+	}
+
+	/* the last path segment, without the query */
+	p = pl_strchr(&target, '?');
+	if (p)
+		target.l = p - target.p;
+
+	p = pl_strrchr(&target, '/');
+	name.p = p ? p + 1 : target.p;
+	name.l = target.l - (name.p - target.p);
+
+	/* and the one before it */
+	dir.p = target.p;
+	dir.l = p ? (size_t)(p - target.p) : 0;
+
+	p = pl_strrchr(&dir, '/');
+	if (p) {
+		dir.l -= p + 1 - dir.p;
+		dir.p  = p + 1;
+	}
+
+	if (0 == pl_strcmp(&name, "master.m3u8")) {
+		const struct mbuf *mb = conn->srv->org->master;
+
+		return respond(conn, 200, "OK", CTYPE_M3U8, "no-cache",
+			       NULL, mb->buf, mb->end);
+	}
+
+	return serve_media(conn, &dir, &name);
+}
+
+
+/* handle the next complete request, one at a time */
+static int conn_process(struct conn *conn)
+{
+	struct mbuf *rx = conn->rx;
+	const char *end;
+	struct pl req, all;
+	size_t len;
+	int err;
+
+	while (!conn->busy && !conn->close && mbuf_get_left(rx)) {
+
+		pl_set_mbuf(&all, rx);
+
+		end = NULL;
+		for (len = 3; len < all.l; len++) {
+			if (!memcmp(all.p + len - 3, "\r\n\r\n", 4)) {
+				end = all.p + len - 3;
+				break;
+			}
+		}
+
+		if (!end) {
+			if (all.l > MAX_REQ_SIZE)
+				return EOVERFLOW;
+			break;
+		}
+
+		req.p = all.p;
+		req.l = end - all.p;
+
+		mbuf_advance(rx, req.l + 4);
+
+		err = handle_request(conn, &req);
+		if (err)
+			return err;
+	}
+
+	if (!mbuf_get_left(rx)) {
+		mbuf_rewind(rx);
+	}
+	else if (rx->pos) {
+		len = mbuf_get_left(rx);
+
+		memmove(rx->buf, mbuf_buf(rx), len);
+		rx->pos = 0;
+		rx->end = len;
+	}
+
+	return 0;
+}
+
+
+static void conn_fd_handler(int flags, void *arg)
+{
+	struct conn *conn = arg;
+	uint8_t buf[RECV_SIZE];
+	ssize_t n;
+	int err;
+
+	if ((flags & FD_WRITE) && conn->busy) {
+		err = conn_send(conn);
+		if (err)
+			goto out;
+	}
+
+	if (flags & FD_READ) {
+
+		n = recv(conn->fd, buf, sizeof(buf), 0);
+		if (n < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK ||
+			    errno == EINTR)
+				return;
+			err = errno;
+			goto out;
+		}
+		else if (n == 0) {
+			err = ECONNRESET;
+			goto out;
+		}
+
+		mbuf_set_pos(conn->rx, conn->rx->end);
+		err = mbuf_write_mem(conn->rx, buf, n);
+		mbuf_set_pos(conn->rx, 0);
+		if (err)
+			goto out;
+	}
+
+	err = conn_process(conn);
+	if (err)
+		goto out;
+
+	if (conn->close && !conn->busy)
+		err = ECONNRESET;
+
+ out:
+	if (err)
+		mem_deref(conn);
+}
+
+
+static void accept_handler(int flags, void *arg)
+{
+	struct server *srv = arg;
+	struct conn *conn;
+	int fd, one = 1;
+
+	for (;;) {
+
+		fd = accept(srv->lfd, NULL, NULL);
+		if (fd < 0)
+			return;
+
+		(void)fcntl(fd, F_SETFL, O_NONBLOCK);
+		(void)setsockopt(fd, IPPROTO_TCP, TCP_NODELAY,
+				 &one, sizeof(one));
+
+		conn = mem_zalloc(sizeof(*conn), conn_destructor);
+		if (!conn) {
+			(void)close(fd);
+			continue;
+		}
+
+		conn->srv = srv;
+		conn->fd  = fd;
+		conn->rx  = mbuf_alloc(1024);
+		conn->hdr = mbuf_alloc(256);
+
+		list_append(&srv->connl, &conn->le, conn);
+
+		if (!conn->rx || !conn->hdr ||
+		    fd_listen(fd, FD_READ, conn_fd_handler, conn))
+			mem_deref(conn);
+	}
+}
+
+
+static int listen_socket(int *fdp, const struct sa *laddr)
+{
+	int fd, one = 1;
+
+	fd = socket(sa_af(laddr), SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (fd < 0)
+		return errno;
+
+	(void)setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	(void)setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+
+	if (bind(fd, &laddr->u.sa, laddr->len) || listen(fd, 1024)) {
+		const int err = errno;
+		(void)close(fd);
+		return err;
+	}
+
+	*fdp = fd;
+
+	return 0;
+}
+
+
+static void set_ready(struct server *srv, int err)
+{
+	pthread_mutex_lock(&srv->mutex);
+	srv->ready = true;
+	srv->err = err;
+	pthread_cond_signal(&srv->cond);
+	pthread_mutex_unlock(&srv->mutex);
+}
+
+
+static void mqueue_handler(int id, void *data, void *arg)
+{
+	re_cancel();
+}
+
+
+static void *server_thread(void *arg)
+{
+	struct server *srv = arg;
+	sigset_t set;
+	unsigned i;
+	int err;
+
+	/* signals are handled by the main thread only */
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGTERM);
+	sigaddset(&set, SIGALRM);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	err = re_thread_init();
+	if (err) {
+		set_ready(srv, err);
+		return NULL;
+	}
+
+	err = fd_setsize(65536);
+	if (err)
+		goto out;
+
+	err = mqueue_alloc(&srv->mqueue, mqueue_handler, srv);
+	if (err)
+		goto out;
+
+	err = fd_listen(srv->lfd, FD_READ, accept_handler, srv);
+	if (err)
+		goto out;
+
+	set_ready(srv, 0);
+
+	re_main(NULL);
+
+ out:
+	if (err)
+		set_ready(srv, err);
+
+	list_flush(&srv->connl);
+
+	for (i=0; i<MAX_RENDITIONS; i++)
+		srv->plv[i].mb = mem_deref(srv->plv[i].mb);
+
+	fd_close(srv->lfd);
+	srv->mqueue = mem_deref(srv->mqueue);
+
+	re_thread_close();
+
+	return NULL;
+}
+
+
+/* stop the event loop of the server and wait for the thread to end */
+static void server_stop(struct server *srv)
+{
+	if (!srv || !srv->running)
+		return;
+
+	mqueue_push(srv->mqueue, 0, NULL);
+	pthread_join(srv->tid, NULL);
+	srv->running = false;
+}
+
+
+static void server_destructor(void *data)
+{
+	struct server *srv = data;
+
+	server_stop(srv);
+
+	if (srv->lfd >= 0)
+		(void)close(srv->lfd);
+
+	pthread_cond_destroy(&srv->cond);
+	pthread_mutex_destroy(&srv->mutex);
+}
+
+
+static int server_alloc(struct server **srvp, const struct origin *o,
+			const struct sa *laddr)
+{
+	struct server *srv;
+	int err;
+
+	srv = mem_zalloc(sizeof(*srv), server_destructor);
+	if (!srv)
+		return ENOMEM;
+
+	pthread_mutex_init(&srv->mutex, NULL);
+	pthread_cond_init(&srv->cond, NULL);
+
+	srv->org = o;
+	srv->lfd = -1;
+
+	err = listen_socket(&srv->lfd, laddr);
+	if (err)
+		goto out;
+
+	err = pthread_create(&srv->tid, NULL, server_thread, srv);
+	if (err)
+		goto out;
+
+	pthread_mutex_lock(&srv->mutex);
+	while (!srv->ready)
+		pthread_cond_wait(&srv->cond, &srv->mutex);
+	err = srv->err;
+	pthread_mutex_unlock(&srv->mutex);
+
+	if (err)
+		pthread_join(srv->tid, NULL);
+	else
+		srv->running = true;
+
+ out:
+	if (err)
+		mem_deref(srv);
+	else
+		*srvp = srv;
+
+	return err;
+}
+
+
+static void signal_handler(int signum)
+{
+	re_fprintf(stderr, "terminated on signal %d\n", signum);
+
+	re_cancel();
+}
+
+
+int main(int argc, char *argv[])
+{
+	struct server *srvv[MAX_THREADS];
+	const char *addr = "127.0.0.1";
+	uint32_t port = 8080, nthreads = 1;
+	uint64_t n_req = 0, n_bytes = 0;
+	size_t seg_max = 0;
+	struct sa laddr;
+	unsigned i;
+	int err = 0;
+
+	memset(srvv, 0, sizeof(srvv));
+
+	org.seg_dur   = 2.0;
+	org.rendc     = 3;
+	org.window    = 6;
+	org.bandwidth = 400000;
+
+	for (;;) {
+
+		const int c = getopt(argc, argv, "a:b:d:hl:p:r:s:w:D");
+		if (0 > c)
+			break;
+
+		switch (c) {
+
+		case 'a':
+			addr = optarg;
+			break;
+
+		case 'b':
+			org.bandwidth = atoi(optarg) * 1000;
+			break;
+
+		case 'd':
+			org.seg_dur = atof(optarg);
+			break;
+
+		case 'l':
+			org.window = atoi(optarg);
+			break;
+
+		case 'p':
+			port = atoi(optarg);
+			break;
+
+		case 'r':
+			org.rendc = atoi(optarg);
+			break;
+
+		case 's':
+			org.seg_size = atoi(optarg);
+			break;
+
+		case 'w':
+			nthreads = atoi(optarg);
+			break;
+
+		case 'D':
+			org.subdirs = true;
+			break;
+
+		case '?':
+		default:
+			err = EINVAL;
+			/*@fallthrough@*/
+		case 'h':
+			usage();
+			return err;
+		}
+	}
+
+	if (org.seg_dur <= 0.0 || !org.window || !org.bandwidth ||
+	    !org.rendc || org.rendc > MAX_RENDITIONS ||
+	    !nthreads || nthreads > MAX_THREADS || !port || port > 65535) {
+		usage();
+		return EINVAL;
+	}
+
+	err = sa_set_str(&laddr, addr, port);
+	if (err) {
+		re_fprintf(stderr, "invalid address: %s\n", addr);
+		return err;
+	}
+
+	for (i=0; i<org.rendc; i++) {
+
+		if (org.seg_size)
+			org.segv[i] = org.seg_size;
+		else
+			org.segv[i] = (size_t)(org.bandwidth *
+					       ladder[i].factor *
+					       org.seg_dur / 8);
+
+		seg_max = max(seg_max, org.segv[i]);
+	}
+
+	err = libre_init();
+	if (err) {
+		re_fprintf(stderr, "libre_init: %m\n", err);
+		return err;
+	}
+
+	org.zero = mem_zalloc(max(seg_max, 1), NULL);
+	if (!org.zero) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err = master_alloc(&org);
+	if (err)
+		goto out;
+
+	org.ts_start = time_usec();
+
+	for (i=0; i<nthreads; i++) {
+
+		err = server_alloc(&srvv[i], &org, &laddr);
+		if (err) {
+			re_fprintf(stderr, "server %u: %m\n", i, err);
+			goto out;
+		}
+	}
+
+	re_printf("hlsperf-origin -- http://%J/master.m3u8, %u renditions,"
+		  " %.1fs segments, window %u, threads %u\n",
+		  &laddr, org.rendc, org.seg_dur, org.window, nthreads);
+
+	(void)re_main(signal_handler);
+
+ out:
+	for (i=0; i<nthreads; i++) {
+
+		if (!srvv[i])
+			continue;
+
+		server_stop(srvv[i]);
+
+		n_req   += srvv[i]->n_req;
+		n_bytes += srvv[i]->n_bytes;
+
+		mem_deref(srvv[i]);
+	}
+
+	if (n_req)
+		re_printf("served %llu requests, %llu bytes\n",
+			  n_req, n_bytes);
+
+	mem_deref(org.master);
+	mem_deref(org.zero);
+
+	libre_close();
+
+	return err;
+}
@@ -0,0 +1,9 @@
+#
+# srcs.mk All tool source files.
+#
+# Copyright (C) 2019 Creytiv.com
+#
+
+TRACE_SRCS	+= trace.c
+
+ORIGIN_SRCS	+= origin.c
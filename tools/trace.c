@@ -0,0 +1,233 @@
+/**
+ * @file trace.c HLS Performance client -- trace decoder
+ *
+ * Copyright (C) 2019 Creytiv.com
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <re.h>
+#include "../src/hlsperf.h"
+
+
+/*
+ * Decodes the binary trace files written with hlsperf -T, as CSV or
+ * JSON lines, or computes the histograms of the traced requests per
+ * request kind. Only the records still in the ring are decoded.
+ */
+
+
+enum {
+	KINDS = REQ_INIT + 1,
+};
+
+enum format {
+	FMT_CSV = 0,
+	FMT_JSON,
+	FMT_HIST,
+};
+
+struct stats {
+	struct hist ttfb[KINDS];
+	struct hist total[KINDS];
+	uint64_t n_req[KINDS];
+	uint64_t n_err[KINDS];
+	uint64_t bytes[KINDS];
+	uint64_t n_lost;          /* overwritten in the ring */
+};
+
+
+static void usage(void)
+{
+	re_fprintf(stderr,
+		   "usage: hlsperf-trace [-j | -s] <trace-file>...\n"
+		   "\t-j  JSON lines instead of CSV\n"
+		   "\t-s  Histograms per request kind\n");
+}
+
+
+static void print_rec(enum format fmt, const struct trace_hdr *hdr,
+		      const struct trace_rec *r)
+{
+	const unsigned long long t = hdr->wall_start + r->ts;
+	char rend[8] = "";
+
+	if (r->rend != TRACE_NO_REND)
+		(void)re_snprintf(rend, sizeof(rend), "%u", r->rend);
+
+	if (fmt == FMT_JSON) {
+		(void)printf("{\"time_us\": %llu, \"worker\": %u,"
+			     " \"session\": %u, \"kind\": \"%s\","
+			     " \"rendition\": %s, \"uri_hash\": \"%08x\","
+			     " \"status\": %u, \"error\": %d, \"bytes\": %llu,"
+			     " \"dns_us\": %u, \"connect_us\": %u,"
+			     " \"ttfb_us\": %u, \"total_us\": %u,"
+			     " \"reused\": %s}\n",
+			     t, hdr->worker, r->sess, req_kind_name(r->kind),
+			     rend[0] ? rend : "null", r->uri_hash, r->scode,
+			     r->err, (unsigned long long)r->bytes,
+			     r->dns, r->connect, r->ttfb, r->total,
+			     r->flags & TRACE_REUSED ? "true" : "false");
+		return;
+	}
+
+	(void)printf("%llu,%u,%u,%s,%s,%08x,%u,%d,%llu,%u,%u,%u,%u,%d\n",
+		     t, hdr->worker, r->sess, req_kind_name(r->kind), rend,
+		     r->uri_hash, r->scode, r->err,
+		     (unsigned long long)r->bytes,
+		     r->dns, r->connect, r->ttfb, r->total,
+		     !!(r->flags & TRACE_REUSED));
+}
+
+
+static void stats_add(struct stats *st, const struct trace_rec *r)
+{
+	const unsigned k = r->kind < KINDS ? r->kind : REQ_OTHER;
+
+	++st->n_req[k];
+	st->bytes[k] += r->bytes;
+
+	if (r->err || r->scode >= 400) {
+		++st->n_err[k];
+		return;
+	}
+
+	hist_record(&st->ttfb[k], r->ttfb);
+	hist_record(&st->total[k], r->total);
+}
+
+
+static void stats_print(const struct stats *st)
+{
+	unsigned k;
+
+	re_printf("               p50/p90/p99/p99.9/max\n");
+
+	for (k=0; k<KINDS; k++) {
+
+		if (!st->n_req[k])
+			continue;
+
+		re_printf("%s: %llu requests, %llu errors, %llu bytes\n",
+			  req_kind_name(k), st->n_req[k], st->n_err[k],
+			  st->bytes[k]);
+		re_printf("  ttfb [ms]:   %H\n", hist_print, &st->ttfb[k]);
+		re_printf("  total [ms]:  %H\n", hist_print, &st->total[k]);
+	}
+
+	if (st->n_lost)
+		re_printf("%llu records were overwritten\n", st->n_lost);
+}
+
+
+static int decode(const char *path, enum format fmt, struct stats *st)
+{
+	struct trace_hdr hdr;
+	struct trace_rec r;
+	uint64_t n, i;
+	FILE *f;
+	int err = 0;
+
+	f = fopen(path, "r");
+	if (!f)
+		return errno;
+
+	if (1 != fread(&hdr, sizeof(hdr), 1, f)) {
+		err = EBADMSG;
+		goto out;
+	}
+
+	if (memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic)) ||
+	    hdr.version != TRACE_VERSION || hdr.recsize != sizeof(r) ||
+	    !hdr.capacity || (hdr.capacity & (hdr.capacity - 1))) {
+		err = EBADMSG;
+		goto out;
+	}
+
+	/* the last `capacity` records, oldest first */
+	n = min(hdr.head, hdr.capacity);
+	st->n_lost += hdr.head - n;
+
+	for (i = hdr.head - n; i < hdr.head; i++) {
+
+		const uint64_t ix = i & (hdr.capacity - 1);
+
+		if (fseek(f, sizeof(hdr) + ix * sizeof(r), SEEK_SET) ||
+		    1 != fread(&r, sizeof(r), 1, f)) {
+			err = EBADMSG;
+			goto out;
+		}
+
+		if (fmt == FMT_HIST)
+			stats_add(st, &r);
+		else
+			print_rec(fmt, &hdr, &r);
+	}
+
+ out:
+	(void)fclose(f);
+
+	return err;
+}
+
+
+int main(int argc, char *argv[])
+{
+	static struct stats st;
+	enum format fmt = FMT_CSV;
+	int i, err = 0;
+
+	for (;;) {
+
+		const int c = getopt(argc, argv, "hjs");
+		if (0 > c)
+			break;
+
+		switch (c) {
+
+		case 'j':
+			fmt = FMT_JSON;
+			break;
+
+		case 's':
+			fmt = FMT_HIST;
+			break;
+
+		case '?':
+		default:
+			err = EINVAL;
+			/*@fallthrough@*/
+		case 'h':
+			usage();
+			return err;
+		}
+	}
+
+	if (optind >= argc) {
+		usage();
+		return EINVAL;
+	}
+
+	if (fmt == FMT_CSV) {
+		(void)printf("time_us,worker,session,kind,rendition,uri_hash,"
+			     "status,error,bytes,dns_us,connect_us,ttfb_us,"
+			     "total_us,reused\n");
+	}
+
+	for (i=optind; i<argc; i++) {
+
+		err = decode(argv[i], fmt, &st);
+		if (err) {
+			re_fprintf(stderr, "%s: %m\n", argv[i], err);
+			return err;
+		}
+	}
+
+	if (fmt == FMT_HIST)
+		stats_print(&st);
+
+	return 0;
+}